@@ -35,6 +35,8 @@ G_BEGIN_DECLS
 #define   REALM_DBUS_SERVICE_INTERFACE             "org.freedesktop.realmd.Service"
 
 #define   REALM_DBUS_DIAGNOSTICS_SIGNAL            "Diagnostics"
+#define   REALM_DBUS_REALM_DISCOVERED_SIGNAL       "RealmDiscovered"
+#define   REALM_DBUS_DISCOVER_COMPLETED_SIGNAL     "DiscoverCompleted"
 
 #define   REALM_DBUS_ERROR_INTERNAL                "org.freedesktop.realmd.Error.Internal"
 #define   REALM_DBUS_ERROR_FAILED                  "org.freedesktop.realmd.Error.Failed"
@@ -47,6 +49,32 @@ G_BEGIN_DECLS
 #define   REALM_DBUS_ERROR_BAD_HOSTNAME            "org.freedesktop.realmd.Error.BadHostname"
 #define   REALM_DBUS_ERROR_CANCELLED               "org.freedesktop.realmd.Error.Cancelled"
 
+#define   REALM_DBUS_DETAIL_DOMAIN_CONTROLLER      "domain-controller"
+#define   REALM_DBUS_DETAIL_SERVER_SITE            "server-site"
+#define   REALM_DBUS_DETAIL_CLIENT_SITE            "client-site"
+#define   REALM_DBUS_DETAIL_SERVER_FLAGS           "server-flags"
+
+#define   REALM_DBUS_TIMING_PHASES                 "phases"
+#define   REALM_DBUS_TIMING_PHASE                  "phase"
+#define   REALM_DBUS_TIMING_SERVER                 "server"
+#define   REALM_DBUS_TIMING_OFFSET                 "offset"
+#define   REALM_DBUS_TIMING_DURATION               "duration"
+#define   REALM_DBUS_TIMING_ERROR                  "error"
+#define   REALM_DBUS_TIMING_USER_TIME              "user-time"
+#define   REALM_DBUS_TIMING_SYSTEM_TIME            "system-time"
+#define   REALM_DBUS_TIMING_MAX_RSS                "max-rss"
+#define   REALM_DBUS_TIMING_OUTPUT_BYTES           "output-bytes"
+#define   REALM_DBUS_TIMING_ERROR_BYTES            "error-bytes"
+
+#define   REALM_DBUS_DC_ADDRESS                    "address"
+#define   REALM_DBUS_DC_HOSTNAME                   "hostname"
+#define   REALM_DBUS_DC_DOMAIN                     "domain"
+#define   REALM_DBUS_DC_RTT                        "rtt"
+#define   REALM_DBUS_DC_SUCCESSES                  "successes"
+#define   REALM_DBUS_DC_FAILURES                   "failures"
+#define   REALM_DBUS_DC_BAD                        "bad"
+#define   REALM_DBUS_DC_UPDATED                    "updated"
+
 #define   REALM_DBUS_DISCOVERY_DOMAIN              "domain"
 #define   REALM_DBUS_DISCOVERY_KDCS                "kerberos-kdcs"
 #define   REALM_DBUS_DISCOVERY_REALM               "kerberos-realm"
@@ -69,6 +97,7 @@ G_BEGIN_DECLS
 #define   REALM_DBUS_OPTION_COMPUTER_NAME          "computer-name"
 #define   REALM_DBUS_OPTION_OS_NAME                "os-name"
 #define   REALM_DBUS_OPTION_OS_VERSION             "os-version"
+#define   REALM_DBUS_OPTION_FORCE_REFRESH          "force-refresh"
 
 #define   REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY   "active-directory"
 #define   REALM_DBUS_IDENTIFIER_WINBIND            "winbind"
@@ -24,6 +24,9 @@
 #include "realm-options.h"
 #include "realm-settings.h"
 
+/* Seconds before giving up on adcli, unless configured otherwise */
+#define ADCLI_TIMEOUT 300
+
 static void
 on_join_process (GObject *source,
                  GAsyncResult *result,
@@ -191,9 +194,10 @@ realm_adcli_enroll_join_async (RealmDisco *disco,
 
 	g_ptr_array_add (args, NULL);
 
-	realm_command_runv_async ((gchar **)args->pdata, environ, input,
-	                          invocation, on_join_process,
-	                          g_object_ref (task));
+	realm_command_runv_full_async ((gchar **)args->pdata, environ, input,
+	                               realm_command_get_timeout ("adcli", ADCLI_TIMEOUT),
+	                               REALM_COMMAND_NONE, invocation, on_join_process,
+	                               g_object_ref (task));
 
 	g_ptr_array_free (args, TRUE);
 	g_object_unref (task);
@@ -278,9 +282,10 @@ realm_adcli_enroll_delete_async (RealmDisco *disco,
 
 	g_ptr_array_add (args, NULL);
 
-	realm_command_runv_async ((gchar **)args->pdata, environ, input,
-	                          invocation, on_join_process,
-	                          g_object_ref (task));
+	realm_command_runv_full_async ((gchar **)args->pdata, environ, input,
+	                               realm_command_get_timeout ("adcli", ADCLI_TIMEOUT),
+	                               REALM_COMMAND_NONE, invocation, on_join_process,
+	                               g_object_ref (task));
 
 	g_ptr_array_free (args, TRUE);
 	g_object_unref (task);
@@ -93,6 +93,7 @@ typedef struct {
 	gchar *operation_id;
 	gboolean completed;
 	gint outstanding;
+	GList *pending;
 	GQueue failures;
 	GQueue results;
 	gint relevance;
@@ -123,6 +124,7 @@ discover_closure_free (gpointer data)
 	while (!g_queue_is_empty (&discover->failures))
 		g_error_free (g_queue_pop_head (&discover->failures));
 	g_list_free_full (discover->realms, g_object_unref);
+	g_list_free_full (discover->pending, g_object_unref);
 	g_free (discover);
 }
 
@@ -167,6 +169,43 @@ discover_process_results (GSimpleAsyncResult *res,
 	}
 }
 
+static gboolean
+discover_can_complete (DiscoverClosure *discover)
+{
+	DiscoverResult *disco;
+	gint best = 0;
+	GList *l;
+
+	if (discover->outstanding == 0)
+		return TRUE;
+
+	/* A streaming caller gets everything, the early results already went out */
+	if (realm_provider_is_streaming (discover->invocation))
+		return FALSE;
+
+	for (l = discover->results.head; l != NULL; l = g_list_next (l)) {
+		disco = l->data;
+		if (disco->realms && disco->relevance > best)
+			best = disco->relevance;
+	}
+
+	if (best == 0)
+		return FALSE;
+
+	/*
+	 * Done if nothing still running could return anything better. The
+	 * sssd and samba providers share a single in-flight domain discovery,
+	 * so the one left behind completes right after the other, and waiting
+	 * for it costs nothing.
+	 */
+	for (l = discover->pending; l != NULL; l = g_list_next (l)) {
+		if (realm_provider_get_max_relevance (l->data) >= best)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 static void
 on_provider_discover (GObject *source,
                       GAsyncResult *result,
@@ -179,9 +218,11 @@ on_provider_discover (GObject *source,
 	GError *error = NULL;
 	GList *realms;
 	gint relevance;
+	GList *l;
 
 	realms = realm_provider_discover_finish (REALM_PROVIDER (source), result, &relevance, &error);
 	if (error == NULL) {
+		realm_provider_stream_realms (discover->invocation, realms, relevance);
 		disco = g_new0 (DiscoverResult, 1);
 		disco->realms = realms;
 		disco->relevance = relevance;
@@ -192,9 +233,19 @@ on_provider_discover (GObject *source,
 
 	g_assert (discover->outstanding > 0);
 	discover->outstanding--;
+	l = g_list_find (discover->pending, source);
+	if (l != NULL) {
+		g_object_unref (l->data);
+		discover->pending = g_list_delete_link (discover->pending, l);
+	}
 
-	/* All done at this point? */
-	if (!discover->completed && discover->outstanding == 0) {
+	/*
+	 * All done at this point? Providers still going are left to finish
+	 * in the background, and register the realms they find.
+	 */
+	if (!discover->completed && discover_can_complete (discover)) {
+		if (discover->outstanding > 0)
+			g_debug ("Not waiting for %d less relevant providers", discover->outstanding);
 		discover_process_results (res, discover);
 		discover->completed = TRUE;
 		g_simple_async_result_complete (res);
@@ -209,6 +260,7 @@ realm_all_provider_discover_async (RealmProvider *provider,
                                    const gchar *string,
                                    GVariant *options,
                                    GDBusMethodInvocation *invocation,
+                                   GCancellable *cancellable,
                                    GAsyncReadyCallback callback,
                                    gpointer user_data)
 {
@@ -225,11 +277,16 @@ realm_all_provider_discover_async (RealmProvider *provider,
 	g_simple_async_result_set_op_res_gpointer (res, discover, discover_closure_free);
 
 	for (l = self->providers; l != NULL; l = g_list_next (l)) {
-		realm_provider_discover (l->data, string, options, invocation,
-		                         on_provider_discover, g_object_ref (res));
+		discover->pending = g_list_prepend (discover->pending, g_object_ref (l->data));
 		discover->outstanding++;
 	}
 
+	/* Some providers may complete right away, so track them all first */
+	for (l = self->providers; l != NULL; l = g_list_next (l)) {
+		realm_provider_discover (l->data, string, options, invocation, cancellable,
+		                         on_provider_discover, g_object_ref (res));
+	}
+
 	/* If no discovery going on then just complete */
 	if (discover->outstanding == 0) {
 		discover_process_results (res, discover);
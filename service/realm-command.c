@@ -19,13 +19,20 @@
 #include "realm-diagnostics.h"
 #include "realm-invocation.h"
 #include "realm-settings.h"
+#include "realm-timings.h"
 
 #include <glib/gi18n-lib.h>
+#include <glib-unix.h>
 
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <string.h>
+#include <unistd.h>
 
 enum {
 	FD_INPUT,
@@ -36,13 +43,32 @@ enum {
 
 #define DEBUG_VERBOSE 0
 
+/* How long a timed out process has to exit after SIGTERM */
+#define TERM_GRACE_SECONDS 5
+
+/* How much output is kept, unless all of it is asked for */
+#define OUTPUT_HEAD_SIZE 4096
+#define OUTPUT_TAIL_SIZE 16384
+
+/* How much output goes to diagnostics by default */
+#define DIAGNOSTICS_LIMIT 65536
+
 typedef struct {
 	GBytes *input;
 	gsize input_offset;
 	GString *output;
+	gboolean full_output;
+	gchar *tail;
+	gsize tail_start;
+	gsize tail_length;
+	guint64 omitted;
+	guint64 diagnostics_limit;
 	guint source_sig;
 	gint exit_code;
 	gboolean cancelled;
+	gboolean timed_out;
+	guint64 output_bytes;
+	guint64 error_bytes;
 	GDBusMethodInvocation *invocation;
 } CommandClosure;
 
@@ -52,12 +78,25 @@ typedef struct {
 
 	GPid child_pid;
 	guint child_sig;
+	int child_pidfd;
+
+	/* Resource accounting, reported once the process is done */
+	gchar *name;
+	gchar *failure;
+	struct rusage usage;
+	gboolean have_usage;
 
 	GSimpleAsyncResult *res;
 	CommandClosure *command;
 
 	GCancellable *cancellable;
 	guint cancel_sig;
+
+	/* Deadline handling, a timeout of zero means none */
+	guint timeout;
+	gint64 started;
+	guint timeout_sig;
+	guint kill_sig;
 } ProcessSource;
 
 static void
@@ -68,11 +107,55 @@ command_closure_free (gpointer data)
 		g_bytes_unref (command->input);
 	if (command->invocation)
 		g_object_unref (command->invocation);
-	g_string_free (command->output, TRUE);
+	if (command->output)
+		g_string_free (command->output, TRUE);
+	g_free (command->tail);
 	g_assert (command->source_sig == 0);
 	g_free (command);
 }
 
+static gint64
+timeval_to_usec (const struct timeval *tv)
+{
+	return (gint64)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+}
+
+static void
+report_process_usage (ProcessSource *process_source)
+{
+	CommandClosure *command = process_source->command;
+	RealmTimingsUsage usage;
+	gint64 elapsed;
+
+	elapsed = g_get_monotonic_time () - process_source->started;
+
+	usage.output_bytes = command->output_bytes;
+	usage.error_bytes = command->error_bytes;
+
+	if (process_source->have_usage) {
+		usage.user_time = timeval_to_usec (&process_source->usage.ru_utime);
+		usage.system_time = timeval_to_usec (&process_source->usage.ru_stime);
+		usage.max_rss = process_source->usage.ru_maxrss;
+		realm_diagnostics_info (command->invocation,
+		                        "%s took %.2f seconds, %.2f user, %.2f system, "
+		                        "%ld KiB max resident, %" G_GUINT64_FORMAT " bytes output, "
+		                        "%" G_GUINT64_FORMAT " bytes error output",
+		                        process_source->name, elapsed / 1000000.0,
+		                        usage.user_time / 1000000.0, usage.system_time / 1000000.0,
+		                        (long)usage.max_rss, usage.output_bytes, usage.error_bytes);
+	} else {
+		usage.user_time = usage.system_time = usage.max_rss = -1;
+		realm_diagnostics_info (command->invocation,
+		                        "%s took %.2f seconds, %" G_GUINT64_FORMAT " bytes output, "
+		                        "%" G_GUINT64_FORMAT " bytes error output",
+		                        process_source->name, elapsed / 1000000.0,
+		                        usage.output_bytes, usage.error_bytes);
+	}
+
+	realm_timings_record_usage (command->invocation, "command", process_source->name,
+	                            process_source->started, process_source->failure, &usage);
+}
+
 static void
 complete_source_is_done (ProcessSource *process_source)
 {
@@ -82,6 +165,8 @@ complete_source_is_done (ProcessSource *process_source)
 
 	g_assert (process_source->child_sig == 0);
 
+	report_process_usage (process_source);
+
 	if (process_source->cancel_sig) {
 		g_signal_handler_disconnect (process_source->cancellable, process_source->cancel_sig);
 		process_source->cancel_sig = 0;
@@ -165,12 +250,115 @@ on_process_source_finalize (GSource *source)
 
 	g_assert (!process_source->child_pid);
 	g_assert (!process_source->child_sig);
+	g_assert (process_source->child_pidfd < 0);
+	g_assert (!process_source->timeout_sig);
+	g_assert (!process_source->kill_sig);
+
+	g_free (process_source->name);
+	g_free (process_source->failure);
+}
+
+static void
+capture_output (CommandClosure *command,
+                const gchar *data,
+                gsize length)
+{
+	gsize overflow;
+	gsize chunk;
+	gsize at;
+
+	/* The head is filled first, and is everything if asked for */
+	if (command->full_output || command->output->len < OUTPUT_HEAD_SIZE) {
+		chunk = length;
+		if (!command->full_output)
+			chunk = MIN (length, OUTPUT_HEAD_SIZE - command->output->len);
+		g_string_append_len (command->output, data, chunk);
+		data += chunk;
+		length -= chunk;
+	}
+
+	if (length == 0)
+		return;
+
+	/* The rest goes round the tail, overwriting what's oldest */
+	if (command->tail == NULL)
+		command->tail = g_malloc (OUTPUT_TAIL_SIZE);
+
+	while (length > 0) {
+		at = (command->tail_start + command->tail_length) % OUTPUT_TAIL_SIZE;
+		chunk = MIN (length, OUTPUT_TAIL_SIZE - at);
+		memcpy (command->tail + at, data, chunk);
+
+		command->tail_length += chunk;
+		if (command->tail_length > OUTPUT_TAIL_SIZE) {
+			overflow = command->tail_length - OUTPUT_TAIL_SIZE;
+			command->tail_start = (command->tail_start + overflow) % OUTPUT_TAIL_SIZE;
+			command->tail_length = OUTPUT_TAIL_SIZE;
+			command->omitted += overflow;
+		}
+
+		data += chunk;
+		length -= chunk;
+	}
+}
+
+static void
+finish_output (CommandClosure *command)
+{
+	gsize chunk;
+
+	if (command->tail_length == 0)
+		return;
+
+	if (command->omitted > 0) {
+		g_string_append_printf (command->output, "\n[... %" G_GUINT64_FORMAT " bytes of output omitted ...]\n",
+		                        command->omitted);
+	}
+
+	chunk = MIN (command->tail_length, OUTPUT_TAIL_SIZE - command->tail_start);
+	g_string_append_len (command->output, command->tail + command->tail_start, chunk);
+	g_string_append_len (command->output, command->tail, command->tail_length - chunk);
+
+	g_free (command->tail);
+	command->tail = NULL;
+	command->tail_start = command->tail_length = 0;
+}
+
+static void
+send_diagnostics (ProcessSource *process_source,
+                  const gchar *data,
+                  gsize length)
+{
+	CommandClosure *command = process_source->command;
+	guint64 sent;
+
+	if (command->diagnostics_limit == 0) {
+		realm_diagnostics_info_data (command->invocation, data, length);
+		return;
+	}
+
+	sent = command->output_bytes + command->error_bytes;
+	if (sent >= command->diagnostics_limit)
+		return;
+
+	if (sent + length <= command->diagnostics_limit) {
+		realm_diagnostics_info_data (command->invocation, data, length);
+		return;
+	}
+
+	length = command->diagnostics_limit - sent;
+	realm_diagnostics_info_data (command->invocation, data, length);
+	if (data[length - 1] != '\n')
+		realm_diagnostics_info_data (command->invocation, "\n", 1);
+	realm_diagnostics_info (command->invocation,
+	                        "Not showing more than %" G_GUINT64_FORMAT " bytes of output from %s",
+	                        command->diagnostics_limit, process_source->name);
 }
 
 static gboolean
-read_output (int fd,
-             GString *buffer,
-             GDBusMethodInvocation *invocation)
+read_output (ProcessSource *process_source,
+             int fd,
+             guint64 *count)
 {
 	gchar block[1024];
 	gssize result;
@@ -184,8 +372,9 @@ read_output (int fd,
 				continue;
 			return FALSE;
 		} else if (result > 0) {
-			realm_diagnostics_info_data (invocation, block, result);
-			g_string_append_len (buffer, block, result);
+			send_diagnostics (process_source, block, result);
+			capture_output (process_source->command, block, result);
+			*count += result;
 		}
 	} while (result == sizeof (block));
 
@@ -210,7 +399,7 @@ on_process_source_input (CommandClosure *command,
 		                length - command->input_offset);
 		if (result < 0) {
 			if (errno != EINTR && errno != EAGAIN) {
-				if (!command->cancelled || errno != EPIPE)
+				if ((!command->cancelled && !command->timed_out) || errno != EPIPE)
 					g_warning ("couldn't write output data to process: %s", g_strerror (errno));
 				g_bytes_unref (command->input);
 				command->input = NULL;
@@ -235,7 +424,7 @@ on_process_source_output (CommandClosure *command,
                           ProcessSource *process_source,
                           gint fd)
 {
-	if (!read_output (fd, command->output, command->invocation)) {
+	if (!read_output (process_source, fd, &command->output_bytes)) {
 		g_warning ("couldn't read output data from process");
 		return FALSE;
 	}
@@ -248,7 +437,7 @@ on_process_source_error (CommandClosure *command,
                          ProcessSource *process_source,
                          gint fd)
 {
-	if (!read_output (fd, command->output, command->invocation)) {
+	if (!read_output (process_source, fd, &command->error_bytes)) {
 		g_warning ("couldn't read error data from process");
 		return FALSE;
 	}
@@ -321,23 +510,43 @@ static GSourceFuncs process_source_funcs = {
 };
 
 static void
-on_unix_process_child_exited (GPid pid,
-                              gint status,
-                              gpointer user_data)
+process_child_exited (ProcessSource *process_source,
+                      gint status,
+                      const struct rusage *usage)
 {
-	ProcessSource *process_source = user_data;
 	CommandClosure *command = process_source->command;
 	gint code;
 	guint i;
 
-	g_debug ("process exited: %d", (int)pid);
+	g_debug ("process exited: %d", (int)process_source->child_pid);
+
+	if (usage) {
+		process_source->usage = *usage;
+		process_source->have_usage = TRUE;
+	}
 
 	g_spawn_close_pid (process_source->child_pid);
 	process_source->child_pid = 0;
 	process_source->child_sig = 0;
 
-	if (WIFEXITED (status)) {
+	if (process_source->timeout_sig)
+		g_source_remove (process_source->timeout_sig);
+	process_source->timeout_sig = 0;
+	if (process_source->kill_sig)
+		g_source_remove (process_source->kill_sig);
+	process_source->kill_sig = 0;
+
+	/* However it exited in the end, it didn't finish in time */
+	if (command->timed_out) {
+		g_simple_async_result_set_error (process_source->res, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+		                                 _("Process timed out after %.1f seconds"),
+		                                 (g_get_monotonic_time () - process_source->started) / 1000000.0);
+		process_source->failure = g_strdup ("timed out");
+
+	} else if (WIFEXITED (status)) {
 		command->exit_code = WEXITSTATUS (status);
+		if (command->exit_code != 0)
+			process_source->failure = g_strdup_printf ("exit code %d", command->exit_code);
 
 	} else if (WIFSIGNALED (status)) {
 		code = WTERMSIG (status);
@@ -345,6 +554,7 @@ on_unix_process_child_exited (GPid pid,
 		if (!command->cancelled)
 			g_simple_async_result_set_error (process_source->res, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
 			                                 _("Process was terminated with signal: %d"), code);
+		process_source->failure = g_strdup (command->cancelled ? "cancelled" : "terminated");
 	}
 
 	for (i = 0; i < NUM_FDS; ++i) {
@@ -355,6 +565,62 @@ on_unix_process_child_exited (GPid pid,
 	complete_source_is_done (process_source);
 }
 
+static void
+on_unix_process_child_exited (GPid pid,
+                              gint status,
+                              gpointer user_data)
+{
+	/* GLib reaped the process for us, so there's no resource usage */
+	process_child_exited (user_data, status, NULL);
+}
+
+static gboolean
+on_unix_process_pidfd_ready (gint fd,
+                             GIOCondition condition,
+                             gpointer user_data)
+{
+	ProcessSource *process_source = user_data;
+	struct rusage usage;
+	gint status = 0;
+	pid_t ret;
+
+	do {
+		ret = wait4 (process_source->child_pid, &status, WNOHANG, &usage);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret == 0)
+		return TRUE; /* not yet, call again */
+
+	close_fd (&process_source->child_pidfd);
+
+	if (ret < 0) {
+		g_warning ("couldn't wait for process: %s", g_strerror (errno));
+		g_simple_async_result_set_error (process_source->res, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+		                                 _("Couldn't wait for process: %s"), g_strerror (errno));
+		process_child_exited (process_source, W_EXITCODE (255, 0), NULL);
+	} else {
+		process_child_exited (process_source, status, &usage);
+	}
+
+	return FALSE; /* child_sig is cleared above */
+}
+
+static int
+open_process_pidfd (GPid pid)
+{
+#ifdef SYS_pidfd_open
+	int fd;
+
+	fd = syscall (SYS_pidfd_open, pid, 0);
+	if (fd >= 0)
+		fcntl (fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 static void
 on_unix_process_child_setup (gpointer user_data)
 {
@@ -383,6 +649,43 @@ on_unix_process_child_setup (gpointer user_data)
 	}
 }
 
+static gboolean
+on_process_kill (gpointer user_data)
+{
+	ProcessSource *process_source = user_data;
+
+	process_source->kill_sig = 0;
+	if (process_source->child_pid) {
+		g_debug ("sending kill signal to process: %d", (int)process_source->child_pid);
+		kill (-process_source->child_pid, SIGKILL);
+	}
+
+	return FALSE;
+}
+
+static gboolean
+on_process_timeout (gpointer user_data)
+{
+	ProcessSource *process_source = user_data;
+
+	process_source->timeout_sig = 0;
+	if (!process_source->child_pid)
+		return FALSE;
+
+	realm_diagnostics_info (process_source->command->invocation,
+	                        "Process did not finish within %u seconds, terminating it",
+	                        process_source->timeout);
+	process_source->command->timed_out = TRUE;
+
+	/* The process leads its own group, so this reaches anything it started too */
+	kill (-process_source->child_pid, SIGTERM);
+	process_source->kill_sig = g_timeout_add_seconds_full (G_PRIORITY_DEFAULT, TERM_GRACE_SECONDS,
+	                                                       on_process_kill, g_source_ref ((GSource *)process_source),
+	                                                       (GDestroyNotify)g_source_unref);
+
+	return FALSE;
+}
+
 static void
 on_cancellable_cancelled (GCancellable *cancellable,
                           gpointer user_data)
@@ -411,6 +714,49 @@ realm_command_runv_async (gchar **argv,
                           GDBusMethodInvocation *invocation,
                           GAsyncReadyCallback callback,
                           gpointer user_data)
+{
+	realm_command_runv_full_async (argv, environ, input, 0, REALM_COMMAND_NONE,
+	                               invocation, callback, user_data);
+}
+
+static guint64
+get_diagnostics_limit (const gchar *name)
+{
+	gdouble limit;
+	gchar *key;
+
+	key = g_strdup_printf ("%s.diagnostics-limit", name);
+	limit = realm_settings_double ("commands", key, DIAGNOSTICS_LIMIT);
+	g_free (key);
+
+	return limit > 0 ? (guint64)limit : 0;
+}
+
+guint
+realm_command_get_timeout (const gchar *name,
+                           guint default_timeout)
+{
+	gdouble timeout;
+	gchar *key;
+
+	g_return_val_if_fail (name != NULL, default_timeout);
+
+	key = g_strdup_printf ("%s.timeout", name);
+	timeout = realm_settings_double ("commands", key, default_timeout);
+	g_free (key);
+
+	return timeout > 0 ? (guint)timeout : 0;
+}
+
+void
+realm_command_runv_full_async (gchar **argv,
+                               gchar **environ,
+                               GBytes *input,
+                               guint timeout,
+                               RealmCommandFlags flags,
+                               GDBusMethodInvocation *invocation,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data)
 {
 	GSimpleAsyncResult *res;
 	CommandClosure *command;
@@ -477,6 +823,7 @@ realm_command_runv_async (gchar **argv,
 	command = g_new0 (CommandClosure, 1);
 	command->input = input ? g_bytes_ref (input) : NULL;
 	command->output = g_string_sized_new (128);
+	command->full_output = (flags & REALM_COMMAND_FULL_OUTPUT) ? TRUE : FALSE;
 	command->invocation = invocation ? g_object_ref (invocation) : NULL;
 	g_simple_async_result_set_op_res_gpointer (res, command, command_closure_free);
 
@@ -498,6 +845,11 @@ realm_command_runv_async (gchar **argv,
 	process_source->res = g_object_ref (res);
 	process_source->command = command;
 	process_source->child_pid = pid;
+	process_source->child_pidfd = -1;
+	process_source->name = g_path_get_basename (argv[0]);
+	command->diagnostics_limit = get_diagnostics_limit (process_source->name);
+	process_source->timeout = timeout;
+	process_source->started = g_get_monotonic_time ();
 
 	process_source->polls[FD_INPUT].fd = input_fd;
 	if (input_fd >= 0) {
@@ -527,12 +879,29 @@ realm_command_runv_async (gchar **argv,
 	g_source_set_callback (source, unused_callback, NULL, NULL);
 	command->source_sig = g_source_attach (source, g_main_context_default ());
 
-	/* This assumes the outstanding reference to source */
+	/*
+	 * This assumes the outstanding reference to source. We reap the child
+	 * ourselves with wait4() when we can, in order to get its resource usage.
+	 */
 	g_assert (process_source->child_sig == 0);
-	process_source->child_sig = g_child_watch_add_full (G_PRIORITY_DEFAULT, pid,
-	                                                    on_unix_process_child_exited,
-	                                                    g_source_ref (source),
-	                                                    (GDestroyNotify)g_source_unref);
+	process_source->child_pidfd = open_process_pidfd (pid);
+	if (process_source->child_pidfd >= 0) {
+		process_source->child_sig = g_unix_fd_add_full (G_PRIORITY_DEFAULT, process_source->child_pidfd,
+		                                                G_IO_IN, on_unix_process_pidfd_ready,
+		                                                g_source_ref (source),
+		                                                (GDestroyNotify)g_source_unref);
+	} else {
+		process_source->child_sig = g_child_watch_add_full (G_PRIORITY_DEFAULT, pid,
+		                                                    on_unix_process_child_exited,
+		                                                    g_source_ref (source),
+		                                                    (GDestroyNotify)g_source_unref);
+	}
+
+	if (timeout > 0) {
+		process_source->timeout_sig = g_timeout_add_seconds_full (G_PRIORITY_DEFAULT, timeout,
+		                                                          on_process_timeout, g_source_ref (source),
+		                                                          (GDestroyNotify)g_source_unref);
+	}
 
 	/* source is unreffed in complete_if_source_is_done() */
 }
@@ -587,7 +956,9 @@ realm_command_run_known_async (const gchar *known_command,
 	}
 
 	if (message == NULL) {
-		realm_command_runv_async (argv, environ, NULL, invocation, callback, user_data);
+		realm_command_runv_full_async (argv, environ, NULL,
+		                               realm_command_get_timeout (known_command, 0),
+		                               REALM_COMMAND_NONE, invocation, callback, user_data);
 		g_free (argv);
 
 	} else {
@@ -621,6 +992,7 @@ realm_command_run_finish (GAsyncResult *result,
 
 	command = g_simple_async_result_get_op_res_gpointer (res);
 	if (output) {
+		finish_output (command);
 		*output = command->output;
 		command->output = NULL;
 	}
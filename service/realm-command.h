@@ -19,6 +19,11 @@
 
 G_BEGIN_DECLS
 
+typedef enum {
+	REALM_COMMAND_NONE = 0,
+	REALM_COMMAND_FULL_OUTPUT = 1 << 0,
+} RealmCommandFlags;
+
 void                realm_command_runv_async                   (gchar **name_or_path_and_arguments,
                                                                 gchar **environ,
                                                                 GBytes *input,
@@ -26,6 +31,18 @@ void                realm_command_runv_async                   (gchar **name_or_
                                                                 GAsyncReadyCallback callback,
                                                                 gpointer user_data);
 
+void                realm_command_runv_full_async              (gchar **name_or_path_and_arguments,
+                                                                gchar **environ,
+                                                                GBytes *input,
+                                                                guint timeout,
+                                                                RealmCommandFlags flags,
+                                                                GDBusMethodInvocation *invocation,
+                                                                GAsyncReadyCallback callback,
+                                                                gpointer user_data);
+
+guint               realm_command_get_timeout                  (const gchar *name,
+                                                                guint default_timeout);
+
 void                realm_command_run_known_async              (const gchar *known_command,
                                                                 gchar **environ,
                                                                 GDBusMethodInvocation *invocation,
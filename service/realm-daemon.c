@@ -19,9 +19,11 @@
 #include "realm-dbus-constants.h"
 #include "realm-dbus-generated.h"
 #include "realm-diagnostics.h"
+#include "realm-disco-domain.h"
 #include "realm-errors.h"
 #include "realm-example-provider.h"
 #include "realm-invocation.h"
+#include "realm-kerberos.h"
 #include "realm-kerberos-provider.h"
 #include "realm-samba-provider.h"
 #include "realm-settings.h"
@@ -163,6 +165,92 @@ realm_daemon_export_object (GDBusObjectSkeleton *object)
 	g_dbus_object_manager_server_export (object_server, object);
 }
 
+static void   revalidate_next   (GQueue *domains);
+
+static void
+on_revalidate_realm (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	GQueue *domains = user_data;
+	RealmProvider *all_provider;
+	RealmDisco *disco;
+	GList *realms, *l;
+	gchar *domain;
+
+	domain = g_queue_pop_head (domains);
+	disco = realm_disco_domain_finish (result, NULL);
+
+	if (disco == NULL) {
+		g_message ("Couldn't revalidate configured realm: %s", domain);
+
+	/* Give the configured realms what was actually discovered */
+	} else if (object_server) {
+		all_provider = g_object_get_data (G_OBJECT (object_server), "the-provider");
+		realms = realm_provider_get_realms (all_provider);
+		for (l = realms; l != NULL; l = g_list_next (l)) {
+			if (realm_kerberos_is_configured (l->data) &&
+			    g_ascii_strcasecmp (realm_kerberos_get_domain_name (l->data), domain) == 0)
+				realm_kerberos_set_disco (l->data, disco);
+		}
+		g_list_free (realms);
+	}
+
+	realm_disco_unref (disco);
+	g_free (domain);
+	revalidate_next (domains);
+}
+
+static gboolean
+on_revalidate_idle (gpointer user_data)
+{
+	GQueue *domains = user_data;
+	const gchar *domain;
+
+	domain = g_queue_peek_head (domains);
+	g_debug ("revalidating configured realm: %s", domain);
+
+	/* No invocation: this is not on behalf of anyone, and holds nothing */
+	realm_disco_domain_async (domain, NULL, NULL, NULL, on_revalidate_realm, domains);
+	return FALSE;
+}
+
+static void
+revalidate_next (GQueue *domains)
+{
+	if (g_queue_is_empty (domains)) {
+		g_queue_free (domains);
+		return;
+	}
+
+	/* One at a time, and only when nothing else needs doing */
+	g_idle_add_full (G_PRIORITY_LOW, on_revalidate_idle, domains, NULL);
+}
+
+static void
+revalidate_realms (RealmProvider *all_provider)
+{
+	const gchar *domain;
+	GQueue *domains;
+	GList *realms, *l;
+
+	domains = g_queue_new ();
+	realms = realm_provider_get_realms (all_provider);
+	for (l = realms; l != NULL; l = g_list_next (l)) {
+		if (!realm_kerberos_is_configured (l->data))
+			continue;
+		domain = realm_kerberos_get_domain_name (l->data);
+		if (domain == NULL)
+			continue;
+		if (g_queue_find_custom (domains, domain, (GCompareFunc)g_ascii_strcasecmp))
+			continue;
+		g_queue_push_tail (domains, g_strdup (domain));
+	}
+	g_list_free (realms);
+
+	revalidate_next (domains);
+}
+
 static void
 initialize_service (GDBusConnection *connection)
 {
@@ -212,6 +300,10 @@ initialize_service (GDBusConnection *connection)
 	g_object_set_data_full (G_OBJECT (object_server), "the-provider",
 	                        all_provider, g_object_unref);
 
+	/* Warm the discovery cache for configured realms in the background */
+	if (realm_settings_boolean ("discovery", "revalidate-at-start", FALSE))
+		revalidate_realms (all_provider);
+
 	/* Matches the hold() in main() */
 	if (!realm_daemon_release ("startup"))
 		g_warn_if_reached ();
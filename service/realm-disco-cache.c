@@ -0,0 +1,392 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#include "realm-dbus-constants.h"
+#include "realm-disco-cache.h"
+#include "realm-settings.h"
+
+#include <glib/gstdio.h>
+
+#include <string.h>
+
+#define REALM_DISCO_CACHE_FILE   CACHEDIR "/discovery-cache"
+
+typedef struct {
+	RealmDisco *disco;
+	gint64 expires;
+} CacheEntry;
+
+typedef struct {
+	gchar *message;
+	gint64 expires;
+} FailureEntry;
+
+static GHashTable *disco_cache = NULL;
+static GHashTable *failure_cache = NULL;
+static gchar *dhcp_domain = NULL;
+
+static void
+cache_entry_free (gpointer data)
+{
+	CacheEntry *entry = data;
+	realm_disco_unref (entry->disco);
+	g_free (entry);
+}
+
+static void
+failure_entry_free (gpointer data)
+{
+	FailureEntry *entry = data;
+	g_free (entry->message);
+	g_free (entry);
+}
+
+static gint64
+cache_now (void)
+{
+	return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static gchar *
+cache_key (const gchar *input)
+{
+	gchar *key;
+
+	key = g_ascii_strdown (input, -1);
+	return g_strstrip (key);
+}
+
+static gboolean
+cache_persist (void)
+{
+	return realm_settings_boolean ("discovery", "cache-persist", FALSE);
+}
+
+static const gchar *
+cache_server_software (const gchar *value)
+{
+	/* RealmDisco only ever points at these constant strings */
+	if (g_strcmp0 (value, REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY) == 0)
+		return REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY;
+	else if (g_strcmp0 (value, REALM_DBUS_IDENTIFIER_IPA) == 0)
+		return REALM_DBUS_IDENTIFIER_IPA;
+	return NULL;
+}
+
+static RealmDisco *
+load_cache_entry (GKeyFile *key_file,
+                  const gchar *group)
+{
+	RealmDisco *disco;
+	GInetAddress *inet;
+	gchar *value;
+	gint port;
+
+	value = g_key_file_get_string (key_file, group, "domain-name", NULL);
+	if (value == NULL)
+		return NULL;
+
+	disco = realm_disco_new (value);
+	g_free (value);
+
+	disco->kerberos_realm = g_key_file_get_string (key_file, group, "kerberos-realm", NULL);
+	disco->workgroup = g_key_file_get_string (key_file, group, "workgroup", NULL);
+	disco->explicit_server = g_key_file_get_string (key_file, group, "explicit-server", NULL);
+	disco->explicit_netbios = g_key_file_get_string (key_file, group, "explicit-netbios", NULL);
+	disco->domain_controller = g_key_file_get_string (key_file, group, "domain-controller", NULL);
+	disco->server_site = g_key_file_get_string (key_file, group, "server-site", NULL);
+	disco->client_site = g_key_file_get_string (key_file, group, "client-site", NULL);
+	disco->server_flags = g_key_file_get_uint64 (key_file, group, "server-flags", NULL);
+
+	value = g_key_file_get_string (key_file, group, "server-software", NULL);
+	disco->server_software = cache_server_software (value);
+	g_free (value);
+
+	value = g_key_file_get_string (key_file, group, "server-address", NULL);
+	port = g_key_file_get_integer (key_file, group, "server-port", NULL);
+	if (value != NULL) {
+		inet = g_inet_address_new_from_string (value);
+		if (inet != NULL) {
+			disco->server_address = g_inet_socket_address_new (inet, port > 0 ? port : 389);
+			g_object_unref (inet);
+		}
+	}
+	g_free (value);
+
+	return disco;
+}
+
+static void
+load_cache_file (void)
+{
+	GError *error = NULL;
+	GKeyFile *key_file;
+	CacheEntry *entry;
+	RealmDisco *disco;
+	gchar **groups;
+	gint64 expires;
+	gint64 now;
+	gint i;
+
+	key_file = g_key_file_new ();
+	if (!g_key_file_load_from_file (key_file, REALM_DISCO_CACHE_FILE, G_KEY_FILE_NONE, &error)) {
+		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_message ("Couldn't load discovery cache: %s", error->message);
+		g_error_free (error);
+		g_key_file_free (key_file);
+		return;
+	}
+
+	now = cache_now ();
+	groups = g_key_file_get_groups (key_file, NULL);
+	for (i = 0; groups[i] != NULL; i++) {
+		expires = g_key_file_get_int64 (key_file, groups[i], "expires", NULL);
+		if (expires <= now)
+			continue;
+		disco = load_cache_entry (key_file, groups[i]);
+		if (disco == NULL)
+			continue;
+		entry = g_new0 (CacheEntry, 1);
+		entry->disco = disco;
+		entry->expires = expires;
+		g_hash_table_insert (disco_cache, g_strdup (groups[i]), entry);
+	}
+
+	g_strfreev (groups);
+	g_key_file_free (key_file);
+}
+
+static void
+save_cache_file (void)
+{
+	GHashTableIter iter;
+	GError *error = NULL;
+	GKeyFile *key_file;
+	CacheEntry *entry;
+	RealmDisco *disco;
+	GInetSocketAddress *inet;
+	gchar *address;
+	gchar *contents;
+	gsize length;
+	gint64 now;
+	gchar *key;
+
+	key_file = g_key_file_new ();
+	now = cache_now ();
+
+	g_hash_table_iter_init (&iter, disco_cache);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&entry)) {
+		/* Only things that look like a group name can be stored */
+		if (entry->expires <= now || strpbrk (key, "[]\r\n") != NULL)
+			continue;
+
+		disco = entry->disco;
+		g_key_file_set_int64 (key_file, key, "expires", entry->expires);
+		g_key_file_set_string (key_file, key, "domain-name", disco->domain_name);
+		if (disco->kerberos_realm)
+			g_key_file_set_string (key_file, key, "kerberos-realm", disco->kerberos_realm);
+		if (disco->workgroup)
+			g_key_file_set_string (key_file, key, "workgroup", disco->workgroup);
+		if (disco->explicit_server)
+			g_key_file_set_string (key_file, key, "explicit-server", disco->explicit_server);
+		if (disco->explicit_netbios)
+			g_key_file_set_string (key_file, key, "explicit-netbios", disco->explicit_netbios);
+		if (disco->server_software)
+			g_key_file_set_string (key_file, key, "server-software", disco->server_software);
+		if (disco->domain_controller)
+			g_key_file_set_string (key_file, key, "domain-controller", disco->domain_controller);
+		if (disco->server_site)
+			g_key_file_set_string (key_file, key, "server-site", disco->server_site);
+		if (disco->client_site)
+			g_key_file_set_string (key_file, key, "client-site", disco->client_site);
+		if (disco->server_flags)
+			g_key_file_set_uint64 (key_file, key, "server-flags", disco->server_flags);
+		if (disco->server_address && G_IS_INET_SOCKET_ADDRESS (disco->server_address)) {
+			inet = G_INET_SOCKET_ADDRESS (disco->server_address);
+			address = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+			g_key_file_set_string (key_file, key, "server-address", address);
+			g_key_file_set_integer (key_file, key, "server-port", g_inet_socket_address_get_port (inet));
+			g_free (address);
+		}
+	}
+
+	contents = g_key_file_to_data (key_file, &length, NULL);
+	if (!g_file_set_contents (REALM_DISCO_CACHE_FILE, contents, length, &error)) {
+		g_message ("Couldn't write discovery cache: %s", error->message);
+		g_error_free (error);
+	}
+
+	g_free (contents);
+	g_key_file_free (key_file);
+}
+
+static void
+prepare_cache (void)
+{
+	if (disco_cache)
+		return;
+
+	disco_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, cache_entry_free);
+	if (cache_persist ())
+		load_cache_file ();
+}
+
+RealmDisco *
+realm_disco_cache_lookup (const gchar *input,
+                          gint *expires_in)
+{
+	CacheEntry *entry;
+	gint64 now;
+	gchar *key;
+
+	g_return_val_if_fail (input != NULL, NULL);
+
+	prepare_cache ();
+
+	key = cache_key (input);
+	entry = g_hash_table_lookup (disco_cache, key);
+
+	now = cache_now ();
+	if (entry && entry->expires <= now) {
+		g_hash_table_remove (disco_cache, key);
+		entry = NULL;
+	}
+
+	g_free (key);
+
+	if (entry == NULL)
+		return NULL;
+
+	if (expires_in)
+		*expires_in = (gint)(entry->expires - now);
+	return realm_disco_ref (entry->disco);
+}
+
+void
+realm_disco_cache_store (const gchar *input,
+                         RealmDisco *disco,
+                         gint ttl)
+{
+	CacheEntry *entry;
+	gint max_age;
+	gchar *key;
+
+	g_return_if_fail (input != NULL);
+	g_return_if_fail (disco != NULL);
+
+	max_age = (gint)realm_settings_double ("discovery", "cache-max-age", 300);
+
+	/* An unknown TTL means we rely on the maximum age alone */
+	if (ttl < 0 || ttl > max_age)
+		ttl = max_age;
+	if (ttl <= 0)
+		return;
+
+	prepare_cache ();
+
+	entry = g_new0 (CacheEntry, 1);
+	entry->disco = realm_disco_ref (disco);
+	entry->expires = cache_now () + ttl;
+	g_hash_table_replace (disco_cache, cache_key (input), entry);
+
+	/* Whatever failed before works now */
+	if (failure_cache) {
+		key = cache_key (input);
+		g_hash_table_remove (failure_cache, key);
+		g_free (key);
+	}
+
+	if (cache_persist ())
+		save_cache_file ();
+}
+
+gchar *
+realm_disco_cache_lookup_failure (const gchar *input,
+                                  gint *expires_in)
+{
+	FailureEntry *entry;
+	gint64 now;
+	gchar *key;
+
+	g_return_val_if_fail (input != NULL, NULL);
+
+	if (!failure_cache)
+		return NULL;
+
+	key = cache_key (input);
+	entry = g_hash_table_lookup (failure_cache, key);
+
+	now = cache_now ();
+	if (entry && entry->expires <= now) {
+		g_hash_table_remove (failure_cache, key);
+		entry = NULL;
+	}
+
+	g_free (key);
+
+	if (entry == NULL)
+		return NULL;
+
+	if (expires_in)
+		*expires_in = (gint)(entry->expires - now);
+	return g_strdup (entry->message);
+}
+
+void
+realm_disco_cache_store_failure (const gchar *input,
+                                 const gchar *message)
+{
+	FailureEntry *entry;
+	gint ttl;
+
+	g_return_if_fail (input != NULL);
+	g_return_if_fail (message != NULL);
+
+	ttl = (gint)realm_settings_double ("discovery", "negative-cache-ttl", 30);
+	if (ttl <= 0)
+		return;
+
+	if (!failure_cache)
+		failure_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, failure_entry_free);
+
+	entry = g_new0 (FailureEntry, 1);
+	entry->message = g_strdup (message);
+	entry->expires = cache_now () + ttl;
+	g_hash_table_replace (failure_cache, cache_key (input), entry);
+}
+
+void
+realm_disco_cache_set_dhcp_domain (const gchar *domain)
+{
+	/* A different network may well be able to find what failed before */
+	if (g_strcmp0 (domain, dhcp_domain) != 0) {
+		if (failure_cache)
+			g_hash_table_remove_all (failure_cache);
+		g_free (dhcp_domain);
+		dhcp_domain = g_strdup (domain);
+	}
+}
+
+void
+realm_disco_cache_flush (void)
+{
+	if (disco_cache)
+		g_hash_table_remove_all (disco_cache);
+	if (failure_cache)
+		g_hash_table_remove_all (failure_cache);
+	if (cache_persist ())
+		g_unlink (REALM_DISCO_CACHE_FILE);
+}
@@ -0,0 +1,45 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_CACHE_H__
+#define __REALM_DISCO_CACHE_H__
+
+#include "realm-disco.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+RealmDisco *   realm_disco_cache_lookup     (const gchar *input,
+                                             gint *expires_in);
+
+void           realm_disco_cache_store      (const gchar *input,
+                                             RealmDisco *disco,
+                                             gint ttl);
+
+gchar *        realm_disco_cache_lookup_failure (const gchar *input,
+                                                 gint *expires_in);
+
+void           realm_disco_cache_store_failure  (const gchar *input,
+                                                 const gchar *message);
+
+void           realm_disco_cache_set_dhcp_domain (const gchar *domain);
+
+void           realm_disco_cache_flush      (void);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_CACHE_H__ */
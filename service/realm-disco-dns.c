@@ -16,9 +16,17 @@
 
 #include "realm-diagnostics.h"
 #include "realm-disco-dns.h"
+#include "realm-disco-score.h"
+#include "realm-settings.h"
+#include "realm-timings.h"
 
 #include <glib/gi18n.h>
 
+#include <arpa/nameser.h>
+#include <netinet/in.h>
+#include <resolv.h>
+#include <string.h>
+
 typedef enum {
 	PHASE_NONE,
 	PHASE_SRV,
@@ -26,17 +34,36 @@ typedef enum {
 	PHASE_DONE
 } DiscoPhase;
 
+typedef struct _RealmDiscoDns RealmDiscoDns;
+
 typedef struct {
+	RealmDiscoDns *self;
+	GSrvTarget *target;
+	GQueue addresses;
+	gboolean resolved;
+	gint64 started;
+} TargetSlot;
+
+struct _RealmDiscoDns {
 	GSocketAddressEnumerator parent;
 	gchar *name;
+	gchar *service;
+	gboolean service_only;
 	GQueue addresses;
-	GQueue targets;
-	gint current_port;
+	GPtrArray *targets;
+	guint next_target;
+	gint resolving;
+	gint resolve_max;
+	gboolean looking;
 	gint returned;
+	gint ttl;
+	gboolean transient;
 	DiscoPhase phase;
+	gint64 started;
 	GResolver *resolver;
+	GTask *task;
 	GDBusMethodInvocation *invocation;
-} RealmDiscoDns;
+};
 
 typedef struct {
 	GSocketAddressEnumeratorClass parent;
@@ -46,17 +73,34 @@ typedef struct {
 #define REALM_DISCO_DNS(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), REALM_TYPE_DISCO_DNS, RealmDiscoDns))
 #define REALM_IS_DISCO_DNS(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst), REALM_TYPE_DISCO_DNS))
 
-static void return_or_resolve (RealmDiscoDns *self, GTask *task);
+static void return_or_resolve (RealmDiscoDns *self);
 
 GType realm_disco_dns_get_type (void) G_GNUC_CONST;
 
 G_DEFINE_TYPE (RealmDiscoDns, realm_disco_dns, G_TYPE_SOCKET_ADDRESS_ENUMERATOR);
 
+static void
+target_slot_free (gpointer data)
+{
+	TargetSlot *slot = data;
+	gpointer value;
+
+	for (;;) {
+		value = g_queue_pop_head (&slot->addresses);
+		if (!value)
+			break;
+		g_object_unref (value);
+	}
+
+	g_srv_target_free (slot->target);
+	g_free (slot);
+}
+
 static void
 realm_disco_dns_init (RealmDiscoDns *self)
 {
 	g_queue_init (&self->addresses);
-	g_queue_init (&self->targets);
+	self->ttl = -1;
 }
 
 static void
@@ -66,7 +110,8 @@ realm_disco_dns_finalize (GObject *obj)
 	gpointer value;
 
 	g_free (self->name);
-	g_object_unref (self->invocation);
+	g_free (self->service);
+	g_clear_object (&self->invocation);
 	g_clear_object (&self->resolver);
 
 	for (;;) {
@@ -76,13 +121,10 @@ realm_disco_dns_finalize (GObject *obj)
 		g_object_unref (value);
 	}
 
-	for (;;) {
-		value = g_queue_pop_head (&self->targets);
-		if (!value)
-			break;
-		g_srv_target_free (value);
-	}
+	if (self->targets)
+		g_ptr_array_free (self->targets, TRUE);
 
+	g_assert (self->task == NULL);
 	G_OBJECT_CLASS (realm_disco_dns_parent_class)->finalize (obj);
 }
 
@@ -95,113 +137,449 @@ realm_disco_dns_next (GSocketAddressEnumerator *enumerator,
 	g_return_val_if_reached (NULL);
 }
 
+static void
+queue_addresses (GQueue *queue,
+                 GList *addrs,
+                 guint16 port)
+{
+	GQueue inet6 = G_QUEUE_INIT;
+	GQueue inet4 = G_QUEUE_INIT;
+	GInetAddress *inet;
+	GList *l;
+
+	for (l = addrs; l != NULL; l = g_list_next (l)) {
+		if (g_inet_address_get_family (l->data) == G_SOCKET_FAMILY_IPV6)
+			g_queue_push_tail (&inet6, l->data);
+		else
+			g_queue_push_tail (&inet4, l->data);
+	}
+
+	/* Alternate address families, so one broken family doesn't stall us */
+	while (!g_queue_is_empty (&inet6) || !g_queue_is_empty (&inet4)) {
+		inet = g_queue_pop_head (&inet6);
+		if (inet)
+			g_queue_push_tail (queue, g_inet_socket_address_new (inet, port));
+		inet = g_queue_pop_head (&inet4);
+		if (inet)
+			g_queue_push_tail (queue, g_inet_socket_address_new (inet, port));
+	}
+}
+
+static void
+demote_bad_addresses (RealmDiscoDns *self,
+                      GQueue *queue,
+                      const gchar *hostname)
+{
+	GQueue bad = G_QUEUE_INIT;
+	GSocketAddress *address;
+	GList *l, *next;
+	gchar *string;
+
+	/* Addresses that failed recently are tried after the others */
+	for (l = queue->head; l != NULL; l = next) {
+		next = g_list_next (l);
+		address = l->data;
+		if (hostname)
+			realm_disco_score_note (address, hostname, self->name);
+		if (realm_disco_score_is_bad (address)) {
+			g_queue_delete_link (queue, l);
+			g_queue_push_tail (&bad, address);
+		}
+	}
+
+	while ((address = g_queue_pop_head (&bad)) != NULL) {
+		string = realm_timings_address_to_string (address);
+		g_debug ("Trying %s last, it failed recently", string);
+		g_free (string);
+		g_queue_push_tail (queue, address);
+	}
+}
+
+static void
+return_address (RealmDiscoDns *self,
+                GSocketAddress *address)
+{
+	GTask *task = self->task;
+
+	self->task = NULL;
+	if (address)
+		self->returned++;
+	g_task_return_pointer (task, address, address ? g_object_unref : NULL);
+	g_object_unref (task);
+}
+
+static void
+return_error (RealmDiscoDns *self,
+              GError *error)
+{
+	GTask *task = self->task;
+
+	self->task = NULL;
+	g_task_return_error (task, error);
+	g_object_unref (task);
+}
+
 static void
 on_name_resolved (GObject *source,
                   GAsyncResult *result,
                   gpointer user_data)
 {
-	GTask *task = G_TASK (user_data);
-	RealmDiscoDns *self = g_task_get_source_object (task);
+	RealmDiscoDns *self = REALM_DISCO_DNS (user_data);
 	GError *error = NULL;
 	GList *addrs;
-	GList *l;
 
 	addrs = g_resolver_lookup_by_name_finish (self->resolver, result, &error);
+	self->looking = FALSE;
 
+	realm_timings_record (self->invocation, "resolve", self->name, self->started,
+	                      error ? error->message : NULL);
 	if (error)
 		g_debug ("%s", error->message);
 
 	/* These are not real errors, just absence of addresses */
+	if (g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE))
+		self->transient = TRUE;
 	if (g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND) ||
 	    g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE))
 		g_clear_error (&error);
 
 	if (error) {
-		g_task_return_error (task, error);
+		return_error (self, error);
 
 	} else {
-		for (l = addrs; l != NULL; l = g_list_next (l))
-			g_queue_push_head (&self->addresses, g_inet_socket_address_new (l->data, self->current_port));
+		queue_addresses (&self->addresses, addrs, 389);
 		g_list_free_full (addrs, g_object_unref);
-		return_or_resolve (self, task);
+		demote_bad_addresses (self, &self->addresses, NULL);
+		return_or_resolve (self);
 	}
 
-	g_object_unref (task);
+	g_object_unref (self);
+}
+
+static void
+on_target_resolved (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+	TargetSlot *slot = user_data;
+	RealmDiscoDns *self = slot->self;
+	GError *error = NULL;
+	GList *addrs;
+
+	addrs = g_resolver_lookup_by_name_finish (self->resolver, result, &error);
+
+	realm_timings_record (self->invocation, "resolve", g_srv_target_get_hostname (slot->target),
+	                      slot->started, error ? error->message : NULL);
+
+	/* A target that doesn't resolve just has no addresses */
+	if (error) {
+		g_debug ("%s", error->message);
+		g_error_free (error);
+	}
+
+	queue_addresses (&slot->addresses, addrs, g_srv_target_get_port (slot->target));
+	g_list_free_full (addrs, g_object_unref);
+	demote_bad_addresses (self, &slot->addresses, g_srv_target_get_hostname (slot->target));
+
+	slot->resolved = TRUE;
+	self->resolving--;
+
+	return_or_resolve (self);
+	g_object_unref (self);
+}
+
+static void
+resolve_targets (RealmDiscoDns *self)
+{
+	TargetSlot *slot;
+
+	/* Targets are sorted, so the most preferred are resolved first */
+	while (self->resolving < self->resolve_max &&
+	       self->next_target < self->targets->len) {
+		slot = self->targets->pdata[self->next_target++];
+		slot->started = g_get_monotonic_time ();
+		g_resolver_lookup_by_name_async (self->resolver, g_srv_target_get_hostname (slot->target),
+		                                 g_task_get_cancellable (self->task),
+		                                 on_target_resolved, slot);
+		g_object_ref (self);
+		self->resolving++;
+	}
+}
+
+static GSocketAddress *
+pop_target_address (RealmDiscoDns *self,
+                    gboolean *waiting)
+{
+	TargetSlot *slot;
+	gint priority = -1;
+	guint i;
+
+	/*
+	 * Hand out addresses in the order of the sorted SRV targets, but
+	 * don't wait on a slow target when another of the same priority
+	 * has already resolved. Never skip ahead to a lower priority while
+	 * targets of a higher priority are still being resolved.
+	 */
+	for (i = 0; i < self->targets->len; i++) {
+		slot = self->targets->pdata[i];
+		if (slot->resolved && g_queue_is_empty (&slot->addresses))
+			continue;
+		if (priority >= 0 && g_srv_target_get_priority (slot->target) != priority)
+			break;
+		priority = g_srv_target_get_priority (slot->target);
+		if (!g_queue_is_empty (&slot->addresses))
+			return g_queue_pop_head (&slot->addresses);
+		*waiting = TRUE;
+	}
+
+	return NULL;
+}
+
+typedef struct {
+	GList *targets;
+	gint ttl;
+	gboolean transient;
+} SrvResult;
+
+static void
+srv_result_free (gpointer data)
+{
+	SrvResult *srv = data;
+	g_list_free_full (srv->targets, (GDestroyNotify)g_srv_target_free);
+	g_free (srv);
+}
+
+/*
+ * GResolver doesn't tell us the TTL of the SRV records, and we need it
+ * to know how long discovery results stay valid. So look these up
+ * ourselves in a thread.
+ */
+static void
+lookup_service_thread (GTask *task,
+                       gpointer source_object,
+                       gpointer task_data,
+                       GCancellable *cancellable)
+{
+	const gchar *rrname = task_data;
+	struct __res_state state;
+	gchar name[NS_MAXDNAME];
+	const guchar *rdata;
+	SrvResult *srv;
+	guchar *answer;
+	ns_msg msg;
+	ns_rr rr;
+	gint count;
+	gint len;
+	gint i;
+
+	memset (&state, 0, sizeof (state));
+	if (res_ninit (&state) < 0) {
+		g_task_return_new_error (task, G_RESOLVER_ERROR, G_RESOLVER_ERROR_INTERNAL,
+		                         _("Couldn't initialize the DNS resolver"));
+		return;
+	}
+
+	answer = g_malloc (NS_MAXMSG);
+	len = res_nquery (&state, rrname, ns_c_in, ns_t_srv, answer, NS_MAXMSG);
+
+	srv = g_new0 (SrvResult, 1);
+	srv->ttl = -1;
+
+	if (len < 0) {
+		/* These are not real errors, just absence of records */
+		if (state.res_h_errno == NO_RECOVERY) {
+			g_task_return_new_error (task, G_RESOLVER_ERROR, G_RESOLVER_ERROR_INTERNAL,
+			                         _("Error resolving \"%s\""), rrname);
+			srv_result_free (srv);
+			srv = NULL;
+		} else {
+			g_debug ("No SRV records for %s: %s", rrname, hstrerror (state.res_h_errno));
+			srv->transient = (state.res_h_errno == TRY_AGAIN);
+		}
+
+	} else if (ns_initparse (answer, len, &msg) < 0) {
+		g_task_return_new_error (task, G_RESOLVER_ERROR, G_RESOLVER_ERROR_INTERNAL,
+		                         _("Malformed DNS response for \"%s\""), rrname);
+		srv_result_free (srv);
+		srv = NULL;
+
+	} else {
+		count = ns_msg_count (msg, ns_s_an);
+		for (i = 0; i < count; i++) {
+			if (ns_parserr (&msg, ns_s_an, i, &rr) < 0)
+				continue;
+			if (ns_rr_type (rr) != ns_t_srv || ns_rr_rdlen (rr) < 7)
+				continue;
+
+			rdata = ns_rr_rdata (rr);
+			if (dn_expand (ns_msg_base (msg), ns_msg_end (msg), rdata + 6, name, sizeof (name)) < 0)
+				continue;
+
+			srv->targets = g_list_prepend (srv->targets,
+			                               g_srv_target_new (name, ns_get16 (rdata + 4),
+			                                                 ns_get16 (rdata), ns_get16 (rdata + 2)));
+			if (srv->ttl < 0 || ns_rr_ttl (rr) < (guint)srv->ttl)
+				srv->ttl = MIN (ns_rr_ttl (rr), G_MAXINT);
+		}
+
+		srv->targets = g_srv_target_list_sort (srv->targets);
+	}
+
+	if (srv)
+		g_task_return_pointer (task, srv, srv_result_free);
+
+	g_free (answer);
+	res_nclose (&state);
 }
 
+static void
+demote_bad_targets (RealmDiscoDns *self)
+{
+	GPtrArray *good;
+	GPtrArray *bad;
+	TargetSlot *slot;
+	guint i;
+
+	/*
+	 * Move targets that failed recently to the end, keeping the SRV
+	 * order otherwise. They keep their priority, which still groups
+	 * them together when handing out addresses.
+	 */
+	good = g_ptr_array_new ();
+	bad = g_ptr_array_new ();
+	for (i = 0; i < self->targets->len; i++) {
+		slot = self->targets->pdata[i];
+		if (realm_disco_score_is_bad_host (g_srv_target_get_hostname (slot->target))) {
+			g_debug ("Trying %s last, it failed recently",
+			         g_srv_target_get_hostname (slot->target));
+			g_ptr_array_add (bad, slot);
+		} else {
+			g_ptr_array_add (good, slot);
+		}
+	}
+
+	for (i = 0; i < good->len; i++)
+		self->targets->pdata[i] = good->pdata[i];
+	for (i = 0; i < bad->len; i++)
+		self->targets->pdata[good->len + i] = bad->pdata[i];
+
+	g_ptr_array_free (good, TRUE);
+	g_ptr_array_free (bad, TRUE);
+}
 
 static void
 on_service_resolved (GObject *source,
                      GAsyncResult *result,
                      gpointer user_data)
 {
-	GTask *task = G_TASK (user_data);
-	RealmDiscoDns *self = g_task_get_source_object (task);
+	RealmDiscoDns *self = REALM_DISCO_DNS (user_data);
 	GError *error = NULL;
-	GList *targets;
+	TargetSlot *slot;
+	SrvResult *srv;
 	GList *l;
 
-	targets = g_resolver_lookup_service_finish (self->resolver, result, &error);
+	srv = g_task_propagate_pointer (G_TASK (result), &error);
+	self->looking = FALSE;
 
-	if (error)
-		g_debug ("%s", error->message);
-
-	/* These are not real errors, just absence of addresses */
-	if (g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND) ||
-	    g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE))
-		g_clear_error (&error);
+	realm_timings_record (self->invocation, "srv-query", self->service, self->started,
+	                      error ? error->message : NULL);
 
 	if (error) {
-		g_task_return_error (task, error);
+		g_debug ("%s", error->message);
+		return_error (self, error);
 
 	} else {
-		for (l = targets; l != NULL; l = g_list_next (l))
-			g_queue_push_tail (&self->targets, l->data);
-		g_list_free (targets);
-		return_or_resolve (self, task);
+		self->targets = g_ptr_array_new_with_free_func (target_slot_free);
+		for (l = srv->targets; l != NULL; l = g_list_next (l)) {
+			slot = g_new0 (TargetSlot, 1);
+			slot->self = self;
+			slot->target = l->data;
+			g_queue_init (&slot->addresses);
+			g_ptr_array_add (self->targets, slot);
+		}
+		g_list_free (srv->targets);
+		srv->targets = NULL;
+		demote_bad_targets (self);
+		if (srv->ttl >= 0)
+			self->ttl = srv->ttl;
+		if (srv->transient)
+			self->transient = TRUE;
+		srv_result_free (srv);
+		return_or_resolve (self);
 	}
 
+	g_object_unref (self);
+}
+
+static void
+lookup_service_async (RealmDiscoDns *self,
+                      GCancellable *cancellable,
+                      GAsyncReadyCallback callback,
+                      gpointer user_data)
+{
+	GTask *task;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_task_data (task, g_strdup (self->service), g_free);
+	g_task_set_return_on_cancel (task, TRUE);
+	g_task_run_in_thread (task, lookup_service_thread);
 	g_object_unref (task);
 }
 
 static void
-return_or_resolve (RealmDiscoDns *self,
-                   GTask *task)
+return_or_resolve (RealmDiscoDns *self)
 {
 	GSocketAddress *address;
-	GSrvTarget *target;
+	gboolean waiting = FALSE;
+	GCancellable *cancellable;
+	GError *error = NULL;
+
+	/* Nobody is asking for an address right now */
+	if (self->task == NULL)
+		return;
+
+	cancellable = g_task_get_cancellable (self->task);
+	if (g_cancellable_set_error_if_cancelled (cancellable, &error)) {
+		return_error (self, error);
+		return;
+	}
 
 	address = g_queue_pop_head (&self->addresses);
+	if (address == NULL && self->targets) {
+		resolve_targets (self);
+		address = pop_target_address (self, &waiting);
+	}
+
 	if (address) {
-		self->returned++;
-		g_task_return_pointer (task, address, g_object_unref);
+		return_address (self, address);
 		return;
 	}
 
-	target = g_queue_pop_head (&self->targets);
-	if (target) {
-		self->current_port = g_srv_target_get_port (target);
-		g_resolver_lookup_by_name_async (self->resolver, g_srv_target_get_hostname (target),
-		                                 g_task_get_cancellable (task), on_name_resolved,
-		                                 g_object_ref (task));
-		g_srv_target_free (target);
+	/* Wait for more targets to resolve, or the current lookup */
+	if (waiting || self->looking)
 		return;
-	}
 
 	switch (self->returned > 0 ? PHASE_DONE : self->phase) {
 	case PHASE_NONE:
-		realm_diagnostics_info (self->invocation, "Resolving: _ldap._tcp.%s", self->name);
-		g_resolver_lookup_service_async (self->resolver, "ldap", "tcp", self->name,
-		                                 g_task_get_cancellable (task),
-		                                 on_service_resolved, g_object_ref (task));
+		realm_diagnostics_info (self->invocation, "Resolving: %s", self->service);
+		self->started = g_get_monotonic_time ();
+		lookup_service_async (self, cancellable, on_service_resolved, g_object_ref (self));
+		self->looking = TRUE;
 		self->phase = PHASE_SRV;
 		break;
 	case PHASE_SRV:
+		/* Only looking for servers advertised in the SRV records */
+		if (self->service_only) {
+			realm_diagnostics_info (self->invocation, "No results: %s", self->service);
+			self->phase = PHASE_DONE;
+			return_address (self, NULL);
+			break;
+		}
 		realm_diagnostics_info (self->invocation, "Resolving: %s", self->name);
-		g_resolver_lookup_by_name_async (self->resolver, self->name,
-		                                 g_task_get_cancellable (task), on_name_resolved,
-		                                 g_object_ref (task));
-		self->current_port = 389;
+		self->started = g_get_monotonic_time ();
+		g_resolver_lookup_by_name_async (self->resolver, self->name, cancellable,
+		                                 on_name_resolved, g_object_ref (self));
+		self->looking = TRUE;
 		self->phase = PHASE_HOST;
 		break;
 	case PHASE_HOST:
@@ -209,7 +587,7 @@ return_or_resolve (RealmDiscoDns *self,
 		self->phase = PHASE_DONE;
 		/* fall through */
 	case PHASE_DONE:
-		g_task_return_pointer (task, NULL, NULL);
+		return_address (self, NULL);
 		break;
 	}
 }
@@ -224,8 +602,17 @@ realm_disco_dns_next_async (GSocketAddressEnumerator *enumerator,
 	GTask *task;
 
 	task = g_task_new (enumerator, cancellable, callback, user_data);
-	return_or_resolve (self, task);
-	g_object_unref (task);
+
+	/* Callers wait for each address before asking for the next */
+	if (self->task != NULL) {
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_PENDING,
+		                         "Already looking up the next address");
+		g_object_unref (task);
+		return;
+	}
+
+	self->task = task;
+	return_or_resolve (self);
 }
 
 static GSocketAddress *
@@ -262,7 +649,9 @@ realm_disco_dns_enumerate_servers (const gchar *domain_or_server,
 
 	self = g_object_new (REALM_TYPE_DISCO_DNS, NULL);
 	self->name = g_hostname_to_ascii (input);
-	self->invocation = g_object_ref (invocation);
+	self->service = g_strdup_printf ("_ldap._tcp.%s", self->name);
+	self->invocation = invocation ? g_object_ref (invocation) : NULL;
+	self->resolve_max = MAX (1, (gint)realm_settings_double ("discovery", "resolve-max", 8));
 
 	/* If is an IP, skip resolution */
 	if (g_hostname_is_ip_address (input)) {
@@ -278,6 +667,27 @@ realm_disco_dns_enumerate_servers (const gchar *domain_or_server,
 	return G_SOCKET_ADDRESS_ENUMERATOR (self);
 }
 
+GSocketAddressEnumerator *
+realm_disco_dns_enumerate_site_servers (const gchar *domain,
+                                        const gchar *site,
+                                        GDBusMethodInvocation *invocation)
+{
+	RealmDiscoDns *self;
+
+	g_return_val_if_fail (domain != NULL, NULL);
+	g_return_val_if_fail (site != NULL, NULL);
+
+	self = g_object_new (REALM_TYPE_DISCO_DNS, NULL);
+	self->name = g_hostname_to_ascii (domain);
+	self->service = g_strdup_printf ("_ldap._tcp.%s._sites.dc._msdcs.%s", site, self->name);
+	self->service_only = TRUE;
+	self->invocation = invocation ? g_object_ref (invocation) : NULL;
+	self->resolve_max = MAX (1, (gint)realm_settings_double ("discovery", "resolve-max", 8));
+	self->resolver = g_resolver_get_default ();
+
+	return G_SOCKET_ADDRESS_ENUMERATOR (self);
+}
+
 RealmDiscoDnsHint
 realm_disco_dns_get_hint (GSocketAddressEnumerator *enumerator)
 {
@@ -290,9 +700,23 @@ realm_disco_dns_get_hint (GSocketAddressEnumerator *enumerator)
 	}
 }
 
+gboolean
+realm_disco_dns_get_transient (GSocketAddressEnumerator *enumerator)
+{
+	g_return_val_if_fail (REALM_IS_DISCO_DNS (enumerator), FALSE);
+	return REALM_DISCO_DNS (enumerator)->transient;
+}
+
 const gchar *
 realm_disco_dns_get_name (GSocketAddressEnumerator *enumerator)
 {
 	g_return_val_if_fail (REALM_IS_DISCO_DNS (enumerator), NULL);
 	return REALM_DISCO_DNS (enumerator)->name;
 }
+
+gint
+realm_disco_dns_get_ttl (GSocketAddressEnumerator *enumerator)
+{
+	g_return_val_if_fail (REALM_IS_DISCO_DNS (enumerator), -1);
+	return REALM_DISCO_DNS (enumerator)->ttl;
+}
@@ -28,10 +28,18 @@ G_BEGIN_DECLS
 GSocketAddressEnumerator *  realm_disco_dns_enumerate_servers    (const gchar *domain_or_server,
                                                                   GDBusMethodInvocation *invocation);
 
+GSocketAddressEnumerator *  realm_disco_dns_enumerate_site_servers (const gchar *domain,
+                                                                    const gchar *site,
+                                                                    GDBusMethodInvocation *invocation);
+
 RealmDiscoDnsHint           realm_disco_dns_get_hint             (GSocketAddressEnumerator *enumerator);
 
 const gchar *               realm_disco_dns_get_name             (GSocketAddressEnumerator *enumerator);
 
+gint                        realm_disco_dns_get_ttl              (GSocketAddressEnumerator *enumerator);
+
+gboolean                    realm_disco_dns_get_transient        (GSocketAddressEnumerator *enumerator);
+
 G_END_DECLS
 
 #endif /* __REALM_DISCO_DNS_H__ */
@@ -18,13 +18,16 @@
 #include "realm-dbus-constants.h"
 #include "realm-diagnostics.h"
 #include "realm-disco.h"
+#include "realm-disco-cache.h"
 #include "realm-disco-dns.h"
 #include "realm-disco-domain.h"
 #include "realm-disco-mscldap.h"
 #include "realm-disco-rootdse.h"
 #include "realm-errors.h"
-#include "realm-invocation.h"
+#include "realm-ldap.h"
 #include "realm-network.h"
+#include "realm-settings.h"
+#include "realm-timings.h"
 
 #include <glib/gi18n.h>
 
@@ -40,8 +43,29 @@ typedef struct {
 	GCancellable *cancellable;
 	GDBusMethodInvocation *invocation;
 	GSocketAddressEnumerator *enumerator;
+	gboolean enumerating;
+	GSocketAddress *pending;
+	gchar *pending_host;
 	gint outstanding;
+	gint max_probes;
+	guint stagger_ms;
+	guint stagger_source;
+	gboolean stagger_ready;
+	GSocketAddress *latest_probe;
+	gboolean site_phase;
+	RealmDisco *fallback;
+	gboolean use_ping;
+	gboolean collecting;
+	gboolean pinging;
+	gchar *ping_domain;
+	GQueue candidates;
 	gboolean completed;
+	gboolean cached;
+	gint ttl;
+	gchar *failure;
+	gboolean transient;
+	gint64 started;
+	gint64 ping_started;
 	RealmDisco *disco;
 	Callback *callback;
 } RealmDiscoDomain;
@@ -71,6 +95,10 @@ static void
 realm_disco_domain_init (RealmDiscoDomain *self)
 {
 	self->cancellable = g_cancellable_new ();
+	self->ttl = -1;
+	self->started = g_get_monotonic_time ();
+	self->stagger_ready = TRUE;
+	g_queue_init (&self->candidates);
 }
 
 static void
@@ -80,10 +108,18 @@ realm_disco_domain_finalize (GObject *obj)
 
 	g_free (self->input);
 	g_object_unref (self->cancellable);
-	g_object_unref (self->invocation);
+	g_clear_object (&self->invocation);
 	g_clear_object (&self->enumerator);
+	g_clear_object (&self->pending);
+	g_clear_object (&self->latest_probe);
+	g_free (self->pending_host);
+	g_free (self->ping_domain);
+	g_free (self->failure);
+	g_list_free_full (self->candidates.head, g_object_unref);
+	realm_disco_unref (self->fallback);
 	realm_disco_unref (self->disco);
 
+	g_assert (self->stagger_source == 0);
 	g_assert (self->callback == NULL);
 	G_OBJECT_CLASS (realm_disco_domain_parent_class)->finalize (obj);
 }
@@ -116,28 +152,77 @@ realm_disco_domain_async_result_init (GAsyncResultIface *iface)
 	iface->get_user_data = realm_disco_domain_get_user_data;
 }
 
+static gboolean
+is_transient_error (GError *error)
+{
+	if (error->domain == REALM_LDAP_ERROR) {
+		/* A refused connection is LDAP_CONNECT_ERROR, and definite */
+		switch (error->code) {
+		case LDAP_SERVER_DOWN:
+		case LDAP_TIMEOUT:
+		case LDAP_UNAVAILABLE:
+		case LDAP_BUSY:
+		case LDAP_TIMELIMIT_EXCEEDED:
+			return TRUE;
+		default:
+			return FALSE;
+		}
+	}
+
+	/* Timeouts, and the network or DNS servers being unreachable */
+	if (g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE))
+		return TRUE;
+	return g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+	       g_error_matches (error, G_IO_ERROR, G_IO_ERROR_HOST_UNREACHABLE) ||
+	       g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NETWORK_UNREACHABLE);
+}
+
 static void
 complete_discover (RealmDiscoDomain *self)
 {
 	Callback *call, *next;
+	gboolean cancelled;
 
 	g_assert (!self->completed);
 	self->completed = TRUE;
+	cancelled = g_cancellable_is_cancelled (self->cancellable);
 
 	/* No longer in the concurrency cache */
-	g_hash_table_remove (discover_cache, self->input);
-	if (g_hash_table_size (discover_cache) == 0)
-		g_hash_table_destroy (discover_cache);
-	discover_cache = NULL;
+	if (discover_cache) {
+		if (g_hash_table_lookup (discover_cache, self->input) == self)
+			g_hash_table_remove (discover_cache, self->input);
+		if (g_hash_table_size (discover_cache) == 0) {
+			g_hash_table_destroy (discover_cache);
+			discover_cache = NULL;
+		}
+	}
 
 	/* Stop all other results */
 	g_cancellable_cancel (self->cancellable);
+	if (self->stagger_source) {
+		g_source_remove (self->stagger_source);
+		self->stagger_source = 0;
+	}
 
 	call = self->callback;
 	self->callback = NULL;
 
-	if (self->disco)
+	realm_timings_record (self->invocation, self->cached ? "discover-cached" : "discover",
+	                      self->input, self->started,
+	                      self->disco ? NULL : (self->failure ? self->failure : "Not found"));
+
+	if (self->disco && !self->cached) {
 		realm_diagnostics_info (self->invocation, "Successfully discovered: %s", self->disco->domain_name);
+		realm_disco_cache_store (self->input, self->disco, self->ttl);
+
+	/*
+	 * Remember the failure briefly, so repeated typos are cheap. But only
+	 * when the answer was definite, a timeout may well work next time.
+	 */
+	} else if (!self->disco && !self->cached && !cancelled && !self->transient) {
+		realm_disco_cache_store_failure (self->input, self->failure ? self->failure :
+		                                 "No usable realm servers found");
+	}
 
 	while (call != NULL) {
 		next = call->next;
@@ -160,9 +245,18 @@ on_discover_rootdse (GObject *source,
 	self->outstanding--;
 	disco = realm_disco_rootdse_finish (result, &error);
 
-	if (error && !self->completed)
+	if (error && !self->completed) {
 		realm_diagnostics_error (self->invocation, error, NULL);
+		g_free (self->failure);
+		self->failure = g_strdup (error->message);
+		if (is_transient_error (error))
+			self->transient = TRUE;
+	}
 	g_clear_error (&error);
+
+	/* A failed server lets the next candidate start right away */
+	if (disco == NULL)
+		self->stagger_ready = TRUE;
 	step_discover (self, disco);
 
 	g_object_unref (self);
@@ -177,10 +271,9 @@ on_discover_next_address (GObject *source,
 	GSocketAddressEnumerator *enumerator = G_SOCKET_ADDRESS_ENUMERATOR (source);
 	GError *error = NULL;
 	GSocketAddress *address;
-	GInetSocketAddress *inet;
-	const gchar *explicit_host;
 	RealmDiscoDnsHint hint;
-	gchar *string;
+
+	self->enumerating = FALSE;
 
 	if (self->completed) {
 		g_object_unref (self);
@@ -188,35 +281,220 @@ on_discover_next_address (GObject *source,
 	}
 
 	address = g_socket_address_enumerator_next_finish (enumerator, result, &error);
-	if (error != NULL || address == NULL) {
-		if (error && !self->completed && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+
+	/* Left over from before we started looking in our site */
+	if (enumerator != self->enumerator) {
+		g_clear_error (&error);
+		g_clear_object (&address);
+
+	} else if (error != NULL || address == NULL) {
+		if (error && !self->completed && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
 			realm_diagnostics_error (self->invocation, error, "Couldn't lookup realm DNS records");
+			g_free (self->failure);
+			self->failure = g_strdup_printf ("Couldn't lookup realm DNS records: %s", error->message);
+			if (is_transient_error (error))
+				self->transient = TRUE;
+		}
+		if (realm_disco_dns_get_transient (enumerator))
+			self->transient = TRUE;
 		g_clear_error (&error);
 		g_clear_object (&self->enumerator);
 
+	} else if (self->collecting && !(realm_disco_dns_get_hint (enumerator) & REALM_DISCO_IS_SERVER)) {
+		/* Gather all the servers, to ping them at once */
+		g_queue_push_tail (&self->candidates, address);
+		self->ttl = realm_disco_dns_get_ttl (enumerator);
+
 	} else {
-		inet = G_INET_SOCKET_ADDRESS (address);
-		string = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+		self->collecting = FALSE;
+		g_assert (self->pending == NULL);
+		self->pending = address;
 
 		hint = realm_disco_dns_get_hint (enumerator);
 		if (hint & REALM_DISCO_IS_SERVER)
-			explicit_host = realm_disco_dns_get_name (enumerator);
-		else
-			explicit_host = NULL;
-
-		realm_diagnostics_info (self->invocation, "Performing LDAP DSE lookup on: %s", string);
-		realm_disco_rootdse_async (address, explicit_host,
-		                           self->invocation, self->cancellable,
-		                           on_discover_rootdse, g_object_ref (self));
-		self->outstanding++;
-		g_free (string);
+			self->pending_host = g_strdup (realm_disco_dns_get_name (enumerator));
+
+		self->ttl = realm_disco_dns_get_ttl (enumerator);
 	}
 
 	step_discover (self, NULL);
-	g_clear_object (&address);
 	g_object_unref (self);
 }
 
+static gboolean
+on_stagger_timeout (gpointer user_data)
+{
+	RealmDiscoDomain *self = REALM_DISCO_DOMAIN (user_data);
+
+	self->stagger_source = 0;
+	self->stagger_ready = TRUE;
+	step_discover (self, NULL);
+
+	return FALSE;
+}
+
+static void
+on_probe_progress (GSocketAddress *address,
+                   RealmDiscoRootDseEvent event,
+                   gpointer user_data)
+{
+	RealmDiscoDomain *self = REALM_DISCO_DOMAIN (user_data);
+
+	/* Only the newest probe decides when the next one starts */
+	if (self->completed || address != self->latest_probe)
+		return;
+
+	switch (event) {
+	case REALM_DISCO_ROOTDSE_CONNECTED:
+		/* Connected, the probe now has until it is considered slow */
+		if (self->stagger_source) {
+			g_source_remove (self->stagger_source);
+			self->stagger_source = 0;
+		}
+		break;
+	case REALM_DISCO_ROOTDSE_SLOW:
+		self->stagger_ready = TRUE;
+		step_discover (self, NULL);
+		break;
+	}
+}
+
+static void
+start_probe (RealmDiscoDomain *self)
+{
+	GInetSocketAddress *inet;
+	gchar *string;
+
+	inet = G_INET_SOCKET_ADDRESS (self->pending);
+	string = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+	realm_diagnostics_info (self->invocation, "Performing LDAP DSE lookup on: %s", string);
+	g_free (string);
+
+	realm_disco_rootdse_async (self->pending, self->pending_host,
+	                           self->invocation, self->cancellable, on_probe_progress,
+	                           on_discover_rootdse, g_object_ref (self));
+	self->outstanding++;
+
+	g_clear_object (&self->latest_probe);
+	self->latest_probe = self->pending;
+	self->pending = NULL;
+	g_free (self->pending_host);
+	self->pending_host = NULL;
+
+	/* Give this server a head start before racing another against it */
+	self->stagger_ready = FALSE;
+	if (self->stagger_source)
+		g_source_remove (self->stagger_source);
+	self->stagger_source = g_timeout_add_full (G_PRIORITY_DEFAULT, self->stagger_ms,
+	                                           on_stagger_timeout, g_object_ref (self),
+	                                           g_object_unref);
+}
+
+static void
+on_discover_ping (GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+	RealmDiscoDomain *self = REALM_DISCO_DOMAIN (user_data);
+	GInetSocketAddress *inet;
+	GError *error = NULL;
+	RealmDisco *disco;
+	gchar *string;
+
+	self->pinging = FALSE;
+	disco = realm_disco_mscldap_ping_finish (result, &error);
+
+	string = disco ? realm_timings_address_to_string (disco->server_address) : NULL;
+	realm_timings_record (self->invocation, "netlogon-ping", string, self->ping_started,
+	                      error ? error->message : (disco ? NULL : "No replies"));
+	g_free (string);
+
+	if (disco) {
+		inet = G_INET_SOCKET_ADDRESS (disco->server_address);
+		string = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+		realm_diagnostics_info (self->invocation, "Received NetLogon reply from: %s", string);
+		g_free (string);
+	} else if (self->completed) {
+		/* Nothing to report */
+	} else if (error == NULL) {
+		realm_diagnostics_info (self->invocation, "No NetLogon replies, trying LDAP on each server");
+	} else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		realm_diagnostics_error (self->invocation, error, "Couldn't send NetLogon ping");
+	}
+
+	g_clear_error (&error);
+
+	/* Servers that didn't reply are now tried one at a time */
+	step_discover (self, disco);
+	g_object_unref (self);
+}
+
+static void
+begin_ping (RealmDiscoDomain *self)
+{
+	realm_diagnostics_info (self->invocation, "Sending NetLogon ping to %u domain controllers",
+	                        self->candidates.length);
+
+	self->pinging = TRUE;
+	self->ping_started = g_get_monotonic_time ();
+	realm_disco_mscldap_ping_async (self->ping_domain, self->candidates.head,
+	                                self->cancellable, on_discover_ping,
+	                                g_object_ref (self));
+}
+
+static void
+enumerate_next (RealmDiscoDomain *self)
+{
+	if (self->enumerator && !self->enumerating) {
+		self->enumerating = TRUE;
+		g_socket_address_enumerator_next_async (self->enumerator,
+		                                        self->cancellable,
+		                                        on_discover_next_address,
+		                                        g_object_ref (self));
+	}
+}
+
+static gboolean
+disco_is_close (RealmDisco *disco)
+{
+	/* No site information, so nothing would be closer */
+	if (disco->client_site == NULL)
+		return TRUE;
+	if (disco->server_flags & REALM_DISCO_DS_CLOSEST)
+		return TRUE;
+	return disco->server_site != NULL &&
+	       g_ascii_strcasecmp (disco->client_site, disco->server_site) == 0;
+}
+
+static void
+begin_site_discover (RealmDiscoDomain *self,
+                     RealmDisco *disco)
+{
+	realm_diagnostics_info (self->invocation, "Domain controller %s is not in site %s, looking for one that is",
+	                        disco->domain_controller ? disco->domain_controller : disco->domain_name,
+	                        disco->client_site);
+
+	/* Same as Windows DC locator: try the DCs in our site, or use this one */
+	self->site_phase = TRUE;
+	self->fallback = disco;
+
+	g_clear_object (&self->pending);
+	g_free (self->pending_host);
+	self->pending_host = NULL;
+
+	g_list_free_full (self->candidates.head, g_object_unref);
+	g_queue_init (&self->candidates);
+	self->collecting = self->use_ping;
+	g_free (self->ping_domain);
+	self->ping_domain = g_strdup (disco->domain_name);
+
+	g_clear_object (&self->enumerator);
+	self->enumerator = realm_disco_dns_enumerate_site_servers (disco->domain_name,
+	                                                           disco->client_site,
+	                                                           self->invocation);
+	self->stagger_ready = TRUE;
+}
+
 static void
 step_discover (RealmDiscoDomain *self,
                RealmDisco *disco)
@@ -224,19 +502,62 @@ step_discover (RealmDiscoDomain *self,
 	/* Already done, just skip these results */
 	if (self->completed) {
 		realm_disco_unref (disco);
+		return;
+	}
+
+	if (disco && self->site_phase) {
+		/* Only a domain controller in our site beats the one we have */
+		if (!disco_is_close (disco)) {
+			realm_disco_unref (disco);
+			disco = NULL;
+		}
+
+	} else if (disco && !disco_is_close (disco) &&
+	           disco->explicit_server == NULL && disco->domain_name != NULL) {
+		begin_site_discover (self, disco);
+		disco = NULL;
+	}
 
 	/* Either have a result, or finished searching: done */
-	} else if (disco || (self->enumerator == NULL && self->outstanding == 0)) {
+	if (disco || (self->enumerator == NULL && self->pending == NULL && self->outstanding == 0 &&
+	              !self->pinging && g_queue_is_empty (&self->candidates))) {
+		if (disco == NULL) {
+			disco = self->fallback;
+			self->fallback = NULL;
+		}
 		self->disco = disco;
 		complete_discover (self);
+		return;
+	}
 
-	/* Otherwise try up to three servers at once */
-	} else if (self->enumerator && self->outstanding < 3) {
-		g_socket_address_enumerator_next_async (self->enumerator,
-		                                        self->cancellable,
-		                                        on_discover_next_address,
-		                                        g_object_ref (self));
+	/* Every server is known, so ping them all at once */
+	if (self->collecting && self->enumerator == NULL) {
+		self->collecting = FALSE;
+		if (!g_queue_is_empty (&self->candidates))
+			begin_ping (self);
+	}
+
+	if (self->collecting || self->pinging) {
+		if (self->collecting)
+			enumerate_next (self);
+		return;
 	}
+
+	if (self->pending == NULL)
+		self->pending = g_queue_pop_head (&self->candidates);
+
+	/*
+	 * Start the next server once the previous one had its head start,
+	 * failed, or if nothing is in flight. The first server to answer
+	 * wins, and the rest are cancelled in complete_discover().
+	 */
+	if (self->pending && self->outstanding < self->max_probes &&
+	    (self->stagger_ready || self->outstanding == 0))
+		start_probe (self);
+
+	/* Always have the next candidate ready to go */
+	if (self->pending == NULL)
+		enumerate_next (self);
 }
 
 static void
@@ -246,34 +567,83 @@ on_cancel_propagate (GCancellable *source,
 	g_cancellable_cancel (dest);
 }
 
+static gboolean
+on_idle_complete_cached (gpointer user_data)
+{
+	complete_discover (REALM_DISCO_DOMAIN (user_data));
+	return FALSE;
+}
+
 void
 realm_disco_domain_async (const gchar *string,
+                          GVariant *options,
                           GDBusMethodInvocation *invocation,
+                          GCancellable *cancellable,
                           GAsyncReadyCallback callback,
                           gpointer user_data)
 {
 	RealmDiscoDomain *self;
-	GCancellable *cancellable;
+	gboolean force = FALSE;
+	RealmDisco *disco;
+	gchar *failure;
+	gint expires_in;
 	Callback *call;
 
 	g_return_if_fail (string != NULL);
 	g_return_if_fail (invocation == NULL || G_IS_DBUS_METHOD_INVOCATION (invocation));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	if (options)
+		g_variant_lookup (options, REALM_DBUS_OPTION_FORCE_REFRESH, "b", &force);
 
 	if (!discover_cache)
 		discover_cache = g_hash_table_new (g_str_hash, g_str_equal);
 
 	self = g_hash_table_lookup (discover_cache, string);
+	disco = NULL;
+	failure = NULL;
+
+	if (self == NULL && !force) {
+		disco = realm_disco_cache_lookup (string, &expires_in);
+		if (disco == NULL)
+			failure = realm_disco_cache_lookup_failure (string, &expires_in);
+	}
+
+	if (disco != NULL || failure != NULL) {
+		self = g_object_new (REALM_TYPE_DISCO_DOMAIN, NULL);
+		self->input = g_strdup (string);
+		self->invocation = invocation ? g_object_ref (invocation) : NULL;
+		self->disco = disco;
+		self->cached = TRUE;
+
+		if (disco) {
+			realm_diagnostics_info (invocation, "Using cached discovery for: %s (expires in %d seconds)",
+			                        disco->domain_name, expires_in);
+		} else {
+			realm_diagnostics_info (invocation, "Discovery of %s failed recently, not retrying for %d seconds: %s",
+			                        string, expires_in, failure);
+			g_free (failure);
+		}
+
+		/* Always complete asynchronously */
+		g_idle_add_full (G_PRIORITY_DEFAULT, on_idle_complete_cached,
+		                 g_object_ref (self), g_object_unref);
 
-	if (self == NULL) {
+	} else if (self == NULL) {
 		self = g_object_new (REALM_TYPE_DISCO_DOMAIN, NULL);
 		self->input = g_strdup (string);
-		self->invocation = g_object_ref (invocation);
+		self->invocation = invocation ? g_object_ref (invocation) : NULL;
 		self->enumerator = realm_disco_dns_enumerate_servers (string, invocation);
+		self->max_probes = MAX (1, (gint)realm_settings_double ("discovery", "probe-max", 8));
+		self->stagger_ms = MAX (0, (gint)realm_settings_double ("discovery", "probe-stagger", 150));
+		self->ping_domain = g_strstrip (g_strdup (string));
+		self->use_ping = realm_settings_boolean ("discovery", "netlogon-ping", FALSE) &&
+		                 !g_hostname_is_ip_address (self->ping_domain);
+		self->collecting = self->use_ping;
 
 		g_hash_table_insert (discover_cache, self->input, self);
 		g_assert (!self->completed);
 
-		cancellable = realm_invocation_get_cancellable (invocation);
 		if (cancellable) {
 			g_cancellable_connect (cancellable, (GCallback)on_cancel_propagate,
 			                       g_object_ref (self->cancellable), g_object_unref);
@@ -24,7 +24,9 @@
 G_BEGIN_DECLS
 
 void          realm_disco_domain_async    (const gchar *string,
+                                           GVariant *options,
                                            GDBusMethodInvocation *invocation,
+                                           GCancellable *cancellable,
                                            GAsyncReadyCallback callback,
                                            gpointer user_data);
 
@@ -16,13 +16,16 @@
 
 #include "realm-dbus-constants.h"
 #include "realm-disco-mscldap.h"
+#include "realm-disco-score.h"
 #include "realm-ldap.h"
 #include "realm-options.h"
+#include "realm-settings.h"
 
 #include <glib/gi18n.h>
 
 #include <errno.h>
 #include <resolv.h>
+#include <string.h>
 #include <unistd.h>
 
 typedef struct {
@@ -32,6 +35,7 @@ typedef struct {
 	gint count;
 	gint fever_id;
 	gint normal_id;
+	gboolean returned;
 } Closure;
 
 /* Number of rapid requets to do */
@@ -165,7 +169,7 @@ parse_netlogon (struct berval **bvs,
 {
 	guchar *at, *end, *beg;
 	gchar *unused = NULL;
-	guint type, flags;
+	guint type = 0, flags = 0;
 	gboolean success = FALSE;
 
 	if (bvs != NULL && bvs[0] != NULL) {
@@ -182,17 +186,29 @@ parse_netlogon (struct berval **bvs,
 	    !skip_n (&at, end, 16) || /* guid */
 	    !parse_string (beg, end, &at, &unused) || /* forest */
 	    !parse_string (beg, end, &at, &disco->domain_name) ||
-	    !parse_string (beg, end, &at, &unused) || /* hostname */
+	    !parse_string (beg, end, &at, &disco->domain_controller) ||
 	    !parse_string (beg, end, &at, &disco->workgroup) ||
 	    !parse_string (beg, end, &at, &unused) || /* shorthost */
 	    !parse_string (beg, end, &at, &unused) || /* user */
-	    !parse_string (beg, end, &at, &unused) || /* server site */
-	    !parse_string (beg, end, &at, &unused)) { /* client site */
+	    !parse_string (beg, end, &at, &disco->server_site) ||
+	    !parse_string (beg, end, &at, &disco->client_site)) {
 		success = FALSE;
 	}
 
 	g_free (unused);
 
+	/* A client outside of any site gets an empty string */
+	if (disco->client_site && !disco->client_site[0]) {
+		g_free (disco->client_site);
+		disco->client_site = NULL;
+	}
+	if (disco->server_site && !disco->server_site[0]) {
+		g_free (disco->server_site);
+		disco->server_site = NULL;
+	}
+
+	disco->server_flags = flags;
+
 	if (!success) {
 		g_set_error (error, REALM_LDAP_ERROR, LDAP_PROTOCOL_ERROR,
 		             _("Received invalid or unsupported Netlogon data from server"));
@@ -205,6 +221,44 @@ parse_netlogon (struct berval **bvs,
 	return TRUE;
 }
 
+gchar *
+realm_disco_mscldap_flags_to_string (guint flags)
+{
+	static const struct {
+		guint flag;
+		const gchar *name;
+	} names[] = {
+		{ REALM_DISCO_DS_PDC, "pdc" },
+		{ REALM_DISCO_DS_GC, "gc" },
+		{ REALM_DISCO_DS_LDAP, "ldap" },
+		{ REALM_DISCO_DS_DS, "ds" },
+		{ REALM_DISCO_DS_KDC, "kdc" },
+		{ REALM_DISCO_DS_TIMESERV, "timeserv" },
+		{ REALM_DISCO_DS_CLOSEST, "closest" },
+		{ REALM_DISCO_DS_WRITABLE, "writable" },
+		{ REALM_DISCO_DS_GOOD_TIMESERV, "good-timeserv" },
+	};
+
+	GString *string;
+	guint i;
+
+	string = g_string_new ("");
+	for (i = 0; i < G_N_ELEMENTS (names); i++) {
+		if (flags & names[i].flag) {
+			if (string->len)
+				g_string_append_c (string, ' ');
+			g_string_append (string, names[i].name);
+			flags &= ~names[i].flag;
+		}
+	}
+
+	/* Anything we don't have a name for */
+	if (flags != 0)
+		g_string_append_printf (string, "%s0x%x", string->len ? " " : "", flags);
+
+	return g_string_free (string, FALSE);
+}
+
 gboolean
 realm_disco_mscldap_result (LDAP *ldap,
                             LDAPMessage *message,
@@ -252,6 +306,37 @@ on_resend (gpointer user_data)
 	return TRUE;
 }
 
+static gboolean
+on_ldap_message (LDAP *ldap,
+                 LDAPMessage *message,
+                 gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Closure *clo = g_task_get_task_data (task);
+	GError *error = NULL;
+	RealmDisco *disco;
+
+	switch (ldap_msgtype (message)) {
+	case LDAP_RES_SEARCH_ENTRY:
+	case LDAP_RES_SEARCH_RESULT:
+		g_debug ("Received response");
+		disco = realm_disco_new (NULL);
+		disco->server_address = g_object_ref (clo->address);
+		if (realm_disco_mscldap_result (ldap, message, disco, &error)) {
+			disco->explicit_server = g_strdup (clo->explicit_server);
+			g_task_return_pointer (task, disco, realm_disco_unref);
+		} else {
+			realm_disco_unref (disco);
+			g_task_return_error (task, error);
+		}
+		clo->returned = TRUE;
+		return FALSE;
+	default:
+		/* Ignore and keep waiting */
+		return TRUE;
+	}
+}
+
 static GIOCondition
 on_ldap_io (LDAP *ldap,
             GIOCondition cond,
@@ -259,10 +344,7 @@ on_ldap_io (LDAP *ldap,
 {
 	GTask *task = G_TASK (user_data);
 	Closure *clo = g_task_get_task_data (task);
-	struct timeval tvpoll = { 0, 0 };
-	LDAPMessage *message;
 	GError *error = NULL;
-	RealmDisco *disco;
 	int msgid;
 
 	/* Cancelled */
@@ -287,34 +369,14 @@ on_ldap_io (LDAP *ldap,
 		}
 	}
 
-	/* Ready to get a result */
+	/* Ready to get a result, replies to a feverish batch arrive together */
 	if (cond & G_IO_IN) {
-		switch (ldap_result (ldap, LDAP_RES_ANY, 0, &tvpoll, &message)) {
-		case LDAP_RES_SEARCH_ENTRY:
-		case LDAP_RES_SEARCH_RESULT:
-			g_debug ("Received response");
-			disco = realm_disco_new (NULL);
-			disco->server_address = g_object_ref (clo->address);
-			if (realm_disco_mscldap_result (ldap, message, disco, &error)) {
-				disco->explicit_server = g_strdup (clo->explicit_server);
-				g_task_return_pointer (task, disco, realm_disco_unref);
-			} else {
-				realm_disco_unref (disco);
-				g_task_return_error (task, error);
-			}
-			ldap_msgfree (message);
-			return G_IO_NVAL;
-		case -1:
-			realm_ldap_set_error (&error, ldap, -1);
+		if (!realm_ldap_drain_results (ldap, LDAP_MSG_ONE, on_ldap_message, task, &error)) {
 			g_task_return_error (task, error);
 			return G_IO_NVAL;
-		case 0:
-			break;
-		default:
-			/* Ignore and keep waiting */
-			ldap_msgfree (message);
-			break;
 		}
+		if (clo->returned)
+			return G_IO_NVAL;
 	}
 
 	/* Now wait for a response */
@@ -369,3 +431,341 @@ realm_disco_mscldap_finish (GAsyncResult *result,
 	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 	return g_task_propagate_pointer (G_TASK (result), error);
 }
+
+typedef struct {
+	GList *addresses;
+	GSocket *sockets[2];
+	GSource *sources[2];
+	GBytes *request;
+	ber_int_t msgid;
+	gint count;
+	guint fever_id;
+	guint normal_id;
+	guint timeout_id;
+	gint64 started;
+} PingClosure;
+
+static void
+ping_cleanup (PingClosure *clo)
+{
+	guint i;
+
+	if (clo->fever_id)
+		g_source_remove (clo->fever_id);
+	if (clo->normal_id)
+		g_source_remove (clo->normal_id);
+	if (clo->timeout_id)
+		g_source_remove (clo->timeout_id);
+	clo->fever_id = clo->normal_id = clo->timeout_id = 0;
+
+	for (i = 0; i < G_N_ELEMENTS (clo->sources); i++) {
+		if (clo->sources[i]) {
+			g_source_destroy (clo->sources[i]);
+			g_source_unref (clo->sources[i]);
+			clo->sources[i] = NULL;
+		}
+	}
+}
+
+static void
+ping_closure_free (gpointer data)
+{
+	PingClosure *clo = data;
+	guint i;
+
+	ping_cleanup (clo);
+	for (i = 0; i < G_N_ELEMENTS (clo->sockets); i++)
+		g_clear_object (&clo->sockets[i]);
+	g_list_free_full (clo->addresses, g_object_unref);
+	if (clo->request)
+		g_bytes_unref (clo->request);
+	g_free (clo);
+}
+
+static GBytes *
+build_ping_request (const gchar *domain,
+                    ber_int_t msgid)
+{
+	struct berval *bv = NULL;
+	BerElement *ber;
+	GBytes *bytes;
+	int rc;
+
+	ber = ber_alloc_t (LBER_USE_DER);
+	g_return_val_if_fail (ber != NULL, NULL);
+
+	/* The same search realm_disco_mscldap_request() does, plus the domain */
+	rc = ber_printf (ber, "{it{seeiib", msgid, (ber_tag_t)LDAP_REQ_SEARCH, "",
+	                 (ber_int_t)LDAP_SCOPE_BASE, (ber_int_t)LDAP_DEREF_NEVER,
+	                 (ber_int_t)0, (ber_int_t)0, (ber_int_t)0);
+	if (rc >= 0) {
+		rc = ber_printf (ber, "t{t{ss}t{so}}", (ber_tag_t)LDAP_FILTER_AND,
+		                 (ber_tag_t)LDAP_FILTER_EQUALITY, "DnsDomain", domain,
+		                 (ber_tag_t)LDAP_FILTER_EQUALITY, "NtVer",
+		                 "\x06\x00\x00\x00", (ber_len_t)4);
+	}
+	if (rc >= 0)
+		rc = ber_printf (ber, "{s}}}", "NetLogon");
+	if (rc >= 0)
+		rc = ber_flatten (ber, &bv);
+
+	ber_free (ber, 1);
+	g_return_val_if_fail (rc >= 0, NULL);
+
+	bytes = g_bytes_new (bv->bv_val, bv->bv_len);
+	ber_bvfree (bv);
+	return bytes;
+}
+
+static RealmDisco *
+parse_ping_reply (PingClosure *clo,
+                  gchar *data,
+                  gsize length,
+                  GError **error)
+{
+	struct berval **bvs = NULL;
+	RealmDisco *disco = NULL;
+	struct berval bv;
+	BerElement *ber;
+	ber_int_t msgid;
+	ber_tag_t tag;
+
+	bv.bv_val = data;
+	bv.bv_len = length;
+
+	ber = ber_init (&bv);
+	g_return_val_if_fail (ber != NULL, NULL);
+
+	/* LDAPMessage with a SearchResultEntry with a single attribute */
+	if (ber_scanf (ber, "{it{x{{x[V]", &msgid, &tag, &bvs) == LBER_ERROR ||
+	    msgid != clo->msgid || tag != LDAP_RES_SEARCH_ENTRY) {
+		g_set_error (error, REALM_LDAP_ERROR, LDAP_DECODING_ERROR,
+		             _("Received invalid or unsupported Netlogon data from server"));
+
+	} else {
+		disco = realm_disco_new (NULL);
+		if (!parse_netlogon (bvs, disco, error)) {
+			realm_disco_unref (disco);
+			disco = NULL;
+		}
+	}
+
+	if (bvs)
+		ber_bvecfree (bvs);
+	ber_free (ber, 1);
+	return disco;
+}
+
+static void
+ping_complete (GTask *task,
+               RealmDisco *disco,
+               GError *error)
+{
+	/* The sockets hold the only references to the task */
+	g_object_ref (task);
+	ping_cleanup (g_task_get_task_data (task));
+	if (error)
+		g_task_return_error (task, error);
+	else
+		g_task_return_pointer (task, disco, disco ? realm_disco_unref : NULL);
+	g_object_unref (task);
+}
+
+static gboolean
+on_ping_input (GSocket *sock,
+               GIOCondition cond,
+               gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	PingClosure *clo = g_task_get_task_data (task);
+	GSocketAddress *from;
+	GError *error = NULL;
+	RealmDisco *disco;
+	gchar buffer[4096];
+	gssize len;
+
+	if (g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task), &error)) {
+		ping_complete (task, NULL, error);
+		return FALSE;
+	}
+
+	for (;;) {
+		from = NULL;
+		len = g_socket_receive_from (sock, &from, buffer, sizeof (buffer), NULL, &error);
+		if (len < 0) {
+			if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+				g_debug ("Couldn't receive NetLogon reply: %s", error->message);
+			g_clear_error (&error);
+			break;
+		}
+
+		/* The first valid reply wins */
+		disco = parse_ping_reply (clo, buffer, len, &error);
+		if (disco) {
+			g_debug ("Received NetLogon reply");
+			disco->server_address = from;
+			realm_disco_score_success (from, disco->domain_controller, disco->domain_name,
+			                           g_get_monotonic_time () - clo->started);
+			ping_complete (task, disco, NULL);
+			return FALSE;
+		}
+
+		g_debug ("%s", error->message);
+		g_clear_error (&error);
+		g_clear_object (&from);
+	}
+
+	return TRUE;
+}
+
+static void
+send_pings (PingClosure *clo)
+{
+	const gchar *data;
+	GError *error = NULL;
+	GSocketFamily family;
+	gsize length;
+	GList *l;
+
+	g_debug ("Sending NetLogon ping to %u addresses", g_list_length (clo->addresses));
+
+	data = g_bytes_get_data (clo->request, &length);
+	for (l = clo->addresses; l != NULL; l = g_list_next (l)) {
+		family = g_socket_address_get_family (l->data);
+		if (!clo->sockets[family == G_SOCKET_FAMILY_IPV6])
+			continue;
+		if (g_socket_send_to (clo->sockets[family == G_SOCKET_FAMILY_IPV6], l->data,
+		                      data, length, NULL, &error) < 0) {
+			g_debug ("Couldn't send NetLogon ping: %s", error->message);
+			g_clear_error (&error);
+		}
+	}
+}
+
+static gboolean
+on_ping_fever (gpointer user_data)
+{
+	PingClosure *clo = g_task_get_task_data (user_data);
+
+	send_pings (clo);
+
+	/* Remove rapid fire after sending a feverish batch */
+	if (clo->count++ > DISCO_FEVER) {
+		clo->fever_id = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+on_ping_resend (gpointer user_data)
+{
+	send_pings (g_task_get_task_data (user_data));
+	return TRUE;
+}
+
+static gboolean
+on_ping_timeout (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	PingClosure *clo = g_task_get_task_data (task);
+
+	g_debug ("No NetLogon reply in time");
+	clo->timeout_id = 0;
+
+	/*
+	 * Not scored as failures: UDP is often filtered while LDAP works fine,
+	 * and the caller tries each server over LDAP next, scoring it there.
+	 */
+	ping_complete (task, NULL, NULL);
+	return FALSE;
+}
+
+static GSocket *
+ping_socket (GTask *task,
+             GSocketFamily family)
+{
+	PingClosure *clo = g_task_get_task_data (task);
+	GError *error = NULL;
+	GSocket *sock;
+	gint i;
+
+	i = (family == G_SOCKET_FAMILY_IPV6);
+	if (clo->sockets[i])
+		return clo->sockets[i];
+
+	sock = g_socket_new (family, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &error);
+	if (sock == NULL) {
+		g_debug ("Couldn't create socket for NetLogon ping: %s", error->message);
+		g_error_free (error);
+		return NULL;
+	}
+
+	/* on_ping_input() reads until there's nothing left, so never wait */
+	g_socket_set_blocking (sock, FALSE);
+
+	clo->sockets[i] = sock;
+	clo->sources[i] = g_socket_create_source (sock, G_IO_IN, g_task_get_cancellable (task));
+	g_source_set_callback (clo->sources[i], (GSourceFunc)on_ping_input,
+	                       g_object_ref (task), g_object_unref);
+	g_source_attach (clo->sources[i], g_task_get_context (task));
+	return sock;
+}
+
+void
+realm_disco_mscldap_ping_async (const gchar *domain,
+                                GList *addresses,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer user_data)
+{
+	PingClosure *clo;
+	gboolean any = FALSE;
+	gdouble timeout;
+	GTask *task;
+	GList *l;
+
+	g_return_if_fail (domain != NULL);
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	clo = g_new0 (PingClosure, 1);
+	clo->msgid = g_random_int_range (1, G_MAXINT32);
+	clo->request = build_ping_request (domain, clo->msgid);
+	g_task_set_task_data (task, clo, ping_closure_free);
+
+	/* One socket per address family, for all the servers */
+	for (l = addresses; l != NULL; l = g_list_next (l)) {
+		if (!G_IS_INET_SOCKET_ADDRESS (l->data))
+			continue;
+		clo->addresses = g_list_prepend (clo->addresses, g_object_ref (l->data));
+		if (ping_socket (task, g_socket_address_get_family (l->data)))
+			any = TRUE;
+	}
+
+	clo->addresses = g_list_reverse (clo->addresses);
+
+	if (!any || clo->request == NULL) {
+		ping_complete (task, NULL, NULL);
+
+	} else {
+		clo->started = g_get_monotonic_time ();
+		send_pings (clo);
+		clo->fever_id = g_timeout_add (100, on_ping_fever, task);
+		clo->normal_id = g_timeout_add (1000, on_ping_resend, task);
+
+		timeout = realm_settings_double ("discovery", "response-timeout", 5.0);
+		clo->timeout_id = g_timeout_add (MAX (timeout, 0.1) * 1000, on_ping_timeout, task);
+	}
+
+	g_object_unref (task);
+}
+
+RealmDisco *
+realm_disco_mscldap_ping_finish (GAsyncResult *result,
+                                 GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -21,6 +21,19 @@
 
 #include <ldap.h>
 
+/* The DS_*_FLAG values returned in a NetLogon response */
+typedef enum {
+	REALM_DISCO_DS_PDC = 0x00000001,
+	REALM_DISCO_DS_GC = 0x00000004,
+	REALM_DISCO_DS_LDAP = 0x00000008,
+	REALM_DISCO_DS_DS = 0x00000010,
+	REALM_DISCO_DS_KDC = 0x00000020,
+	REALM_DISCO_DS_TIMESERV = 0x00000040,
+	REALM_DISCO_DS_CLOSEST = 0x00000080,
+	REALM_DISCO_DS_WRITABLE = 0x00000100,
+	REALM_DISCO_DS_GOOD_TIMESERV = 0x00000200,
+} RealmDiscoServerFlags;
+
 void           realm_disco_mscldap_async      (GSocketAddress *address,
                                                GSocketProtocol protocol,
                                                const gchar *explicit_server,
@@ -40,4 +53,15 @@ gboolean       realm_disco_mscldap_request    (LDAP *ldap,
                                                int *msgidp,
                                                GError **error);
 
+gchar *        realm_disco_mscldap_flags_to_string (guint flags);
+
+void           realm_disco_mscldap_ping_async (const gchar *domain,
+                                               GList *addresses,
+                                               GCancellable *cancellable,
+                                               GAsyncReadyCallback callback,
+                                               gpointer user_data);
+
+RealmDisco *   realm_disco_mscldap_ping_finish (GAsyncResult *result,
+                                                GError **error);
+
 #endif /* __REALM_DISCO_MSCLDAP_H__ */
@@ -18,31 +18,73 @@
 #include "realm-diagnostics.h"
 #include "realm-disco-mscldap.h"
 #include "realm-disco-rootdse.h"
+#include "realm-disco-score.h"
 #include "realm-ldap.h"
 #include "realm-options.h"
+#include "realm-settings.h"
+#include "realm-timings.h"
 
 #include <glib/gi18n.h>
 
 #include <resolv.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Recent rootDSE round trips, to decide when a server is slow */
+#define RTT_SAMPLES      64
+#define RTT_SAMPLES_MIN  8
+
+/* Used until there are enough samples */
+#define HEDGE_DEFAULT_MS 250
+
+static gint64 rtt_samples[RTT_SAMPLES];
+static guint rtt_samples_len = 0;
+static guint rtt_samples_next = 0;
+static guint hedge_count = 0;
 
 typedef struct _Closure Closure;
 
+typedef gboolean (* RequestFunc) (GTask *task,
+                                  Closure *clo,
+                                  LDAP *ldap);
+
+typedef gboolean (* ResultFunc)  (GTask *task,
+                                  Closure *clo,
+                                  LDAP *ldap,
+                                  LDAPMessage *msg);
+
 struct _Closure {
 	RealmDisco *disco;
 	GSource *source;
 	GDBusMethodInvocation *invocation;
 
 	gchar *default_naming_context;
-	gint msgid;
-
-	gboolean (* request) (GTask *task,
-	                      Closure *clo,
-	                      LDAP *ldap);
 
-	gboolean (* result) (GTask *task,
-	                     Closure *clo,
-	                     LDAP *ldap,
-	                     LDAPMessage *msg);
+	/* When things happened, for timings and the scoreboard */
+	GSocketAddress *address;
+	gchar *server;
+	gint64 started;
+	gboolean connected;
+	gint64 root_dse_sent;
+	gint64 domain_sent;
+	gint64 rtt;
+
+	/* Tell the caller when to start another server alongside this one */
+	RealmDiscoRootDseFunc progress;
+	gpointer progress_data;
+	guint hedge_id;
+
+	/* Searches waiting to be sent, and results waiting by msgid */
+	GQueue requests;
+	GHashTable *results;
+	gboolean returned;
+
+	/* The TCP Netlogon request is sent before we know if it's needed */
+	gint netlogon_msgid;
+	gboolean netlogon_wanted;
+	gboolean netlogon_done;
+	RealmDisco *netlogon;
+	GError *netlogon_error;
 };
 
 static void
@@ -51,10 +93,19 @@ closure_free (gpointer data)
 	Closure *clo = data;
 
 	ldap_memfree (clo->default_naming_context);
+	g_free (clo->server);
+	g_object_unref (clo->address);
+	if (clo->hedge_id)
+		g_source_remove (clo->hedge_id);
 
 	g_source_destroy (clo->source);
 	g_source_unref (clo->source);
 	g_clear_object (&clo->invocation);
+	g_queue_clear (&clo->requests);
+	g_hash_table_destroy (clo->results);
+	if (clo->netlogon)
+		realm_disco_unref (clo->netlogon);
+	g_clear_error (&clo->netlogon_error);
 	realm_disco_unref (clo->disco);
 	g_free (clo);
 }
@@ -122,9 +173,11 @@ search_ldap (GTask *task,
              const gchar *base,
              int scope,
              const char *filter,
-             const char **attrs)
+             const char **attrs,
+             ResultFunc result)
 {
 	GError *error = NULL;
+	int msgid;
 	int rc;
 
 	if (!filter)
@@ -132,7 +185,7 @@ search_ldap (GTask *task,
 
 	g_debug ("Searching %s for %s", base, filter);
 	rc = ldap_search_ext (ldap, base, scope, filter,
-	                      (char **)attrs, 0, NULL, NULL, NULL, -1, &clo->msgid);
+	                      (char **)attrs, 0, NULL, NULL, NULL, -1, &msgid);
 
 	if (rc != 0) {
 		realm_ldap_set_error (&error, ldap, rc);
@@ -140,6 +193,7 @@ search_ldap (GTask *task,
 		return FALSE;
 	}
 
+	g_hash_table_insert (clo->results, GINT_TO_POINTER (msgid), result);
 	return TRUE;
 }
 
@@ -156,11 +210,10 @@ result_krb_realm (GTask *task,
 	g_free (clo->disco->kerberos_realm);
 	clo->disco->kerberos_realm = entry_get_attribute (ldap, entry, "cn", TRUE);
 
-	g_debug ("Found realm: %s", clo->disco->kerberos_realm);
+	realm_timings_record (clo->invocation, "krb-realm", clo->server, clo->domain_sent, NULL);
 
-	/* All done */
-	g_task_return_boolean (task, TRUE);
-	return FALSE;
+	g_debug ("Found realm: %s", clo->disco->kerberos_realm);
+	return TRUE;
 }
 
 static gboolean
@@ -170,11 +223,9 @@ request_krb_realm (GTask *task,
 {
 	const char *attrs[] = { "cn", NULL };
 
-	clo->request = NULL;
-	clo->result = result_krb_realm;
-
 	return search_ldap (task, clo, ldap, clo->default_naming_context,
-	                    LDAP_SCOPE_SUB, "(objectClass=krbRealmContainer)", attrs);
+	                    LDAP_SCOPE_SUB, "(objectClass=krbRealmContainer)", attrs,
+	                    result_krb_realm);
 }
 
 static gboolean
@@ -188,6 +239,9 @@ result_domain_info (GTask *task,
 
 	entry = ldap_first_entry (ldap, message);
 
+	realm_timings_record (clo->invocation, "domain-info", clo->server, clo->domain_sent,
+	                      entry ? NULL : "No domain entry");
+
 	/* If we can't retrieve this, then nothing more to do */
 	if (entry == NULL) {
 		g_debug ("Couldn't read default naming context");
@@ -213,10 +267,6 @@ result_domain_info (GTask *task,
 	clo->disco->domain_name = entry_get_attribute (ldap, entry, "associatedDomain", TRUE);
 
 	g_debug ("Got associatedDomain: %s", clo->disco->domain_name);
-
-	/* Next search for Kerberos container */
-	clo->request = request_krb_realm;
-	clo->result = NULL;
 	return TRUE;
 }
 
@@ -227,11 +277,9 @@ request_domain_info (GTask *task,
 {
 	const char *attrs[] = { "info", "associatedDomain", NULL };
 
-	clo->request = NULL;
-	clo->result = result_domain_info;
-
+	clo->domain_sent = g_get_monotonic_time ();
 	return search_ldap (task, clo, ldap, clo->default_naming_context,
-	                    LDAP_SCOPE_BASE, NULL, attrs);
+	                    LDAP_SCOPE_BASE, NULL, attrs, result_domain_info);
 }
 
 static void
@@ -257,24 +305,49 @@ on_udp_mscldap_complete (GObject *source,
 	g_object_unref (task);
 }
 
+static gboolean
+complete_netlogon (GTask *task,
+                   Closure *clo)
+{
+	if (clo->netlogon_error) {
+		g_debug ("Failed TCP Netlogon response: %s", clo->netlogon_error->message);
+		g_task_return_error (task, clo->netlogon_error);
+		clo->netlogon_error = NULL;
+	} else {
+		g_debug ("Received TCP Netlogon response");
+		realm_disco_unref (clo->disco);
+		clo->disco = clo->netlogon;
+		clo->netlogon = NULL;
+		g_task_return_boolean (task, TRUE);
+	}
+
+	/* All done */
+	return FALSE;
+}
+
 static gboolean
 result_netlogon (GTask *task,
                  Closure *clo,
                  LDAP *ldap,
                  LDAPMessage *message)
 {
-	GError *error = NULL;
+	clo->netlogon = realm_disco_new (NULL);
+	clo->netlogon->explicit_server = g_strdup (clo->disco->explicit_server);
+	clo->netlogon->server_address = g_object_ref (clo->disco->server_address);
 
-	if (realm_disco_mscldap_result (ldap, message, clo->disco, &error)) {
-		g_debug ("Received TCP Netlogon response");
-		g_task_return_boolean (task, TRUE);
-	} else {
-		g_debug ("Failed TCP Netlogon response: %s", error->message);
-		g_task_return_error (task, error);
+	if (!realm_disco_mscldap_result (ldap, message, clo->netlogon, &clo->netlogon_error)) {
+		realm_disco_unref (clo->netlogon);
+		clo->netlogon = NULL;
 	}
 
-	/* All done */
-	return FALSE;
+	clo->netlogon_done = TRUE;
+	realm_timings_record (clo->invocation, "netlogon", clo->server, clo->root_dse_sent,
+	                      clo->netlogon_error ? clo->netlogon_error->message : NULL);
+
+	/* Otherwise hold onto it until the rootDSE tells us what to do */
+	if (clo->netlogon_wanted)
+		return complete_netlogon (task, clo);
+	return TRUE;
 }
 
 static gboolean
@@ -286,16 +359,101 @@ request_netlogon (GTask *task,
 
 	g_debug ("Sending TCP Netlogon request");
 
-	if (!realm_disco_mscldap_request (ldap, &clo->msgid, &error)) {
+	if (!realm_disco_mscldap_request (ldap, &clo->netlogon_msgid, &error)) {
 		g_task_return_error (task, error);
 		return FALSE;
 	}
 
-	clo->request = NULL;
-	clo->result = result_netlogon;
+	g_hash_table_insert (clo->results, GINT_TO_POINTER (clo->netlogon_msgid),
+	                     result_netlogon);
 	return TRUE;
 }
 
+static int
+compare_int64 (const void *a,
+               const void *b)
+{
+	gint64 va = *(const gint64 *)a;
+	gint64 vb = *(const gint64 *)b;
+	return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+static gint64
+hedge_delay (void)
+{
+	gint64 sorted[RTT_SAMPLES];
+	gdouble percentile;
+	guint rank;
+
+	/* Zero turns hedging off */
+	percentile = realm_settings_double ("discovery", "hedge-percentile", 95);
+	if (percentile <= 0)
+		return 0;
+	if (percentile > 100)
+		percentile = 100;
+
+	if (rtt_samples_len < RTT_SAMPLES_MIN)
+		return HEDGE_DEFAULT_MS * 1000;
+
+	memcpy (sorted, rtt_samples, rtt_samples_len * sizeof (gint64));
+	qsort (sorted, rtt_samples_len, sizeof (gint64), compare_int64);
+
+	/* Nearest rank */
+	rank = (guint)(percentile / 100.0 * rtt_samples_len + 0.999999);
+	rank = CLAMP (rank, 1, rtt_samples_len);
+	return MAX (sorted[rank - 1], 1000);
+}
+
+static void
+add_rtt_sample (gint64 rtt)
+{
+	rtt_samples[rtt_samples_next] = rtt;
+	rtt_samples_next = (rtt_samples_next + 1) % RTT_SAMPLES;
+	if (rtt_samples_len < RTT_SAMPLES)
+		rtt_samples_len++;
+}
+
+static gboolean
+on_hedge_timeout (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Closure *clo = g_task_get_task_data (task);
+
+	clo->hedge_id = 0;
+
+	if (g_cancellable_is_cancelled (g_task_get_cancellable (task)))
+		return FALSE;
+
+	hedge_count++;
+	realm_diagnostics_info (clo->invocation, "No reply from %s after %d ms, also trying another server",
+	                        clo->server, (gint)((g_get_monotonic_time () - clo->root_dse_sent) / 1000));
+	realm_timings_record (clo->invocation, "hedge", clo->server, clo->root_dse_sent, NULL);
+
+	(clo->progress) (clo->address, REALM_DISCO_ROOTDSE_SLOW, clo->progress_data);
+	return FALSE;
+}
+
+static void
+begin_hedge (GTask *task,
+             Closure *clo)
+{
+	gint64 delay;
+
+	if (clo->progress == NULL)
+		return;
+
+	delay = hedge_delay ();
+	if (delay <= 0)
+		return;
+
+	/* The server is up, so the caller can give it longer than a dead one */
+	(clo->progress) (clo->address, REALM_DISCO_ROOTDSE_CONNECTED, clo->progress_data);
+
+	/* If it's slower than most answers have been, race another one against it */
+	clo->hedge_id = g_timeout_add_full (G_PRIORITY_DEFAULT, MAX (delay / 1000, 1),
+	                                    on_hedge_timeout, task, NULL);
+}
+
 static gboolean
 result_root_dse (GTask *task,
                  Closure *clo,
@@ -307,6 +465,16 @@ result_root_dse (GTask *task,
 	gchar *string;
 
 	entry = ldap_first_entry (ldap, message);
+	clo->rtt = g_get_monotonic_time () - clo->root_dse_sent;
+	add_rtt_sample (clo->rtt);
+
+	if (clo->hedge_id) {
+		g_source_remove (clo->hedge_id);
+		clo->hedge_id = 0;
+	}
+
+	realm_timings_record (clo->invocation, "rootdse", clo->server, clo->root_dse_sent,
+	                      entry ? NULL : "No rootDSE entry");
 
 	/* Parse out the default naming context */
 	clo->default_naming_context = entry_get_attribute (ldap, entry, "defaultNamingContext", FALSE);
@@ -322,11 +490,12 @@ result_root_dse (GTask *task,
 		                         "1.2.840.113556.1.4.1670")) {
 
 			/*
-			 * Do a TCP NetLogon request since doing this over
-			 * TCP is supported, and we already have a connection
+			 * The TCP NetLogon request went out along with the
+			 * rootDSE search, use its reply when it's here.
 			 */
-			clo->request = request_netlogon;
-			clo->result = NULL;
+			clo->netlogon_wanted = TRUE;
+			if (clo->netlogon_done)
+				return complete_netlogon (task, clo);
 			return TRUE;
 
 		/* Prior to Windows 2003 we have to use UDP for netlogon lookup */
@@ -347,15 +516,20 @@ result_root_dse (GTask *task,
 	/* Not an Active Directory server, check for IPA */
 	} else {
 
+		/* Won't be needing the Netlogon reply */
+		if (!clo->netlogon_done &&
+		    g_hash_table_remove (clo->results, GINT_TO_POINTER (clo->netlogon_msgid)))
+			ldap_abandon_ext (ldap, clo->netlogon_msgid, NULL, NULL);
+
 		if (clo->default_naming_context == NULL) {
 			g_task_return_new_error (task, REALM_LDAP_ERROR, LDAP_NO_SUCH_OBJECT,
 			                         "Couldn't find default naming context on LDAP server");
 			return FALSE;
 		}
 
-		/* Next search for IPA field */
-		clo->request = request_domain_info;
-		clo->result = NULL;
+		/* Neither search depends on the other, so send them together */
+		g_queue_push_tail (&clo->requests, request_domain_info);
+		g_queue_push_tail (&clo->requests, request_krb_realm);
 		return TRUE;
 	}
 }
@@ -367,10 +541,41 @@ request_root_dse (GTask *task,
 {
 	const char *attrs[] = { "defaultNamingContext", "supportedCapabilities", NULL };
 
-	clo->request = NULL;
-	clo->result = result_root_dse;
+	clo->root_dse_sent = g_get_monotonic_time ();
+	if (!search_ldap (task, clo, ldap, "", LDAP_SCOPE_BASE, NULL, attrs, result_root_dse))
+		return FALSE;
+
+	begin_hedge (task, clo);
+
+	/*
+	 * Most servers we talk to are Active Directory, so send the NetLogon
+	 * request right behind the rootDSE search rather than waiting a
+	 * round trip to find out. Other servers just return nothing useful.
+	 */
+	return request_netlogon (task, clo, ldap);
+}
+
+static gboolean
+on_ldap_message (LDAP *ldap,
+                 LDAPMessage *message,
+                 gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Closure *clo = g_task_get_task_data (task);
+	ResultFunc result;
+	int msgid;
+
+	/* Match the reply up with the search it belongs to */
+	msgid = ldap_msgid (message);
+	result = g_hash_table_lookup (clo->results, GINT_TO_POINTER (msgid));
+	g_hash_table_remove (clo->results, GINT_TO_POINTER (msgid));
+
+	if (result != NULL && !result (task, clo, ldap, message)) {
+		clo->returned = TRUE;
+		return FALSE;
+	}
 
-	return search_ldap (task, clo, ldap, "", LDAP_SCOPE_BASE, NULL, attrs);
+	return g_hash_table_size (clo->results) > 0;
 }
 
 static GIOCondition
@@ -380,50 +585,51 @@ on_ldap_io (LDAP *ldap,
 {
 	GTask *task = G_TASK (user_data);
 	Closure *clo = g_task_get_task_data (task);
-	struct timeval tvpoll = { 0, 0 };
-	LDAPMessage *message;
 	GError *error = NULL;
-	gboolean ret;
+	RequestFunc request;
 
 	/* Some failure */
 	if (cond & G_IO_ERR) {
 		realm_ldap_set_error (&error, ldap, 0);
+		if (!clo->connected)
+			realm_timings_record (clo->invocation, "connect", clo->server, clo->started, error->message);
 		g_task_return_error (task, error);
 		return G_IO_NVAL;
 	}
 
-	/* Ready to get a result */
-	if (cond & G_IO_IN && clo->result != NULL) {
-		switch (ldap_result (ldap, clo->msgid, 0, &tvpoll, &message)) {
-		case LDAP_RES_INTERMEDIATE:
-		case LDAP_RES_SEARCH_REFERENCE:
-			ret = TRUE;
-			break;
-		case -1:
-			realm_ldap_set_error (&error, ldap, -1);
+	/* Writable for the first time, so the connection is up */
+	if (cond & G_IO_OUT && !clo->connected) {
+		realm_timings_record (clo->invocation, "connect", clo->server, clo->started, NULL);
+		clo->connected = TRUE;
+	}
+
+	/* Ready to get results, several replies may have arrived together */
+	if (cond & G_IO_IN && g_hash_table_size (clo->results) > 0) {
+		if (!realm_ldap_drain_results (ldap, LDAP_MSG_ALL, on_ldap_message, task, &error)) {
 			g_task_return_error (task, error);
-			ret = FALSE;
-			break;
-		case 0:
-			ret = TRUE;
-			break;
-		default:
-			ret = clo->result (task, clo, ldap, message);
-			ldap_msgfree (message);
-			break;
+			return G_IO_NVAL;
 		}
-
-		if (!ret)
+		if (clo->returned)
 			return G_IO_NVAL;
 	}
 
-	if (cond & G_IO_OUT && clo->request != NULL) {
-		if (!(clo->request) (task, clo, ldap))
-			return G_IO_NVAL;
+	/* Send everything that's queued back to back */
+	if (cond & G_IO_OUT) {
+		while ((request = g_queue_pop_head (&clo->requests)) != NULL) {
+			if (!request (task, clo, ldap))
+				return G_IO_NVAL;
+		}
+	}
+
+	/* Nothing left to send or wait for */
+	if (g_queue_is_empty (&clo->requests) &&
+	    g_hash_table_size (clo->results) == 0) {
+		g_task_return_boolean (task, TRUE);
+		return G_IO_NVAL;
 	}
 
-	return (clo->request ? G_IO_OUT : 0) |
-	       (clo->result ? G_IO_IN : 0);
+	return (g_queue_is_empty (&clo->requests) ? 0 : G_IO_OUT) |
+	       (g_hash_table_size (clo->results) > 0 ? G_IO_IN : 0);
 }
 
 void
@@ -431,6 +637,7 @@ realm_disco_rootdse_async (GSocketAddress *address,
                            const gchar *explicit_server,
                            GDBusMethodInvocation *invocation,
                            GCancellable *cancellable,
+                           RealmDiscoRootDseFunc progress,
                            GAsyncReadyCallback callback,
                            gpointer user_data)
 {
@@ -446,7 +653,13 @@ realm_disco_rootdse_async (GSocketAddress *address,
 	clo->disco->server_address = g_object_ref (address);
 
 	clo->invocation = invocation ? g_object_ref (invocation) : NULL;
-	clo->request = request_root_dse;
+	clo->address = g_object_ref (address);
+	clo->progress = progress;
+	clo->progress_data = user_data;
+	clo->server = realm_timings_address_to_string (address);
+	clo->started = g_get_monotonic_time ();
+	clo->results = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_queue_push_tail (&clo->requests, request_root_dse);
 	g_task_set_task_data (task, clo, closure_free);
 
 	clo->source = realm_ldap_connect_anonymous (address, G_SOCKET_PROTOCOL_TCP,
@@ -462,24 +675,65 @@ RealmDisco *
 realm_disco_rootdse_finish (GAsyncResult *result,
                             GError **error)
 {
+	GError *failure = NULL;
 	Closure *clo;
 	RealmDisco *disco;
 
 	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
 	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-	if (!g_task_propagate_boolean (G_TASK (result), error))
+	clo = g_task_get_task_data (G_TASK (result));
+
+	/* Too late for another server to help */
+	if (clo->hedge_id) {
+		g_source_remove (clo->hedge_id);
+		clo->hedge_id = 0;
+	}
+
+	/* The overall result for this server */
+	if (!g_task_propagate_boolean (G_TASK (result), &failure)) {
+		realm_timings_record (clo->invocation, "server", clo->server, clo->started,
+		                      failure ? failure->message : "Failed");
+
+		/*
+		 * A rootDSE that timed out says its round trip is at least this
+		 * long, and never less than where we hedge now. Abandoned or
+		 * failed probes say nothing about the round trip, so skip them.
+		 */
+		if (clo->root_dse_sent && !clo->rtt &&
+		    g_error_matches (failure, REALM_LDAP_ERROR, LDAP_TIMEOUT)) {
+			add_rtt_sample (MAX (g_get_monotonic_time () - clo->root_dse_sent,
+			                     hedge_delay ()));
+		}
+
+		/* Abandoned because another server answered first isn't its fault */
+		if (!g_error_matches (failure, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			realm_disco_score_failure (clo->address);
+
+		if (failure)
+			g_propagate_error (error, failure);
 		return FALSE;
+	}
 
-	clo = g_task_get_task_data (G_TASK (result));
+	realm_timings_record (clo->invocation, "server", clo->server, clo->started, NULL);
 	disco = clo->disco;
 	clo->disco = NULL;
 
 	/* Should have been set above */
 	g_return_val_if_fail (disco->domain_name, NULL);
 
+	realm_disco_score_success (clo->address, disco->domain_controller,
+	                           disco->domain_name, clo->rtt > 0 ? clo->rtt :
+	                           g_get_monotonic_time () - clo->started);
+
 	if (!disco->kerberos_realm)
 		disco->kerberos_realm = g_ascii_strup (disco->domain_name, -1);
 
 	return disco;
 }
+
+guint
+realm_disco_rootdse_get_hedge_count (void)
+{
+	return hedge_count;
+}
@@ -19,14 +19,26 @@
 
 #include "realm-disco.h"
 
+typedef enum {
+	REALM_DISCO_ROOTDSE_CONNECTED,
+	REALM_DISCO_ROOTDSE_SLOW,
+} RealmDiscoRootDseEvent;
+
+typedef void (* RealmDiscoRootDseFunc) (GSocketAddress *address,
+                                        RealmDiscoRootDseEvent event,
+                                        gpointer user_data);
+
 void           realm_disco_rootdse_async    (GSocketAddress *address,
                                              const gchar *explicit_server,
                                              GDBusMethodInvocation *invocation,
                                              GCancellable *cancellable,
+                                             RealmDiscoRootDseFunc progress,
                                              GAsyncReadyCallback callback,
                                              gpointer user_data);
 
 RealmDisco *   realm_disco_rootdse_finish   (GAsyncResult *result,
                                              GError **error);
 
+guint          realm_disco_rootdse_get_hedge_count (void);
+
 #endif /* __REALM_DISCO_ROOTDSE_H__ */
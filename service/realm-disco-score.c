@@ -0,0 +1,474 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#include "realm-dbus-constants.h"
+#include "realm-disco-score.h"
+#include "realm-settings.h"
+#include "realm-timings.h"
+
+#include <string.h>
+
+#define REALM_DISCO_SCORE_FILE   CACHEDIR "/dc-scores"
+
+/* Weight of the newest sample in the round trip average */
+#define RTT_WEIGHT   0.25
+
+/* A domain controller is bad while the decayed failures are above this */
+#define BAD_FAILURES 0.5
+
+/* Entries not heard of for this many half lives are forgotten */
+#define STALE_HALF_LIVES 8
+
+typedef struct {
+	gchar *hostname;
+	gchar *domain;
+	gdouble rtt;
+	gdouble failures;
+	guint successes;
+	gboolean last_ok;
+	gint64 updated;
+	gint64 decayed;
+} ScoreEntry;
+
+static GHashTable *scores = NULL;
+static guint save_source = 0;
+
+static void
+score_entry_free (gpointer data)
+{
+	ScoreEntry *entry = data;
+	g_free (entry->hostname);
+	g_free (entry->domain);
+	g_free (entry);
+}
+
+static gint64
+score_now (void)
+{
+	return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static gint64
+score_half_life (void)
+{
+	return (gint64)realm_settings_double ("discovery", "dc-score-half-life", 3600);
+}
+
+static void
+decay_entry (ScoreEntry *entry,
+             gint64 now)
+{
+	gint64 half_life;
+
+	half_life = score_half_life ();
+	if (half_life <= 0) {
+		entry->failures = 0;
+		entry->decayed = now;
+		return;
+	}
+
+	/* Halve the failures for each half life that went by */
+	while (entry->decayed + half_life <= now && entry->failures > 0) {
+		entry->failures /= 2;
+		entry->decayed += half_life;
+	}
+
+	if (entry->failures < 0.01) {
+		entry->failures = 0;
+		entry->decayed = now;
+	}
+}
+
+static gboolean
+entry_is_stale (ScoreEntry *entry,
+                gint64 now)
+{
+	gint64 half_life;
+
+	half_life = score_half_life ();
+	return entry->updated + MAX (half_life, 1) * STALE_HALF_LIVES <= now;
+}
+
+static gboolean
+entry_is_bad (ScoreEntry *entry,
+              gint64 now)
+{
+	decay_entry (entry, now);
+	return !entry->last_ok && entry->failures > BAD_FAILURES;
+}
+
+static void
+load_score_file (void)
+{
+	GError *error = NULL;
+	GKeyFile *key_file;
+	ScoreEntry *entry;
+	gchar **groups;
+	gint64 now;
+	gint i;
+
+	key_file = g_key_file_new ();
+	if (!g_key_file_load_from_file (key_file, REALM_DISCO_SCORE_FILE, G_KEY_FILE_NONE, &error)) {
+		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_message ("Couldn't load domain controller scores: %s", error->message);
+		g_error_free (error);
+		g_key_file_free (key_file);
+		return;
+	}
+
+	now = score_now ();
+	groups = g_key_file_get_groups (key_file, NULL);
+	for (i = 0; groups[i] != NULL; i++) {
+		entry = g_new0 (ScoreEntry, 1);
+		entry->hostname = g_key_file_get_string (key_file, groups[i], "hostname", NULL);
+		entry->domain = g_key_file_get_string (key_file, groups[i], "domain", NULL);
+		entry->rtt = g_key_file_get_double (key_file, groups[i], "rtt", NULL);
+		entry->failures = g_key_file_get_double (key_file, groups[i], "failures", NULL);
+		entry->successes = g_key_file_get_integer (key_file, groups[i], "successes", NULL);
+		entry->last_ok = g_key_file_get_boolean (key_file, groups[i], "last-ok", NULL);
+		entry->updated = g_key_file_get_int64 (key_file, groups[i], "updated", NULL);
+		entry->decayed = g_key_file_get_int64 (key_file, groups[i], "decayed", NULL);
+
+		if (entry_is_stale (entry, now)) {
+			score_entry_free (entry);
+			continue;
+		}
+
+		g_hash_table_insert (scores, g_strdup (groups[i]), entry);
+	}
+
+	g_strfreev (groups);
+	g_key_file_free (key_file);
+}
+
+static gboolean
+on_save_scores (gpointer user_data)
+{
+	GHashTableIter iter;
+	GError *error = NULL;
+	GKeyFile *key_file;
+	ScoreEntry *entry;
+	gchar *contents;
+	gsize length;
+	gchar *address;
+	gint64 now;
+
+	save_source = 0;
+
+	key_file = g_key_file_new ();
+	now = score_now ();
+
+	g_hash_table_iter_init (&iter, scores);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&address, (gpointer *)&entry)) {
+		if (entry_is_stale (entry, now)) {
+			g_hash_table_iter_remove (&iter);
+			continue;
+		}
+
+		/* Only noted in passing, nothing learned about it yet */
+		if (entry->successes == 0 && entry->failures == 0)
+			continue;
+
+		if (entry->hostname)
+			g_key_file_set_string (key_file, address, "hostname", entry->hostname);
+		if (entry->domain)
+			g_key_file_set_string (key_file, address, "domain", entry->domain);
+		g_key_file_set_double (key_file, address, "rtt", entry->rtt);
+		g_key_file_set_double (key_file, address, "failures", entry->failures);
+		g_key_file_set_integer (key_file, address, "successes", entry->successes);
+		g_key_file_set_boolean (key_file, address, "last-ok", entry->last_ok);
+		g_key_file_set_int64 (key_file, address, "updated", entry->updated);
+		g_key_file_set_int64 (key_file, address, "decayed", entry->decayed);
+	}
+
+	contents = g_key_file_to_data (key_file, &length, NULL);
+	if (!g_file_set_contents (REALM_DISCO_SCORE_FILE, contents, length, &error)) {
+		g_message ("Couldn't write domain controller scores: %s", error->message);
+		g_error_free (error);
+	}
+
+	g_free (contents);
+	g_key_file_free (key_file);
+	return FALSE;
+}
+
+static void
+prepare_scores (void)
+{
+	if (scores)
+		return;
+
+	scores = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, score_entry_free);
+	load_score_file ();
+}
+
+static void
+queue_save (void)
+{
+	/* Several servers usually report back together, write them all at once */
+	if (save_source == 0)
+		save_source = g_idle_add (on_save_scores, NULL);
+}
+
+static ScoreEntry *
+lookup_entry (GSocketAddress *address,
+              gboolean create)
+{
+	ScoreEntry *entry;
+	gchar *key;
+
+	if (!G_IS_INET_SOCKET_ADDRESS (address))
+		return NULL;
+
+	prepare_scores ();
+
+	key = realm_timings_address_to_string (address);
+	entry = g_hash_table_lookup (scores, key);
+	if (entry == NULL && create) {
+		entry = g_new0 (ScoreEntry, 1);
+		entry->rtt = -1;
+		entry->updated = entry->decayed = score_now ();
+		g_hash_table_insert (scores, key, entry);
+		key = NULL;
+	}
+
+	g_free (key);
+	return entry;
+}
+
+static void
+set_label (gchar **field,
+           const gchar *value)
+{
+	if (value == NULL || value[0] == '\0')
+		return;
+	g_free (*field);
+	*field = g_ascii_strdown (value, -1);
+}
+
+void
+realm_disco_score_note (GSocketAddress *address,
+                        const gchar *hostname,
+                        const gchar *domain)
+{
+	ScoreEntry *entry;
+
+	g_return_if_fail (G_IS_SOCKET_ADDRESS (address));
+
+	/* So failures, which only know the address, can be shown by domain */
+	entry = lookup_entry (address, TRUE);
+	if (entry == NULL)
+		return;
+
+	if (hostname && !entry->hostname)
+		set_label (&entry->hostname, hostname);
+	if (domain && !entry->domain)
+		set_label (&entry->domain, domain);
+}
+
+void
+realm_disco_score_success (GSocketAddress *address,
+                           const gchar *hostname,
+                           const gchar *domain,
+                           gint64 rtt)
+{
+	ScoreEntry *entry;
+	gdouble msec;
+
+	g_return_if_fail (G_IS_SOCKET_ADDRESS (address));
+
+	entry = lookup_entry (address, TRUE);
+	if (entry == NULL)
+		return;
+
+	set_label (&entry->hostname, hostname);
+	set_label (&entry->domain, domain);
+
+	msec = rtt / 1000.0;
+	if (entry->rtt < 0 || entry->successes == 0)
+		entry->rtt = msec;
+	else
+		entry->rtt = RTT_WEIGHT * msec + (1 - RTT_WEIGHT) * entry->rtt;
+
+	entry->updated = score_now ();
+	decay_entry (entry, entry->updated);
+	entry->successes++;
+	entry->last_ok = TRUE;
+
+	queue_save ();
+}
+
+void
+realm_disco_score_failure (GSocketAddress *address)
+{
+	ScoreEntry *entry;
+
+	g_return_if_fail (G_IS_SOCKET_ADDRESS (address));
+
+	entry = lookup_entry (address, TRUE);
+	if (entry == NULL)
+		return;
+
+	entry->updated = score_now ();
+	decay_entry (entry, entry->updated);
+	entry->failures += 1;
+	entry->last_ok = FALSE;
+
+	queue_save ();
+}
+
+gboolean
+realm_disco_score_is_bad (GSocketAddress *address)
+{
+	ScoreEntry *entry;
+
+	g_return_val_if_fail (G_IS_SOCKET_ADDRESS (address), FALSE);
+
+	entry = lookup_entry (address, FALSE);
+	return entry != NULL && entry_is_bad (entry, score_now ());
+}
+
+gboolean
+realm_disco_score_is_bad_host (const gchar *hostname)
+{
+	GHashTableIter iter;
+	ScoreEntry *entry;
+	gboolean any = FALSE;
+	gint64 now;
+
+	g_return_val_if_fail (hostname != NULL, FALSE);
+
+	prepare_scores ();
+	now = score_now ();
+
+	/* A host is bad if all of its known addresses are */
+	g_hash_table_iter_init (&iter, scores);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry)) {
+		if (!entry->hostname || g_ascii_strcasecmp (entry->hostname, hostname) != 0)
+			continue;
+		if (!entry_is_bad (entry, now))
+			return FALSE;
+		any = TRUE;
+	}
+
+	return any;
+}
+
+static gboolean
+entry_in_domain (ScoreEntry *entry,
+                 const gchar *domain)
+{
+	gsize hlen, dlen;
+
+	if (entry->domain && g_ascii_strcasecmp (entry->domain, domain) == 0)
+		return TRUE;
+
+	/* Domain controllers are normally named within their domain */
+	if (entry->hostname) {
+		hlen = strlen (entry->hostname);
+		dlen = strlen (domain);
+		return hlen > dlen + 1 && entry->hostname[hlen - dlen - 1] == '.' &&
+		       g_ascii_strcasecmp (entry->hostname + (hlen - dlen), domain) == 0;
+	}
+
+	return FALSE;
+}
+
+typedef struct {
+	const gchar *address;
+	ScoreEntry *entry;
+	gboolean bad;
+} SortedEntry;
+
+static gint
+compare_entries (gconstpointer a,
+                 gconstpointer b)
+{
+	const SortedEntry *sa = a;
+	const SortedEntry *sb = b;
+
+	/* Same order discovery tries them in, bad ones last, then fastest first */
+	if (sa->bad != sb->bad)
+		return sa->bad ? 1 : -1;
+	if ((sa->entry->rtt < 0) != (sb->entry->rtt < 0))
+		return sa->entry->rtt < 0 ? 1 : -1;
+	if (sa->entry->rtt != sb->entry->rtt)
+		return sa->entry->rtt < sb->entry->rtt ? -1 : 1;
+	return strcmp (sa->address, sb->address);
+}
+
+GVariant *
+realm_disco_score_build (const gchar *domain)
+{
+	GVariantBuilder builder;
+	GVariantBuilder entry_builder;
+	GHashTableIter iter;
+	ScoreEntry *entry;
+	GArray *sorted;
+	SortedEntry se;
+	gchar *address;
+	gint64 now;
+	guint i;
+
+	prepare_scores ();
+	now = score_now ();
+
+	sorted = g_array_new (FALSE, FALSE, sizeof (SortedEntry));
+	g_hash_table_iter_init (&iter, scores);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&address, (gpointer *)&entry)) {
+		if (entry->successes == 0 && entry->failures == 0)
+			continue;
+		if (entry_is_stale (entry, now))
+			continue;
+		if (domain && domain[0] && !entry_in_domain (entry, domain))
+			continue;
+		se.address = address;
+		se.entry = entry;
+		se.bad = entry_is_bad (entry, now);
+		g_array_append_val (sorted, se);
+	}
+
+	g_array_sort (sorted, compare_entries);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+	for (i = 0; i < sorted->len; i++) {
+		se = g_array_index (sorted, SortedEntry, i);
+		g_variant_builder_init (&entry_builder, G_VARIANT_TYPE ("a{sv}"));
+		g_variant_builder_add (&entry_builder, "{sv}", REALM_DBUS_DC_ADDRESS,
+		                       g_variant_new_string (se.address));
+		if (se.entry->hostname)
+			g_variant_builder_add (&entry_builder, "{sv}", REALM_DBUS_DC_HOSTNAME,
+			                       g_variant_new_string (se.entry->hostname));
+		if (se.entry->domain)
+			g_variant_builder_add (&entry_builder, "{sv}", REALM_DBUS_DC_DOMAIN,
+			                       g_variant_new_string (se.entry->domain));
+		if (se.entry->rtt >= 0)
+			g_variant_builder_add (&entry_builder, "{sv}", REALM_DBUS_DC_RTT,
+			                       g_variant_new_double (se.entry->rtt));
+		g_variant_builder_add (&entry_builder, "{sv}", REALM_DBUS_DC_SUCCESSES,
+		                       g_variant_new_uint32 (se.entry->successes));
+		g_variant_builder_add (&entry_builder, "{sv}", REALM_DBUS_DC_FAILURES,
+		                       g_variant_new_double (se.entry->failures));
+		g_variant_builder_add (&entry_builder, "{sv}", REALM_DBUS_DC_BAD,
+		                       g_variant_new_boolean (se.bad));
+		g_variant_builder_add (&entry_builder, "{sv}", REALM_DBUS_DC_UPDATED,
+		                       g_variant_new_int64 (se.entry->updated));
+		g_variant_builder_add_value (&builder, g_variant_builder_end (&entry_builder));
+	}
+
+	g_array_free (sorted, TRUE);
+	return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,43 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_SCORE_H__
+#define __REALM_DISCO_SCORE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void           realm_disco_score_note       (GSocketAddress *address,
+                                             const gchar *hostname,
+                                             const gchar *domain);
+
+void           realm_disco_score_success    (GSocketAddress *address,
+                                             const gchar *hostname,
+                                             const gchar *domain,
+                                             gint64 rtt);
+
+void           realm_disco_score_failure    (GSocketAddress *address);
+
+gboolean       realm_disco_score_is_bad     (GSocketAddress *address);
+
+gboolean       realm_disco_score_is_bad_host (const gchar *hostname);
+
+GVariant *     realm_disco_score_build      (const gchar *domain);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_SCORE_H__ */
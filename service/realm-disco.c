@@ -62,6 +62,9 @@ realm_disco_unref (gpointer data)
 		g_free (disco->explicit_netbios);
 		g_free (disco->kerberos_realm);
 		g_free (disco->workgroup);
+		g_free (disco->domain_controller);
+		g_free (disco->server_site);
+		g_free (disco->client_site);
 		if (disco->server_address)
 			g_object_unref (disco->server_address);
 		g_free (disco);
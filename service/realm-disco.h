@@ -30,6 +30,10 @@ typedef struct {
 	gchar *explicit_server;
 	gchar *explicit_netbios;
 	GSocketAddress *server_address;
+	gchar *domain_controller;
+	gchar *server_site;
+	gchar *client_site;
+	guint server_flags;
 } RealmDisco;
 
 #define        REALM_TYPE_DISCO             (realm_disco_get_type ())
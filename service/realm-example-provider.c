@@ -25,7 +25,6 @@
 #include "realm-settings.h"
 #include "realm-kerberos.h"
 #include "realm-usleep-async.h"
-#include "realm-invocation.h"
 
 #include <string.h>
 
@@ -150,6 +149,7 @@ realm_example_provider_discover_async (RealmProvider *provider,
                                        const gchar *string,
                                        GVariant *options,
                                        GDBusMethodInvocation *invocation,
+                                       GCancellable *cancellable,
                                        GAsyncReadyCallback callback,
                                        gpointer user_data)
 {
@@ -184,7 +184,7 @@ realm_example_provider_discover_async (RealmProvider *provider,
 		g_object_set_data_full (G_OBJECT (task), "the-domain", domain, g_free);
 
 		realm_usleep_async (delay * G_USEC_PER_SEC,
-		                    realm_invocation_get_cancellable (invocation),
+		                    cancellable,
 		                    on_discover_sleep_done,
 		                    g_object_ref (task));
 	}
@@ -257,6 +257,7 @@ realm_example_provider_class_init (RealmExampleProviderClass *klass)
 
 	provider_class->discover_async = realm_example_provider_discover_async;
 	provider_class->discover_finish = realm_example_provider_discover_finish;
+	provider_class->max_relevance = 10;
 
 	object_class->constructed = realm_example_provider_constructed;
 	object_class->get_property = realm_example_provider_get_property;
@@ -17,7 +17,9 @@
 #include "realm-daemon.h"
 #include "realm-dbus-constants.h"
 #include "realm-dbus-generated.h"
+#include "realm-disco-score.h"
 #include "realm-invocation.h"
+#include "realm-timings.h"
 
 #include <glib.h>
 #include <glib/gi18n.h>
@@ -35,6 +37,8 @@ typedef struct {
 
 static InvocationMethod invocation_methods[] = {
 	{ REALM_DBUS_PROVIDER_INTERFACE, "Discover", "org.freedesktop.realmd.discover-realm", 2 },
+	{ REALM_DBUS_PROVIDER_INTERFACE, "DiscoverStreaming", "org.freedesktop.realmd.discover-realm", 2 },
+	{ REALM_DBUS_PROVIDER_INTERFACE, "DiscoverMany", "org.freedesktop.realmd.discover-realm", 2 },
 	{ REALM_DBUS_KERBEROS_MEMBERSHIP_INTERFACE, "Join", "org.freedesktop.realmd.configure-realm", 2 },
 	{ REALM_DBUS_KERBEROS_MEMBERSHIP_INTERFACE, "Leave", "org.freedesktop.realmd.deconfigure-realm", 2 },
 	{ REALM_DBUS_REALM_INTERFACE, "Deconfigure", "org.freedesktop.realmd.deconfigure-realm", 1 },
@@ -340,6 +344,42 @@ on_service_cancel (RealmDbusService *object,
 	return TRUE;
 }
 
+static gboolean
+on_service_get_last_operation_timings (RealmDbusService *object,
+                                       GDBusMethodInvocation *invocation,
+                                       const gchar *operation)
+{
+	gchar *identifier;
+	const gchar *sender;
+
+	sender = g_dbus_method_invocation_get_sender (invocation);
+	g_return_val_if_fail (sender != NULL || realm_daemon_is_dbus_peer (), FALSE);
+
+	if (sender == NULL)
+		sender = PEER;
+
+	/* Same as the identifiers in prepare_method_in_dbus_worker_thread() */
+	if (operation[0] != '\0')
+		identifier = g_strdup_printf ("%s %s", sender, operation);
+	else
+		identifier = g_strdup (sender);
+
+	realm_dbus_service_complete_get_last_operation_timings (object, invocation,
+	                                                        realm_timings_build (identifier));
+	g_free (identifier);
+	return TRUE;
+}
+
+static gboolean
+on_service_get_domain_controller_status (RealmDbusService *object,
+                                         GDBusMethodInvocation *invocation,
+                                         const gchar *domain)
+{
+	realm_dbus_service_complete_get_domain_controller_status (object, invocation,
+	                                                          realm_disco_score_build (domain));
+	return TRUE;
+}
+
 static gboolean
 on_service_set_locale (RealmDbusService *object,
                        GDBusMethodInvocation *invocation,
@@ -402,6 +442,10 @@ realm_invocation_initialize (GDBusConnection *connection)
 	g_signal_connect (service, "handle-release", G_CALLBACK (on_service_release), NULL);
 	g_signal_connect (service, "handle-set-locale", G_CALLBACK (on_service_set_locale), NULL);
 	g_signal_connect (service, "handle-cancel", G_CALLBACK (on_service_cancel), NULL);
+	g_signal_connect (service, "handle-get-last-operation-timings",
+	                  G_CALLBACK (on_service_get_last_operation_timings), NULL);
+	g_signal_connect (service, "handle-get-domain-controller-status",
+	                  G_CALLBACK (on_service_get_domain_controller_status), NULL);
 	g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (service),
 	                                  connection, REALM_DBUS_SERVICE_PATH, NULL);
 
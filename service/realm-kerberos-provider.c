@@ -15,7 +15,6 @@
 #include "config.h"
 
 #include "realm-dbus-constants.h"
-#include "realm-invocation.h"
 #include "realm-kerberos-provider.h"
 
 #include <errno.h>
@@ -70,6 +69,7 @@ realm_kerberos_provider_discover_async (RealmProvider *provider,
                                         const gchar *string,
                                         GVariant *options,
                                         GDBusMethodInvocation *invocation,
+                                        GCancellable *cancellable,
                                         GAsyncReadyCallback callback,
                                         gpointer user_data)
 {
@@ -89,7 +89,7 @@ realm_kerberos_provider_discover_async (RealmProvider *provider,
 		name = g_hostname_to_ascii (string);
 		resolver = g_resolver_get_default ();
 		g_resolver_lookup_service_async (resolver, "kerberos", "udp", name,
-		                                 realm_invocation_get_cancellable (invocation),
+		                                 cancellable,
 		                                 on_kerberos_discover, g_object_ref (task));
 		g_task_set_task_data (task, name, g_free);
 		g_object_unref (resolver);
@@ -131,6 +131,7 @@ realm_kerberos_provider_class_init (RealmKerberosProviderClass *klass)
 	RealmProviderClass *provider_class = REALM_PROVIDER_CLASS (klass);
 	provider_class->discover_async = realm_kerberos_provider_discover_async;
 	provider_class->discover_finish = realm_kerberos_provider_discover_finish;
+	provider_class->max_relevance = 10;
 }
 
 RealmProvider *
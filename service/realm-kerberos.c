@@ -21,6 +21,7 @@
 #include "realm-dbus-generated.h"
 #include "realm-diagnostics.h"
 #include "realm-disco.h"
+#include "realm-disco-mscldap.h"
 #include "realm-errors.h"
 #include "realm-invocation.h"
 #include "realm-kerberos.h"
@@ -30,6 +31,7 @@
 #include "realm-packages.h"
 #include "realm-provider.h"
 #include "realm-settings.h"
+#include "realm-timings.h"
 
 #include <krb5/krb5.h>
 
@@ -333,6 +335,8 @@ join_or_leave (RealmKerberos *self,
 		return;
 	}
 
+	realm_timings_begin (invocation);
+
 	method = method_closure_new (self, invocation);
 	method->cred = cred;
 
@@ -692,6 +696,62 @@ realm_kerberos_class_init (RealmKerberosClass *klass)
 	                                  FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
+static gboolean
+is_disco_detail (const gchar *name)
+{
+	return g_str_equal (name, REALM_DBUS_DETAIL_DOMAIN_CONTROLLER) ||
+	       g_str_equal (name, REALM_DBUS_DETAIL_SERVER_SITE) ||
+	       g_str_equal (name, REALM_DBUS_DETAIL_CLIENT_SITE) ||
+	       g_str_equal (name, REALM_DBUS_DETAIL_SERVER_FLAGS);
+}
+
+static void
+add_disco_details (RealmKerberos *self,
+                   GVariantBuilder *builder)
+{
+	RealmDisco *disco = self->pv->disco;
+	gchar *flags;
+
+	if (disco == NULL)
+		return;
+
+	if (disco->domain_controller)
+		g_variant_builder_add (builder, "(ss)", REALM_DBUS_DETAIL_DOMAIN_CONTROLLER, disco->domain_controller);
+	if (disco->server_site)
+		g_variant_builder_add (builder, "(ss)", REALM_DBUS_DETAIL_SERVER_SITE, disco->server_site);
+	if (disco->client_site)
+		g_variant_builder_add (builder, "(ss)", REALM_DBUS_DETAIL_CLIENT_SITE, disco->client_site);
+	if (disco->server_flags) {
+		flags = realm_disco_mscldap_flags_to_string (disco->server_flags);
+		g_variant_builder_add (builder, "(ss)", REALM_DBUS_DETAIL_SERVER_FLAGS, flags);
+		g_free (flags);
+	}
+}
+
+static void
+update_disco_details (RealmKerberos *self)
+{
+	GVariantBuilder builder;
+	const gchar *name;
+	const gchar *value;
+	GVariant *details;
+	GVariantIter iter;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+
+	details = realm_dbus_realm_get_details (self->pv->realm_iface);
+	if (details) {
+		g_variant_iter_init (&iter, details);
+		while (g_variant_iter_loop (&iter, "(&s&s)", &name, &value)) {
+			if (!is_disco_detail (name))
+				g_variant_builder_add (&builder, "(ss)", name, value);
+		}
+	}
+
+	add_disco_details (self, &builder);
+	realm_dbus_realm_set_details (self->pv->realm_iface, g_variant_builder_end (&builder));
+}
+
 void
 realm_kerberos_set_disco (RealmKerberos *self,
                           RealmDisco *disco)
@@ -702,6 +762,7 @@ realm_kerberos_set_disco (RealmKerberos *self,
 		realm_disco_ref (disco);
 	realm_disco_unref (self->pv->disco);
 	self->pv->disco = disco;
+	update_disco_details (self);
 	g_object_notify (G_OBJECT (self), "disco");
 }
 
@@ -962,18 +1023,15 @@ void
 realm_kerberos_set_details (RealmKerberos *self,
                             ...)
 {
-	GPtrArray *tuples;
-	GVariant *tuple;
-	GVariant *details;
+	GVariantBuilder builder;
 	const gchar *name;
 	const gchar *value;
-	GVariant *values[2];
 	va_list va;
 
 	g_return_if_fail (REALM_IS_KERBEROS (self));
 
 	va_start (va, self);
-	tuples = g_ptr_array_new ();
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
 
 	for (;;) {
 		name = va_arg (va, const gchar *);
@@ -981,21 +1039,13 @@ realm_kerberos_set_details (RealmKerberos *self,
 			break;
 		value = va_arg (va, const gchar *);
 		g_return_if_fail (value != NULL);
-
-		values[0] = g_variant_new_string (name);
-		values[1] = g_variant_new_string (value);
-		tuple = g_variant_new_tuple (values, 2);
-		g_ptr_array_add (tuples, tuple);
+		g_variant_builder_add (&builder, "(ss)", name, value);
 	}
 	va_end (va);
 
-	details = g_variant_new_array (G_VARIANT_TYPE ("(ss)"),
-	                               (GVariant * const *)tuples->pdata,
-	                               tuples->len);
-
-	realm_dbus_realm_set_details (self->pv->realm_iface, details);
-
-	g_ptr_array_free (tuples, TRUE);
+	/* Details learned during discovery are always kept */
+	add_disco_details (self, &builder);
+	realm_dbus_realm_set_details (self->pv->realm_iface, g_variant_builder_end (&builder));
 }
 
 gboolean
@@ -15,6 +15,7 @@
 #include "config.h"
 
 #include "realm-ldap.h"
+#include "realm-settings.h"
 
 #include <glib/gi18n.h>
 #include <glib-unix.h>
@@ -53,15 +54,31 @@ typedef struct {
 
 	gboolean connect_done;
 
+	/* Monotonic times in microseconds, deadline is zero if not waiting */
+	gint64 started;
+	gint64 deadline;
+	gint connect_timeout;
+	gint response_timeout;
+
+	/* Whether a whole message was read during this dispatch */
+	gboolean received;
+
 	/* An LDAP failure we should always return if non-zero */
 	int force_fail;
+
+	/* Why the connect() failed, or zero */
+	int connect_errno;
 } LdapSource;
 
+/* The source whose callback is running, see realm_ldap_drain_results() */
+static LdapSource *dispatching = NULL;
+
 static gboolean
 ldap_source_prepare (GSource *source,
                      gint *timeout)
 {
 	LdapSource *ls = (LdapSource *)source;
+	gint64 now;
 
 	if (ls->force_fail != 0)
 		return TRUE;
@@ -72,6 +89,13 @@ ldap_source_prepare (GSource *source,
 	if ((ls->condition & ls->pollfd.revents) != 0)
 		return TRUE;
 
+	if (ls->deadline != 0) {
+		now = g_source_get_time (source);
+		if (now >= ls->deadline)
+			return TRUE;
+		*timeout = (ls->deadline - now + 999) / 1000;
+	}
+
 	ls->pollfd.events = ls->condition;
 	return FALSE;
 }
@@ -95,6 +119,64 @@ ldap_set_result_code (LDAP *ldap,
 	}
 }
 
+static void
+ldap_set_timed_out (LdapSource *ls,
+                    gint64 now)
+{
+	gchar *message;
+
+	message = g_strdup_printf (ls->connect_done ?
+	                           _("The LDAP server did not respond within %0.1f seconds") :
+	                           _("Couldn't connect to the LDAP server within %0.1f seconds"),
+	                           (gdouble)(now - ls->started) / G_USEC_PER_SEC);
+	ldap_set_option (ls->ldap, LDAP_OPT_DIAGNOSTIC_MESSAGE, message);
+	g_free (message);
+}
+
+static void
+ldap_set_connect_failed (LdapSource *ls)
+{
+	gchar *message;
+
+	message = g_strdup_printf (_("Couldn't connect to the LDAP server: %s"),
+	                           g_strerror (ls->connect_errno));
+	ldap_set_option (ls->ldap, LDAP_OPT_DIAGNOSTIC_MESSAGE, message);
+	g_free (message);
+}
+
+static int
+connect_failure_code (LdapSource *ls,
+                      int error)
+{
+	g_debug ("Cannot connect: %s", g_strerror (error));
+	ls->connect_errno = error;
+
+	/* Refused is a definite answer, an unreachable server may come back */
+	return error == ECONNREFUSED ? LDAP_CONNECT_ERROR : LDAP_SERVER_DOWN;
+}
+
+static void
+ldap_source_update_deadline (LdapSource *ls,
+                             gint64 now)
+{
+	/* The connect deadline stays until we're connected */
+	if (!ls->connect_done)
+		return;
+
+	/*
+	 * Got a whole response, so the next one gets its own deadline. Just
+	 * some bytes arriving doesn't count, or a server trickling out data
+	 * would never time out.
+	 */
+	if (ls->received)
+		ls->deadline = 0;
+
+	if (!(ls->condition & G_IO_IN))
+		ls->deadline = 0;
+	else if (ls->deadline == 0 && ls->response_timeout > 0)
+		ls->deadline = now + (gint64)ls->response_timeout * 1000;
+}
+
 static gboolean
 ldap_source_dispatch (GSource     *source,
                       GSourceFunc  callback,
@@ -102,11 +184,15 @@ ldap_source_dispatch (GSource     *source,
 {
 	RealmLdapCallback func = (RealmLdapCallback)callback;
 	LdapSource *ls = (LdapSource *)source;
+	gboolean timed_out = FALSE;
+	LdapSource *previous;
 	GIOCondition cond;
 	socklen_t slen;
+	gint64 now;
 	int error;
 
 	cond = ls->pollfd.revents & ls->condition;
+	now = g_source_get_time (source);
 
 	/*
 	 * We report cancels as an error. The callback can check if it
@@ -127,28 +213,44 @@ ldap_source_dispatch (GSource     *source,
 		 */
 		if (!ls->connect_done) {
 			ls->connect_done = TRUE;
+			ls->deadline = 0;
 			slen = sizeof (int);
 			if (getsockopt (ls->sock, SOL_SOCKET, SO_ERROR, &error, &slen) != 0) {
 				g_warning ("getsockopt() for SO_ERROR failed");
 				ls->force_fail = LDAP_SERVER_DOWN;
 			} else if (error != 0) {
-				g_debug ("Cannot connect: %s", g_strerror (error));
-				ls->force_fail = LDAP_SERVER_DOWN;
+				ls->force_fail = connect_failure_code (ls, error);
 			}
 		}
+
+	/* Nothing happened in time, give up on this server */
+	} else if (cond == 0 && ls->deadline != 0 && now >= ls->deadline) {
+		g_debug ("LDAP deadline expired");
+		ls->force_fail = LDAP_TIMEOUT;
+		timed_out = TRUE;
 	}
 
 	if (ls->force_fail != 0) {
 		ldap_set_result_code (ls->ldap, ls->force_fail);
+		if (timed_out)
+			ldap_set_timed_out (ls, now);
+		else if (ls->connect_errno != 0)
+			ldap_set_connect_failed (ls);
 		cond |= G_IO_ERR;
 	}
 
 	if (func != NULL && cond != 0) {
+		ls->received = FALSE;
+		previous = dispatching;
+		dispatching = ls;
 		cond = (* func) (ls->ldap, cond, user_data);
+		dispatching = previous;
 		if ((cond & G_IO_NVAL) == G_IO_NVAL)
 			return FALSE;
 		cond |= G_IO_HUP | G_IO_ERR;
 		ls->condition = cond;
+		ldap_source_update_deadline (ls, now);
+		ls->received = FALSE;
 	}
 
 	return TRUE;
@@ -210,6 +312,10 @@ realm_ldap_connect_anonymous (GSocketAddress *address,
 	g_source_set_name (source, "LdapSource");
 	ls = (LdapSource *)source;
 
+	ls->started = g_get_monotonic_time ();
+	ls->connect_timeout = realm_settings_double ("discovery", "connect-timeout", 3.0) * 1000;
+	ls->response_timeout = realm_settings_double ("discovery", "response-timeout", 5.0) * 1000;
+
 	switch (protocol) {
 	case G_SOCKET_PROTOCOL_TCP:
 		ls->sock = socket (g_socket_address_get_family (address),
@@ -231,8 +337,9 @@ realm_ldap_connect_anonymous (GSocketAddress *address,
 
 		if (connect (ls->sock, native, native_len) < 0 &&
 		    errno != EINPROGRESS) {
-			g_debug ("Cannot connect: %s", g_strerror (errno));
-			ls->force_fail = LDAP_SERVER_DOWN;
+			ls->force_fail = connect_failure_code (ls, errno);
+		} else if (ls->connect_timeout > 0) {
+			ls->deadline = ls->started + (gint64)ls->connect_timeout * 1000;
 		}
 
 		if (!g_unix_set_fd_nonblocking (ls->sock, FALSE, NULL))
@@ -327,12 +434,55 @@ realm_ldap_set_condition (GSource *source,
 	GMainContext *context;
 
 	ls->condition = cond | G_IO_HUP | G_IO_ERR;
+	ldap_source_update_deadline (ls, g_get_monotonic_time ());
 
 	context = g_source_get_context (source);
 	if (context != NULL)
 		g_main_context_wakeup (context);
 }
 
+/*
+ * Hands every message that's already arrived to func, in order, without
+ * waiting for more. The message is freed once func returns, and func
+ * returns FALSE when it doesn't want any more. Returns FALSE only if
+ * reading failed.
+ */
+gboolean
+realm_ldap_drain_results (LDAP *ldap,
+                          int all,
+                          RealmLdapMessageFunc func,
+                          gpointer data,
+                          GError **error)
+{
+	struct timeval tvpoll = { 0, 0 };
+	LDAPMessage *message;
+	gboolean more = TRUE;
+	int rc;
+
+	g_return_val_if_fail (ldap != NULL, FALSE);
+	g_return_val_if_fail (func != NULL, FALSE);
+
+	while (more) {
+		rc = ldap_result (ldap, LDAP_RES_ANY, all, &tvpoll, &message);
+		if (rc == 0)
+			break;
+
+		if (rc == -1) {
+			realm_ldap_set_error (error, ldap, -1);
+			return FALSE;
+		}
+
+		/* A complete message, so the source can restart its deadline */
+		if (dispatching != NULL && dispatching->ldap == ldap)
+			dispatching->received = TRUE;
+
+		more = (func) (ldap, message, data);
+		ldap_msgfree (message);
+	}
+
+	return TRUE;
+}
+
 void
 realm_ldap_set_error (GError **error,
                       LDAP *ldap,
@@ -42,4 +42,14 @@ GSource *     realm_ldap_connect_anonymous     (GSocketAddress *address,
 void          realm_ldap_set_condition         (GSource *source,
                                                 GIOCondition cond);
 
+typedef gboolean (* RealmLdapMessageFunc)      (LDAP *ldap,
+                                                LDAPMessage *message,
+                                                gpointer data);
+
+gboolean      realm_ldap_drain_results         (LDAP *ldap,
+                                                int all,
+                                                RealmLdapMessageFunc func,
+                                                gpointer data,
+                                                GError **error);
+
 #endif /* __REALM_LDAP_H__ */
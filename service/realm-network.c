@@ -15,11 +15,44 @@
 #include "config.h"
 
 #include "realm-dbus-constants.h"
+#include "realm-disco-cache.h"
 #include "realm-network.h"
+#include "realm-settings.h"
+
+#include <string.h>
+
+#define NETWORK_MANAGER_NAME "org.freedesktop.NetworkManager"
+
+/* Wait for a burst of changes to settle before looking again */
+#define REFRESH_DELAY_MS 500
+
+/* How long a slow default domain source holds up the others */
+#define DEFAULT_DOMAIN_WAIT_MS 1000
+
+typedef struct {
+	GDBusConnection *connection;
+	gulong closed_sig;
+	guint name_watch;
+	guint subscriptions[2];
+	gboolean running;
+	gboolean known;
+	gboolean ever_known;
+	guint generation;
+	gchar *domain;
+	guint refresh_source;
+} NetworkWatch;
+
+/* For the bus connection last used, until that connection closes */
+static NetworkWatch *network_watch = NULL;
 
 typedef struct {
 	gint outstanding;
 	GList *values;
+	gboolean failed;
+	gboolean cached;
+	gchar *domain;
+	gboolean watched;
+	guint generation;
 } LookupClosure;
 
 static void
@@ -28,9 +61,22 @@ lookup_closure_free (gpointer data)
 	LookupClosure *lookup = data;
 	g_assert (lookup->outstanding == 0);
 	g_list_free_full (lookup->values, (GDestroyNotify)g_variant_unref);
+	g_free (lookup->domain);
 	g_free (lookup);
 }
 
+static void
+lookup_take_error (GSimpleAsyncResult *res,
+                   GError *error)
+{
+	LookupClosure *lookup = g_simple_async_result_get_op_res_gpointer (res);
+
+	lookup->failed = TRUE;
+	g_simple_async_result_take_error (res, error);
+}
+
+static void lookup_complete (GSimpleAsyncResult *res);
+
 static GVariant *
 lookup_get_property_finish (GDBusConnection *connection,
                             GAsyncResult *result,
@@ -84,12 +130,12 @@ on_options (GObject *object,
 	value = lookup_get_property_finish (connection, result,
 	                                    G_VARIANT_TYPE ("a{sv}"), &error);
 	if (error != NULL)
-		g_simple_async_result_take_error (res, error);
+		lookup_take_error (res, error);
 	if (value != NULL)
 		lookup->values = g_list_prepend (lookup->values, value);
 
 	if (lookup->outstanding-- == 1)
-		g_simple_async_result_complete (res);
+		lookup_complete (res);
 
 	g_object_unref (res);
 }
@@ -110,7 +156,7 @@ on_dhcp_config (GObject *object,
 	value = lookup_get_property_finish (connection, result,
 	                                    G_VARIANT_TYPE_OBJECT_PATH, &error);
 	if (error != NULL)
-		g_simple_async_result_take_error (res, error);
+		lookup_take_error (res, error);
 	if (value != NULL) {
 		path = g_variant_get_string (value, NULL);
 		if (path && !g_str_equal (path, "") && !g_str_equal (path, "/")) {
@@ -123,7 +169,7 @@ on_dhcp_config (GObject *object,
 	}
 
 	if (lookup->outstanding-- == 1)
-		g_simple_async_result_complete (res);
+		lookup_complete (res);
 
 	g_object_unref (res);
 }
@@ -160,7 +206,7 @@ on_devices (GObject *object,
 	value = lookup_get_property_finish (connection, result,
 	                                    G_VARIANT_TYPE_OBJECT_PATH_ARRAY, &error);
 	if (error != NULL)
-		g_simple_async_result_take_error (res, error);
+		lookup_take_error (res, error);
 	if (value != NULL) {
 		paths = g_variant_get_objv (value, NULL);
 		for (i = 0; paths[i] != NULL; i++) {
@@ -178,7 +224,7 @@ on_devices (GObject *object,
 	}
 
 	if (lookup->outstanding-- == 1)
-		g_simple_async_result_complete (res);
+		lookup_complete (res);
 
 	g_object_unref (res);
 }
@@ -199,7 +245,7 @@ on_active_connections (GObject *object,
 	value = lookup_get_property_finish (connection, result,
 	                                    G_VARIANT_TYPE_OBJECT_PATH_ARRAY, &error);
 	if (error != NULL)
-		g_simple_async_result_take_error (res, error);
+		lookup_take_error (res, error);
 	if (value != NULL) {
 		paths = g_variant_get_objv (value, NULL);
 		for (i = 0; paths[i] != NULL; i++) {
@@ -212,11 +258,216 @@ on_active_connections (GObject *object,
 	}
 
 	if (lookup->outstanding-- == 1)
-		g_simple_async_result_complete (res);
+		lookup_complete (res);
 
 	g_object_unref (res);
 }
 
+static void
+on_refreshed (GObject *source,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+	GError *error = NULL;
+	gchar *domain;
+
+	/* The lookup remembered the domain when it completed */
+	domain = realm_network_get_dhcp_domain_finish (result, &error);
+	if (error != NULL) {
+		g_debug ("Couldn't get DHCP domain from NetworkManager: %s", error->message);
+		g_error_free (error);
+	}
+
+	g_free (domain);
+}
+
+static gboolean
+on_refresh_timeout (gpointer user_data)
+{
+	NetworkWatch *watch = user_data;
+
+	watch->refresh_source = 0;
+	if (watch->running)
+		realm_network_get_dhcp_domain_async (watch->connection, on_refreshed, NULL);
+	return FALSE;
+}
+
+static void
+invalidate_domain (NetworkWatch *watch)
+{
+	/* Lookups already in flight may have missed this change */
+	watch->known = FALSE;
+	watch->generation++;
+
+	if (watch->refresh_source)
+		g_source_remove (watch->refresh_source);
+	watch->refresh_source = 0;
+	if (watch->running)
+		watch->refresh_source = g_timeout_add (REFRESH_DELAY_MS, on_refresh_timeout, watch);
+}
+
+static void
+update_domain (NetworkWatch *watch,
+               const gchar *domain)
+{
+	gboolean changed;
+
+	changed = watch->ever_known && g_strcmp0 (domain, watch->domain) != 0;
+
+	g_free (watch->domain);
+	watch->domain = g_strdup (domain);
+	watch->known = TRUE;
+	watch->ever_known = TRUE;
+
+	/* Anything discovered on the old network may not hold on this one */
+	if (changed) {
+		g_debug ("DHCP domain changed to: %s", domain ? domain : "(none)");
+		realm_disco_cache_set_dhcp_domain (domain);
+		realm_disco_cache_flush ();
+	}
+}
+
+static gboolean
+interface_matters (const gchar *interface)
+{
+	const gchar *interfaces[] = {
+		"org.freedesktop.NetworkManager",
+		"org.freedesktop.NetworkManager.Connection.Active",
+		"org.freedesktop.NetworkManager.Device",
+		"org.freedesktop.NetworkManager.DHCP4Config",
+		"org.freedesktop.NetworkManager.DHCP6Config",
+	};
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (interfaces); i++) {
+		if (g_strcmp0 (interface, interfaces[i]) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+on_network_changed (GDBusConnection *connection,
+                    const gchar *sender_name,
+                    const gchar *object_path,
+                    const gchar *interface_name,
+                    const gchar *signal_name,
+                    GVariant *parameters,
+                    gpointer user_data)
+{
+	NetworkWatch *watch = user_data;
+	const gchar *changed;
+
+	/* The standard signal names the interface as an argument */
+	changed = interface_name;
+	if (g_str_equal (interface_name, DBUS_PROPERTIES_INTERFACE) &&
+	    g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+		g_variant_get_child (parameters, 0, "&s", &changed);
+
+	/* Ignore things like access point signal strength */
+	if (interface_matters (changed))
+		invalidate_domain (watch);
+}
+
+static void
+on_network_manager_appeared (GDBusConnection *connection,
+                             const gchar *name,
+                             const gchar *name_owner,
+                             gpointer user_data)
+{
+	NetworkWatch *watch = user_data;
+
+	g_debug ("NetworkManager is running, watching for DHCP domain changes");
+	watch->running = TRUE;
+	invalidate_domain (watch);
+}
+
+static void
+on_network_manager_vanished (GDBusConnection *connection,
+                             const gchar *name,
+                             gpointer user_data)
+{
+	NetworkWatch *watch = user_data;
+
+	/* Lookups go back to asking every time, which fails quickly */
+	watch->running = FALSE;
+	invalidate_domain (watch);
+}
+
+static void
+network_watch_free (NetworkWatch *watch)
+{
+	if (watch->refresh_source)
+		g_source_remove (watch->refresh_source);
+	g_dbus_connection_signal_unsubscribe (watch->connection, watch->subscriptions[0]);
+	g_dbus_connection_signal_unsubscribe (watch->connection, watch->subscriptions[1]);
+	g_bus_unwatch_name (watch->name_watch);
+	g_signal_handler_disconnect (watch->connection, watch->closed_sig);
+	g_object_unref (watch->connection);
+	g_free (watch->domain);
+	g_free (watch);
+}
+
+static void
+on_connection_closed (GDBusConnection *connection,
+                      gboolean remote_peer_vanished,
+                      GError *error,
+                      gpointer user_data)
+{
+	NetworkWatch *watch = user_data;
+
+	g_assert (watch == network_watch);
+	network_watch = NULL;
+	network_watch_free (watch);
+}
+
+static NetworkWatch *
+prepare_watch (GDBusConnection *connection)
+{
+	NetworkWatch *watch;
+
+	if (network_watch && network_watch->connection == connection)
+		return network_watch;
+	if (g_dbus_connection_is_closed (connection))
+		return NULL;
+
+	watch = g_new0 (NetworkWatch, 1);
+	watch->connection = g_object_ref (connection);
+
+	/*
+	 * Looking up on another connection moves the watch there. What was
+	 * learned carries over, and lookups begun on the old one are stale.
+	 */
+	if (network_watch) {
+		watch->generation = network_watch->generation + 1;
+		watch->domain = g_strdup (network_watch->domain);
+		watch->ever_known = network_watch->ever_known;
+		network_watch_free (network_watch);
+		network_watch = NULL;
+	}
+
+	watch->closed_sig = g_signal_connect (connection, "closed",
+	                                      G_CALLBACK (on_connection_closed), watch);
+
+	watch->subscriptions[0] = g_dbus_connection_signal_subscribe (connection, NETWORK_MANAGER_NAME,
+	                                                              NULL, "PropertiesChanged", NULL, NULL,
+	                                                              G_DBUS_SIGNAL_FLAGS_NONE,
+	                                                              on_network_changed, watch, NULL);
+	watch->subscriptions[1] = g_dbus_connection_signal_subscribe (connection, NETWORK_MANAGER_NAME,
+	                                                              NULL, "StateChanged", NULL, NULL,
+	                                                              G_DBUS_SIGNAL_FLAGS_NONE,
+	                                                              on_network_changed, watch, NULL);
+	watch->name_watch = g_bus_watch_name_on_connection (connection, NETWORK_MANAGER_NAME,
+	                                                    G_BUS_NAME_WATCHER_FLAGS_NONE,
+	                                                    on_network_manager_appeared,
+	                                                    on_network_manager_vanished,
+	                                                    watch, NULL);
+
+	network_watch = watch;
+	return watch;
+}
+
 void
 realm_network_get_dhcp_domain_async (GDBusConnection *connection,
                                      GAsyncReadyCallback callback,
@@ -224,6 +475,7 @@ realm_network_get_dhcp_domain_async (GDBusConnection *connection,
 {
 	GSimpleAsyncResult *res;
 	LookupClosure *lookup;
+	NetworkWatch *watch;
 
 	g_return_if_fail (G_IS_DBUS_CONNECTION (connection));
 
@@ -232,6 +484,21 @@ realm_network_get_dhcp_domain_async (GDBusConnection *connection,
 	lookup = g_new0 (LookupClosure, 1);
 	g_simple_async_result_set_op_res_gpointer (res, lookup, lookup_closure_free);
 
+	/* Nothing changed since we last looked */
+	watch = prepare_watch (connection);
+	if (watch && watch->running && watch->known) {
+		lookup->cached = TRUE;
+		lookup->domain = g_strdup (watch->domain);
+		g_simple_async_result_complete_in_idle (res);
+		g_object_unref (res);
+		return;
+	}
+
+	if (watch && watch->running) {
+		lookup->watched = TRUE;
+		lookup->generation = watch->generation;
+	}
+
 	lookup_get_property_async (connection, "/org/freedesktop/NetworkManager",
 	                           "org.freedesktop.NetworkManager", "ActiveConnections",
 	                           on_active_connections, g_object_ref (res));
@@ -239,31 +506,389 @@ realm_network_get_dhcp_domain_async (GDBusConnection *connection,
 	g_object_unref (res);
 }
 
+static gchar *
+lookup_domain (LookupClosure *lookup)
+{
+	gchar *domain;
+	GList *l;
+
+	for (l = lookup->values; l != NULL; l = g_list_next (l)) {
+		if (g_variant_lookup (l->data, "domain_name", "s", &domain)) {
+			if (domain && domain[0])
+				return domain;
+			g_free (domain);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+lookup_complete (GSimpleAsyncResult *res)
+{
+	LookupClosure *lookup = g_simple_async_result_get_op_res_gpointer (res);
+
+	lookup->domain = lookup_domain (lookup);
+
+	/*
+	 * Remember it, unless something changed while we were looking. This
+	 * happens here rather than in finish, so it doesn't depend on callers.
+	 */
+	if ((lookup->domain || !lookup->failed) && lookup->watched && network_watch &&
+	    network_watch->running && network_watch->generation == lookup->generation)
+		update_domain (network_watch, lookup->domain);
+
+	g_simple_async_result_complete (res);
+}
+
 gchar *
 realm_network_get_dhcp_domain_finish (GAsyncResult *result,
                                       GError **error)
 {
 	GSimpleAsyncResult *res;
 	LookupClosure *lookup;
-	gchar *domain;
-	GList *l;
 
 	g_return_val_if_fail (g_simple_async_result_is_valid (result, NULL,
 	                      realm_network_get_dhcp_domain_async), NULL);
 	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
 	res = G_SIMPLE_ASYNC_RESULT (result);
-
 	lookup = g_simple_async_result_get_op_res_gpointer (res);
-	for (l = lookup->values; l != NULL; l = g_list_next (l)) {
-		if (g_variant_lookup (l->data, "domain_name", "s", &domain)) {
-			if (domain && domain[0])
-				return domain;
+
+	/* Only report errors if no domain was found */
+	if (lookup->domain == NULL && !lookup->cached &&
+	    g_simple_async_result_propagate_error (res, error))
+		return NULL;
+
+	return g_strdup (lookup->domain);
+}
+
+/* In order of preference */
+enum {
+	SOURCE_NETWORK_MANAGER,
+	SOURCE_RESOLVED,
+	SOURCE_RESOLV_CONF,
+	N_SOURCES
+};
+
+static const gchar *source_names[N_SOURCES] = {
+	"NetworkManager",
+	"systemd-resolved",
+	"resolv.conf",
+};
+
+typedef struct {
+	gchar *domains[N_SOURCES];
+	gboolean done[N_SOURCES];
+	gboolean waited;
+	gboolean completed;
+	guint timeout_id;
+	const gchar *source;
+	gint failures;
+	GError *error;
+} DefaultClosure;
+
+static void
+default_closure_free (gpointer data)
+{
+	DefaultClosure *clo = data;
+	gint i;
+
+	for (i = 0; i < N_SOURCES; i++)
+		g_free (clo->domains[i]);
+	if (clo->timeout_id)
+		g_source_remove (clo->timeout_id);
+	g_clear_error (&clo->error);
+	g_free (clo);
+}
+
+static gchar *
+usable_domain (const gchar *domain)
+{
+	gchar *value;
+
+	if (domain == NULL)
+		return NULL;
+
+	value = g_strstrip (g_strdup (domain));
+
+	/* The root domain, or a trailing dot */
+	while (value[0] && value[strlen (value) - 1] == '.')
+		value[strlen (value) - 1] = '\0';
+
+	if (value[0] == '\0') {
+		g_free (value);
+		return NULL;
+	}
+
+	return value;
+}
+
+static void
+default_complete (GTask *task,
+                  gint source)
+{
+	DefaultClosure *clo = g_task_get_task_data (task);
+
+	clo->completed = TRUE;
+	if (clo->timeout_id)
+		g_source_remove (clo->timeout_id);
+	clo->timeout_id = 0;
+
+	if (source < 0) {
+		/* Only a failure when no source could answer at all */
+		if (clo->error && clo->failures == N_SOURCES) {
+			g_task_return_error (task, clo->error);
+			clo->error = NULL;
+		} else {
+			g_task_return_pointer (task, NULL, NULL);
+		}
+
+	} else {
+		clo->source = source_names[source];
+		g_task_return_pointer (task, clo->domains[source], g_free);
+		clo->domains[source] = NULL;
+	}
+}
+
+static void
+default_check (GTask *task)
+{
+	DefaultClosure *clo = g_task_get_task_data (task);
+	gboolean all = TRUE;
+	gint i;
+
+	if (clo->completed)
+		return;
+
+	/*
+	 * The most preferred source with an answer wins, once those before
+	 * it have nothing. After waiting a while, any answer will do.
+	 */
+	for (i = 0; i < N_SOURCES; i++) {
+		if (clo->done[i] && clo->domains[i]) {
+			default_complete (task, i);
+			return;
+		}
+		if (!clo->done[i]) {
+			if (!clo->waited)
+				return;
+			all = FALSE;
+		}
+	}
+
+	if (all)
+		default_complete (task, -1);
+}
+
+static void
+default_answer (GTask *task,
+                gint source,
+                gchar *domain,
+                GError *error)
+{
+	DefaultClosure *clo = g_task_get_task_data (task);
+
+	if (error) {
+		g_debug ("Couldn't get default domain from %s: %s", source_names[source], error->message);
+		clo->failures++;
+		if (clo->error == NULL)
+			clo->error = error;
+		else
+			g_error_free (error);
+	}
+
+	clo->domains[source] = usable_domain (domain);
+	clo->done[source] = TRUE;
+	g_free (domain);
+
+	default_check (task);
+}
+
+static gboolean
+on_default_timeout (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	DefaultClosure *clo = g_task_get_task_data (task);
+
+	clo->timeout_id = 0;
+	clo->waited = TRUE;
+	default_check (task);
+	return FALSE;
+}
+
+static void
+on_default_dhcp (GObject *source,
+                 GAsyncResult *result,
+                 gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GError *error = NULL;
+	gchar *domain;
+
+	domain = realm_network_get_dhcp_domain_finish (result, &error);
+	default_answer (task, SOURCE_NETWORK_MANAGER, domain, error);
+	g_object_unref (task);
+}
+
+static gchar *
+resolved_pick_domain (GVariant *domains)
+{
+	GVariantIter iter;
+	const gchar *domain;
+	gchar *global = NULL;
+	gchar *value;
+	gboolean route_only;
+	gint32 ifindex;
+
+	/* Older versions of systemd-resolved have no routing only flag */
+	g_variant_iter_init (&iter, domains);
+	for (;;) {
+		route_only = FALSE;
+		if (g_variant_is_of_type (domains, G_VARIANT_TYPE ("a(isb)"))) {
+			if (!g_variant_iter_next (&iter, "(i&sb)", &ifindex, &domain, &route_only))
+				break;
+		} else {
+			if (!g_variant_iter_next (&iter, "(i&s)", &ifindex, &domain))
+				break;
+		}
+
+		/* Routing only domains are not search domains */
+		if (route_only)
+			continue;
+
+		value = usable_domain (domain);
+		if (value == NULL)
+			continue;
+
+		/* Prefer what came with a link over global configuration */
+		if (ifindex > 0) {
+			g_free (global);
+			return value;
+		}
+
+		if (global == NULL)
+			global = value;
+		else
+			g_free (value);
+	}
+
+	return global;
+}
+
+static void
+on_default_resolved (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GError *error = NULL;
+	GVariant *retval;
+	GVariant *value;
+	gchar *domain = NULL;
+
+	retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+	if (retval != NULL) {
+		g_variant_get (retval, "(v)", &value);
+		if (g_variant_is_of_type (value, G_VARIANT_TYPE ("a(isb)")) ||
+		    g_variant_is_of_type (value, G_VARIANT_TYPE ("a(is)")))
+			domain = resolved_pick_domain (value);
+		g_variant_unref (value);
+		g_variant_unref (retval);
+	}
+
+	default_answer (task, SOURCE_RESOLVED, domain, error);
+	g_object_unref (task);
+}
+
+static gchar *
+parse_resolv_conf (const gchar *contents)
+{
+	gchar *domain = NULL;
+	gchar **lines;
+	gchar **words;
+	gint i;
+
+	/* Like the resolver, the last domain or search line wins */
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		g_strdelimit (lines[i], "\t", ' ');
+		words = g_strsplit (g_strstrip (lines[i]), " ", -1);
+		if (words[0] && (g_str_equal (words[0], "domain") || g_str_equal (words[0], "search"))) {
 			g_free (domain);
+			domain = NULL;
+			if (words[1] && words[1][0])
+				domain = g_strdup (words[1]);
 		}
+		g_strfreev (words);
 	}
 
-	/* Only report errors if no domain was found */
-	g_simple_async_result_propagate_error (res, error);
-	return NULL;
+	g_strfreev (lines);
+	return domain;
+}
+
+void
+realm_network_get_default_domain_async (GDBusConnection *connection,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data)
+{
+	DefaultClosure *clo;
+	gchar *contents;
+	GError *error = NULL;
+	gchar *domain = NULL;
+	GTask *task;
+
+	g_return_if_fail (G_IS_DBUS_CONNECTION (connection));
+
+	task = g_task_new (NULL, NULL, callback, user_data);
+	clo = g_new0 (DefaultClosure, 1);
+	g_task_set_task_data (task, clo, default_closure_free);
+
+	/* All the sources are asked at once */
+	realm_network_get_dhcp_domain_async (connection, on_default_dhcp, g_object_ref (task));
+
+	g_dbus_connection_call (connection, "org.freedesktop.resolve1", "/org/freedesktop/resolve1",
+	                        DBUS_PROPERTIES_INTERFACE, "Get",
+	                        g_variant_new ("(ss)", "org.freedesktop.resolve1.Manager", "Domains"),
+	                        G_VARIANT_TYPE ("(v)"), G_DBUS_CALL_FLAGS_NONE,
+	                        -1, NULL, on_default_resolved, g_object_ref (task));
+
+	/* A local file, no need to do this in the background */
+	if (g_file_get_contents (realm_settings_path ("resolv.conf"), &contents, NULL, &error)) {
+		domain = parse_resolv_conf (contents);
+		g_free (contents);
+	} else if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+		g_clear_error (&error);
+	}
+
+	/* Only decided once the others answer */
+	clo->domains[SOURCE_RESOLV_CONF] = usable_domain (domain);
+	clo->done[SOURCE_RESOLV_CONF] = TRUE;
+	g_free (domain);
+	if (error) {
+		g_debug ("Couldn't read resolv.conf: %s", error->message);
+		clo->failures++;
+		clo->error = error;
+	}
+
+	clo->timeout_id = g_timeout_add (DEFAULT_DOMAIN_WAIT_MS, on_default_timeout, task);
+	g_object_unref (task);
+}
+
+gchar *
+realm_network_get_default_domain_finish (GAsyncResult *result,
+                                         const gchar **source,
+                                         GError **error)
+{
+	DefaultClosure *clo;
+	gchar *domain;
+
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	clo = g_task_get_task_data (G_TASK (result));
+	domain = g_task_propagate_pointer (G_TASK (result), error);
+	if (source)
+		*source = domain ? clo->source : NULL;
+	return domain;
 }
@@ -28,6 +28,14 @@ void           realm_network_get_dhcp_domain_async   (GDBusConnection *connectio
 gchar *        realm_network_get_dhcp_domain_finish  (GAsyncResult *result,
                                                       GError **error);
 
+void           realm_network_get_default_domain_async  (GDBusConnection *connection,
+                                                        GAsyncReadyCallback callback,
+                                                        gpointer user_data);
+
+gchar *        realm_network_get_default_domain_finish (GAsyncResult *result,
+                                                        const gchar **source,
+                                                        GError **error);
+
 G_END_DECLS
 
 #endif /* __REALM_NETWORK_H__ */
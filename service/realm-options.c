@@ -131,6 +131,19 @@ realm_options_qualify_names (const gchar *realm_name)
 	return qualify;
 }
 
+gboolean
+realm_options_prefer_discovered_server (const gchar *realm_name)
+{
+	gchar *section;
+	gboolean prefer;
+
+	section = g_utf8_casefold (realm_name, -1);
+	prefer = realm_settings_boolean (section, "prefer-discovered-server", FALSE);
+	g_free (section);
+
+	return prefer;
+}
+
 gboolean
 realm_options_check_domain_name (const gchar *name)
 {
@@ -39,6 +39,8 @@ gboolean       realm_options_automatic_mapping        (GVariant *options,
 
 gboolean       realm_options_qualify_names            (const gchar *realm_name);
 
+gboolean       realm_options_prefer_discovered_server (const gchar *realm_name);
+
 gboolean       realm_options_check_domain_name        (const gchar *domain_name);
 
 const gchar *  realm_options_computer_name           (GVariant *options,
@@ -18,12 +18,14 @@
 #include "realm-dbus-constants.h"
 #include "realm-dbus-generated.h"
 #include "realm-diagnostics.h"
+#include "realm-disco-cache.h"
 #include "realm-errors.h"
 #include "realm-invocation.h"
 #include "realm-kerberos.h"
 #include "realm-network.h"
 #include "realm-provider.h"
 #include "realm-settings.h"
+#include "realm-timings.h"
 
 #include <glib/gi18n.h>
 #include <gio/gio.h>
@@ -43,6 +45,7 @@ typedef struct {
 	GVariant *options;
 	gchar *string;
 	guint timeout_id;
+	gint64 started;
 } MethodClosure;
 
 static MethodClosure *
@@ -96,6 +99,62 @@ discover_configured (RealmProvider *self,
 	return matched;
 }
 
+static const gchar *
+stream_operation (GDBusMethodInvocation *invocation)
+{
+	const gchar *operation;
+
+	operation = realm_invocation_get_operation (invocation);
+	if (operation == NULL)
+		operation = g_object_get_data (G_OBJECT (invocation), "realm-stream-operation");
+	return operation ? operation : "";
+}
+
+static void
+emit_stream_signal (GDBusMethodInvocation *invocation,
+                    const gchar *signal,
+                    GVariant *parameters)
+{
+	GError *error = NULL;
+
+	/* Only the caller is interested, just like with diagnostics */
+	g_dbus_connection_emit_signal (g_dbus_method_invocation_get_connection (invocation),
+	                               g_dbus_method_invocation_get_sender (invocation),
+	                               g_dbus_method_invocation_get_object_path (invocation),
+	                               REALM_DBUS_PROVIDER_INTERFACE, signal, parameters, &error);
+
+	if (error != NULL) {
+		g_warning ("couldn't emit the %s signal: %s", signal, error->message);
+		g_error_free (error);
+	}
+}
+
+static void
+complete_streaming (GDBusMethodInvocation *invocation,
+                    GList *realms,
+                    gint relevance,
+                    GError *error)
+{
+	GPtrArray *paths;
+	GList *l;
+
+	realm_provider_stream_realms (invocation, realms, relevance);
+	g_object_set_data (G_OBJECT (invocation), "realm-stream-completed", GINT_TO_POINTER (1));
+
+	paths = g_ptr_array_new ();
+	for (l = realms; l != NULL; l = g_list_next (l))
+		g_ptr_array_add (paths, g_variant_new_object_path (g_dbus_object_get_object_path (l->data)));
+
+	emit_stream_signal (invocation, REALM_DBUS_DISCOVER_COMPLETED_SIGNAL,
+	                    g_variant_new ("(si@aos)", stream_operation (invocation), relevance,
+	                                   g_variant_new_array (G_VARIANT_TYPE ("o"),
+	                                                        (GVariant *const *)paths->pdata,
+	                                                        paths->len),
+	                                   error ? error->message : ""));
+
+	g_ptr_array_free (paths, TRUE);
+}
+
 static void
 return_discover_result (MethodClosure *closure,
                         GList *realms,
@@ -129,8 +188,14 @@ return_discover_result (MethodClosure *closure,
 		relevance = 20;
 	}
 
-	if (error == NULL) {
+	if (error == NULL)
 		realms = g_list_sort (realms, sort_configured_first);
+
+	/* The method itself already returned when streaming */
+	if (error == NULL && realm_provider_is_streaming (closure->invocation)) {
+		complete_streaming (closure->invocation, realms, relevance, NULL);
+
+	} else if (error == NULL) {
 		results = g_ptr_array_new ();
 		for (l = realms; l != NULL; l = g_list_next (l)) {
 			path = g_dbus_object_get_object_path (l->data);
@@ -148,18 +213,24 @@ return_discover_result (MethodClosure *closure,
 		if (error->domain == REALM_ERROR || error->domain == G_DBUS_ERROR) {
 			g_dbus_error_strip_remote_error (error);
 			realm_diagnostics_error (closure->invocation, error, NULL);
-			g_dbus_method_invocation_return_gerror (closure->invocation, error);
 
 		} else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
 			realm_diagnostics_error (closure->invocation, error, "Cancelled");
-			g_dbus_method_invocation_return_error (closure->invocation, REALM_ERROR, REALM_ERROR_CANCELLED,
-			                                       _("Operation was cancelled."));
+			g_clear_error (&error);
+			g_set_error (&error, REALM_ERROR, REALM_ERROR_CANCELLED,
+			             _("Operation was cancelled."));
 
 		} else {
 			realm_diagnostics_error (closure->invocation, error, "Failed to discover realm");
-			g_dbus_method_invocation_return_error (closure->invocation, REALM_ERROR, REALM_ERROR_FAILED,
-			                                       _("Failed to discover realm. See diagnostics."));
+			g_clear_error (&error);
+			g_set_error (&error, REALM_ERROR, REALM_ERROR_FAILED,
+			             _("Failed to discover realm. See diagnostics."));
 		}
+
+		if (realm_provider_is_streaming (closure->invocation))
+			complete_streaming (closure->invocation, NULL, 0, error);
+		else
+			g_dbus_method_invocation_return_gerror (closure->invocation, error);
 		g_error_free (error);
 	}
 
@@ -187,30 +258,31 @@ on_discover_default (GObject *source,
                      gpointer user_data)
 {
 	MethodClosure *method = user_data;
+	const gchar *from = NULL;
 	GError *error = NULL;
 
-	method->string = realm_network_get_dhcp_domain_finish (result, &error);
+	method->string = realm_network_get_default_domain_finish (result, &from, &error);
+	realm_timings_record (method->invocation, "default-domain", from, method->started,
+	                      error ? error->message : NULL);
 	if (error != NULL) {
-		realm_diagnostics_error (method->invocation, error, "Couldn't get default domain from DHCP");
+		realm_diagnostics_error (method->invocation, error, "Couldn't get default domain");
 		g_clear_error (&error);
 	}
 
-	if (method->string) {
-		g_strstrip (method->string);
-		if (g_str_equal (method->string, "")) {
-			g_free (method->string);
-			method->string = NULL;
-		}
-	}
+	/* Discovery failures from before may not hold on this network */
+	realm_disco_cache_set_dhcp_domain (method->string);
 
-	/* Yay we have a default domain from DHCP, use it */
+	/* Yay we have a default domain, use it */
 	if (method->string) {
+		realm_diagnostics_info (method->invocation, "Using default domain %s from %s",
+		                        method->string, from);
 		realm_provider_discover (method->self, method->string,
 		                         method->options, method->invocation,
+		                         realm_invocation_get_cancellable (method->invocation),
 		                         on_discover_complete, method);
 
 	} else {
-		realm_diagnostics_info (method->invocation, "No default domain received via DHCP");
+		realm_diagnostics_info (method->invocation, "No default domain found");
 		return_discover_result (method, NULL, 0, NULL);
 	}
 }
@@ -238,6 +310,8 @@ realm_provider_handle_discover (RealmDbusProvider *provider,
 	GDBusConnection *connection;
 	MethodClosure *method;
 
+	realm_timings_begin (invocation);
+
 	method = method_closure_new (self, invocation, options);
 	method->timeout_id = g_timeout_add_seconds (TIMEOUT_SECONDS,
 	                                            on_discover_timeout, method);
@@ -246,17 +320,274 @@ realm_provider_handle_discover (RealmDbusProvider *provider,
 
 	if (g_str_equal (string, "")) {
 		connection = g_dbus_method_invocation_get_connection (invocation);
-		realm_network_get_dhcp_domain_async (connection, on_discover_default,
-		                                     method);
+		method->started = g_get_monotonic_time ();
+		realm_network_get_default_domain_async (connection, on_discover_default,
+		                                        method);
 
 	} else {
 		realm_provider_discover (self, method->string, options, invocation,
+		                         realm_invocation_get_cancellable (invocation),
 		                         on_discover_complete, method);
 	}
 
 	return TRUE;
 }
 
+static gboolean
+realm_provider_handle_discover_streaming (RealmDbusProvider *provider,
+                                          GDBusMethodInvocation *invocation,
+                                          const gchar *string,
+                                          GVariant *options,
+                                          gpointer user_data)
+{
+	static guint counter = 0;
+
+	/* Without an operation from the caller, make one up to tag the signals */
+	if (realm_invocation_get_operation (invocation) == NULL) {
+		g_object_set_data_full (G_OBJECT (invocation), "realm-stream-operation",
+		                        g_strdup_printf ("discover-%u", ++counter), g_free);
+	}
+
+	/* Holds its own reference to the invocation, so can return right away */
+	realm_provider_handle_discover (provider, invocation, string, options, user_data);
+	g_object_ref (invocation);
+	realm_dbus_provider_complete_discover_streaming (provider, invocation,
+	                                                 stream_operation (invocation));
+	g_object_unref (invocation);
+
+	return TRUE;
+}
+
+typedef struct _BatchClosure BatchClosure;
+
+typedef struct {
+	BatchClosure *batch;
+	const gchar *string;
+	gint relevance;
+	GList *realms;
+	gchar *failure;
+	guint timeout_id;
+	gboolean timed_out;
+	GCancellable *cancellable;
+	gulong cancel_sig;
+} BatchItem;
+
+struct _BatchClosure {
+	RealmProvider *self;
+	GDBusMethodInvocation *invocation;
+	GVariant *options;
+	gchar **strings;
+	BatchItem *items;
+	guint n_items;
+	guint next;
+	gint running;
+	gint max;
+};
+
+static void
+batch_closure_free (BatchClosure *batch)
+{
+	guint i;
+
+	for (i = 0; i < batch->n_items; i++) {
+		g_assert (batch->items[i].timeout_id == 0);
+		g_assert (batch->items[i].cancellable == NULL);
+		g_list_free_full (batch->items[i].realms, g_object_unref);
+		g_free (batch->items[i].failure);
+	}
+
+	g_object_unref (batch->self);
+	g_object_unref (batch->invocation);
+	g_variant_unref (batch->options);
+	g_strfreev (batch->strings);
+	g_free (batch->items);
+	g_free (batch);
+}
+
+static void
+batch_complete (BatchClosure *batch)
+{
+	GVariantBuilder builder;
+	GVariantBuilder paths;
+	GCancellable *cancellable;
+	BatchItem *item;
+	GList *l;
+	guint i;
+
+	cancellable = realm_invocation_get_cancellable (batch->invocation);
+	if (g_cancellable_is_cancelled (cancellable)) {
+		g_dbus_method_invocation_return_error (batch->invocation, REALM_ERROR, REALM_ERROR_CANCELLED,
+		                                       _("Operation was cancelled."));
+		batch_closure_free (batch);
+		return;
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(siaos)"));
+	for (i = 0; i < batch->n_items; i++) {
+		item = batch->items + i;
+		g_variant_builder_init (&paths, G_VARIANT_TYPE ("ao"));
+		for (l = item->realms; l != NULL; l = g_list_next (l))
+			g_variant_builder_add (&paths, "o", g_dbus_object_get_object_path (l->data));
+		g_variant_builder_add (&builder, "(siaos)", item->string, item->relevance,
+		                       &paths, item->failure ? item->failure : "");
+	}
+
+	realm_dbus_provider_complete_discover_many (batch->self->pv->provider_iface, batch->invocation,
+	                                            g_variant_builder_end (&builder));
+	batch_closure_free (batch);
+}
+
+static void batch_next (BatchClosure *batch);
+
+static gboolean
+on_batch_item_timeout (gpointer user_data)
+{
+	BatchItem *item = user_data;
+	BatchClosure *batch = item->batch;
+
+	item->timeout_id = 0;
+	item->timed_out = TRUE;
+
+	/* Same deadline as a plain Discover(), only this item fails though */
+	realm_diagnostics_error (batch->invocation, NULL, "Discovery of %s timed out after %d seconds",
+	                         item->string, TIMEOUT_SECONDS);
+
+	/* Its slot is only free once the discovery has wound down */
+	g_cancellable_cancel (item->cancellable);
+	return FALSE;
+}
+
+static void
+on_batch_cancelled (GCancellable *cancellable,
+                    gpointer user_data)
+{
+	/* Cancelling the whole DiscoverMany() cancels each discovery */
+	g_cancellable_cancel (user_data);
+}
+
+static void
+on_batch_discover (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+	BatchItem *item = user_data;
+	BatchClosure *batch = item->batch;
+	GCancellable *cancellable;
+	GError *error = NULL;
+
+	if (item->timeout_id)
+		g_source_remove (item->timeout_id);
+	item->timeout_id = 0;
+
+	cancellable = realm_invocation_get_cancellable (batch->invocation);
+	if (item->cancel_sig)
+		g_cancellable_disconnect (cancellable, item->cancel_sig);
+	item->cancel_sig = 0;
+	g_clear_object (&item->cancellable);
+
+	item->realms = realm_provider_discover_finish (batch->self, result, &item->relevance, &error);
+
+	/* Whatever it found in the end came too late */
+	if (item->timed_out) {
+		g_list_free_full (item->realms, g_object_unref);
+		item->realms = NULL;
+		item->relevance = 0;
+		g_clear_error (&error);
+		item->failure = g_strdup_printf (_("Discovery timed out after %d seconds"), TIMEOUT_SECONDS);
+	}
+
+	/* Same fallback and messages as a plain Discover() */
+	if (error == NULL && item->realms == NULL && !item->timed_out) {
+		item->realms = discover_configured (batch->self, item->string);
+		if (item->realms)
+			item->relevance = 20;
+	}
+
+	if (error == NULL) {
+		item->realms = g_list_sort (item->realms, sort_configured_first);
+	} else if (error->domain == REALM_ERROR || error->domain == G_DBUS_ERROR) {
+		g_dbus_error_strip_remote_error (error);
+		item->failure = g_strdup (error->message);
+	} else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		item->failure = g_strdup (_("Operation was cancelled."));
+	} else {
+		realm_diagnostics_error (batch->invocation, error, "Failed to discover realm: %s", item->string);
+		item->failure = g_strdup (_("Failed to discover realm. See diagnostics."));
+	}
+
+	g_clear_error (&error);
+
+	g_assert (batch->running > 0);
+	batch->running--;
+	batch_next (batch);
+}
+
+static void
+batch_next (BatchClosure *batch)
+{
+	GCancellable *cancellable;
+	BatchItem *item;
+
+	/* Identical domains in flight at once share a single discovery */
+	while (batch->running < batch->max && batch->next < batch->n_items) {
+		item = batch->items + batch->next++;
+		if (item->string[0] == '\0') {
+			item->failure = g_strdup (_("No domain or realm specified"));
+			continue;
+		}
+
+		/* Each discovery can be given up on by itself */
+		item->cancellable = g_cancellable_new ();
+		cancellable = realm_invocation_get_cancellable (batch->invocation);
+		if (cancellable) {
+			item->cancel_sig = g_cancellable_connect (cancellable, G_CALLBACK (on_batch_cancelled),
+			                                          g_object_ref (item->cancellable), g_object_unref);
+		}
+
+		item->timeout_id = g_timeout_add_seconds (TIMEOUT_SECONDS, on_batch_item_timeout, item);
+		batch->running++;
+		realm_provider_discover (batch->self, item->string, batch->options, batch->invocation,
+		                         item->cancellable, on_batch_discover, item);
+	}
+
+	if (batch->running == 0 && batch->next == batch->n_items)
+		batch_complete (batch);
+}
+
+static gboolean
+realm_provider_handle_discover_many (RealmDbusProvider *provider,
+                                     GDBusMethodInvocation *invocation,
+                                     const gchar *const *strings,
+                                     GVariant *options,
+                                     gpointer user_data)
+{
+	RealmProvider *self = REALM_PROVIDER (user_data);
+	BatchClosure *batch;
+	guint i;
+
+	realm_timings_begin (invocation);
+
+	batch = g_new0 (BatchClosure, 1);
+	batch->self = g_object_ref (self);
+	batch->invocation = g_object_ref (invocation);
+	batch->options = g_variant_ref (options);
+	batch->strings = g_strdupv ((gchar **)strings);
+	batch->n_items = g_strv_length (batch->strings);
+	batch->items = g_new0 (BatchItem, batch->n_items);
+	batch->max = MAX (1, (gint)realm_settings_double ("discovery", "batch-max", 8));
+
+	for (i = 0; i < batch->n_items; i++) {
+		batch->items[i].batch = batch;
+		batch->items[i].string = g_strstrip (batch->strings[i]);
+	}
+
+	realm_diagnostics_info (invocation, "Discovering %u domains, %d at a time",
+	                        batch->n_items, batch->max);
+
+	batch_next (batch);
+	return TRUE;
+}
+
 static gboolean
 realm_provider_authorize_method (GDBusObjectSkeleton *skeleton,
                                  GDBusInterfaceSkeleton *iface,
@@ -290,6 +621,10 @@ realm_provider_init (RealmProvider *self)
 	self->pv->provider_iface = realm_dbus_provider_skeleton_new ();
 	g_signal_connect (self->pv->provider_iface, "handle-discover",
 	                  G_CALLBACK (realm_provider_handle_discover), self);
+	g_signal_connect (self->pv->provider_iface, "handle-discover-streaming",
+	                  G_CALLBACK (realm_provider_handle_discover_streaming), self);
+	g_signal_connect (self->pv->provider_iface, "handle-discover-many",
+	                  G_CALLBACK (realm_provider_handle_discover_many), self);
 	g_dbus_object_skeleton_add_interface (G_DBUS_OBJECT_SKELETON (self),
 	                                      G_DBUS_INTERFACE_SKELETON (self->pv->provider_iface));
 }
@@ -347,6 +682,7 @@ realm_provider_class_init (RealmProviderClass *klass)
 	skeleton_class->authorize_method = realm_provider_authorize_method;
 
 	klass->get_realms = realm_provider_real_get_realms;
+	klass->max_relevance = 100;
 
 	g_type_class_add_private (klass, sizeof (RealmProviderPrivate));
 }
@@ -443,6 +779,7 @@ realm_provider_discover (RealmProvider *self,
                          const gchar *string,
                          GVariant *options,
                          GDBusMethodInvocation *invocation,
+                         GCancellable *cancellable,
                          GAsyncReadyCallback callback,
                          gpointer user_data)
 {
@@ -451,7 +788,7 @@ realm_provider_discover (RealmProvider *self,
 	klass = REALM_PROVIDER_GET_CLASS (self);
 	g_return_if_fail (klass->discover_async != NULL);
 
-	(klass->discover_async) (self, string, options, invocation, callback, user_data);
+	(klass->discover_async) (self, string, options, invocation, cancellable, callback, user_data);
 }
 
 GList *
@@ -478,6 +815,51 @@ realm_provider_discover_finish (RealmProvider *self,
 	return realms;
 }
 
+gboolean
+realm_provider_is_streaming (GDBusMethodInvocation *invocation)
+{
+	return invocation != NULL &&
+	       g_strcmp0 (g_dbus_method_invocation_get_method_name (invocation), "DiscoverStreaming") == 0;
+}
+
+void
+realm_provider_stream_realms (GDBusMethodInvocation *invocation,
+                              GList *realms,
+                              gint relevance)
+{
+	GHashTable *streamed;
+	const gchar *path;
+	GList *l;
+
+	if (!realm_provider_is_streaming (invocation) ||
+	    g_object_get_data (G_OBJECT (invocation), "realm-stream-completed"))
+		return;
+
+	streamed = g_object_get_data (G_OBJECT (invocation), "realm-streamed");
+	if (streamed == NULL) {
+		streamed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		g_object_set_data_full (G_OBJECT (invocation), "realm-streamed", streamed,
+		                        (GDestroyNotify)g_hash_table_unref);
+	}
+
+	/* Each realm is only reported once per operation */
+	for (l = realms; l != NULL; l = g_list_next (l)) {
+		path = g_dbus_object_get_object_path (l->data);
+		if (g_hash_table_contains (streamed, path))
+			continue;
+		g_hash_table_add (streamed, g_strdup (path));
+		emit_stream_signal (invocation, REALM_DBUS_REALM_DISCOVERED_SIGNAL,
+		                    g_variant_new ("(soi)", stream_operation (invocation), path, relevance));
+	}
+}
+
+gint
+realm_provider_get_max_relevance (RealmProvider *self)
+{
+	g_return_val_if_fail (REALM_IS_PROVIDER (self), 0);
+	return REALM_PROVIDER_GET_CLASS (self)->max_relevance;
+}
+
 gboolean
 realm_provider_match_software (GVariant *options,
                                const gchar *server_software,
@@ -48,6 +48,7 @@ struct _RealmProviderClass {
 	                                  const gchar *string,
 	                                  GVariant *options,
 	                                  GDBusMethodInvocation *invocation,
+	                                  GCancellable *cancellable,
 	                                  GAsyncReadyCallback callback,
 	                                  gpointer user_data);
 
@@ -57,6 +58,9 @@ struct _RealmProviderClass {
 	                                  GError **error);
 
 	GList *      (* get_realms)      (RealmProvider *provider);
+
+	/* The highest relevance discover_finish() ever returns */
+	gint max_relevance;
 };
 
 GType                    realm_provider_get_type                 (void) G_GNUC_CONST;
@@ -78,6 +82,7 @@ void                     realm_provider_discover                 (RealmProvider
                                                                   const gchar *string,
                                                                   GVariant *options,
                                                                   GDBusMethodInvocation *invocation,
+                                                                  GCancellable *cancellable,
                                                                   GAsyncReadyCallback callback,
                                                                   gpointer user_data);
 
@@ -86,6 +91,14 @@ GList *                  realm_provider_discover_finish          (RealmProvider
                                                                   gint *relevance,
                                                                   GError **error);
 
+gint                     realm_provider_get_max_relevance        (RealmProvider *self);
+
+gboolean                 realm_provider_is_streaming             (GDBusMethodInvocation *invocation);
+
+void                     realm_provider_stream_realms            (GDBusMethodInvocation *invocation,
+                                                                  GList *realms,
+                                                                  gint relevance);
+
 void                     realm_provider_set_name                 (RealmProvider *self,
                                                                   const gchar *value);
 
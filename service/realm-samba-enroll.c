@@ -34,6 +34,9 @@
 #include <fcntl.h>
 #include <string.h>
 
+/* Seconds before giving up on net, unless configured otherwise */
+#define NET_TIMEOUT 300
+
 typedef struct {
 	GDBusMethodInvocation *invocation;
 	gchar *join_args[8];
@@ -43,6 +46,7 @@ typedef struct {
 	RealmIniConfig *config;
 	gchar *custom_smb_conf;
 	gchar *envvar;
+	gchar *server;
 } JoinClosure;
 
 static void
@@ -57,6 +61,7 @@ join_closure_free (gpointer data)
 		g_free (join->join_args[i]);
 	realm_disco_unref (join->disco);
 	g_free (join->envvar);
+	g_free (join->server);
 	g_clear_object (&join->invocation);
 	g_clear_object (&join->config);
 
@@ -93,12 +98,27 @@ join_closure_init (GTask *task,
 	int temp_fd;
 	const gchar *explicit_computer_name = NULL;
 	const gchar *authid = NULL;
+	GInetAddress *address;
 
 	join = g_new0 (JoinClosure, 1);
 	join->disco = realm_disco_ref (disco);
 	join->invocation = invocation ? g_object_ref (invocation) : NULL;
 	g_task_set_task_data (task, join, join_closure_free);
 
+	/*
+	 * Point net at the domain controller that discovery already talked
+	 * to, rather than having it locate one again. The host name is
+	 * better than the address when using kerberos.
+	 */
+	if (disco->explicit_server) {
+		join->server = g_strdup (disco->explicit_server);
+	} else if (disco->domain_controller) {
+		join->server = g_strdup (disco->domain_controller);
+	} else if (G_IS_INET_SOCKET_ADDRESS (disco->server_address)) {
+		address = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (disco->server_address));
+		join->server = g_inet_address_to_string (address);
+	}
+
 	explicit_computer_name = realm_options_computer_name (options, disco->domain_name);
 	/* Set netbios name to explicit or truncated name if available */
 	if (explicit_computer_name != NULL)
@@ -157,6 +177,7 @@ join_closure_init (GTask *task,
 static void
 begin_net_process (JoinClosure *join,
                    GBytes *input,
+                   RealmCommandFlags flags,
                    GAsyncReadyCallback callback,
                    gpointer user_data,
                    ...) G_GNUC_NULL_TERMINATED;
@@ -164,6 +185,7 @@ begin_net_process (JoinClosure *join,
 static void
 begin_net_process (JoinClosure *join,
                    GBytes *input,
+                   RealmCommandFlags flags,
                    GAsyncReadyCallback callback,
                    gpointer user_data,
                    ...)
@@ -198,9 +220,9 @@ begin_net_process (JoinClosure *join,
 		g_ptr_array_add (args, join->custom_smb_conf);
 	}
 
-	if (join->disco->explicit_server) {
+	if (join->server) {
 		g_ptr_array_add (args, "-S");
-		g_ptr_array_add (args, join->disco->explicit_server);
+		g_ptr_array_add (args, join->server);
 	}
 
 	va_start (va, user_data);
@@ -210,8 +232,9 @@ begin_net_process (JoinClosure *join,
 	} while (arg != NULL);
 	va_end (va);
 
-	realm_command_runv_async ((gchar **)args->pdata, env, input,
-	                          join->invocation, callback, user_data);
+	realm_command_runv_full_async ((gchar **)args->pdata, env, input,
+	                               realm_command_get_timeout ("net", NET_TIMEOUT),
+	                               flags, join->invocation, callback, user_data);
 
 	g_free (logenv);
 	g_ptr_array_free (args, TRUE);
@@ -296,13 +319,13 @@ on_join_do_keytab (GObject *source,
 
 	/* Do keytab with a user name */
 	} else if (join->user_name != NULL) {
-		begin_net_process (join, join->password_input,
+		begin_net_process (join, join->password_input, REALM_COMMAND_NONE,
 		                   on_keytab_do_finish, g_object_ref (task),
 		                   "-U", join->user_name, "ads", "keytab", "create", NULL);
 
 	/* Do keytab with a ccache file */
 	} else {
-		begin_net_process (join, NULL,
+		begin_net_process (join, NULL, REALM_COMMAND_NONE,
 		                   on_keytab_do_finish, g_object_ref (task),
 		                   "-k", "ads", "keytab", "create", NULL);
 	}
@@ -359,7 +382,7 @@ begin_join (GTask *task,
 
 	/* Do join with a user name */
 	} else if (join->user_name) {
-		begin_net_process (join, join->password_input,
+		begin_net_process (join, join->password_input, REALM_COMMAND_FULL_OUTPUT,
 		                   on_join_do_keytab, g_object_ref (task),
 		                   "-U", join->user_name, "ads", "join", join->disco->domain_name,
 		                   join->join_args[0], join->join_args[1],
@@ -368,7 +391,7 @@ begin_join (GTask *task,
 
 	/* Do join with a ccache */
 	} else {
-		begin_net_process (join, NULL,
+		begin_net_process (join, NULL, REALM_COMMAND_FULL_OUTPUT,
 		                   on_join_do_keytab, g_object_ref (task),
 		                   "-k", "ads", "join", join->disco->domain_name,
 		                   join->join_args[0], join->join_args[1],
@@ -468,13 +491,13 @@ realm_samba_enroll_leave_async (RealmDisco *disco,
 	case REALM_CREDENTIAL_PASSWORD:
 		join->password_input = realm_command_build_password_line (cred->x.password.value);
 		join->user_name = g_strdup (cred->x.password.name);
-		begin_net_process (join, join->password_input,
+		begin_net_process (join, join->password_input, REALM_COMMAND_NONE,
 		                   on_leave_complete, g_object_ref (task),
 		                   "-U", join->user_name, "ads", "leave", NULL);
 		break;
 	case REALM_CREDENTIAL_CCACHE:
 		join->envvar = g_strdup_printf ("KRB5CCNAME=%s", cred->x.ccache.file);
-		begin_net_process (join, NULL,
+		begin_net_process (join, NULL, REALM_COMMAND_NONE,
 		                   on_leave_complete, g_object_ref (task),
 		                   "-k", "ads", "leave", NULL);
 		break;
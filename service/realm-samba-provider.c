@@ -107,6 +107,7 @@ realm_samba_provider_discover_async (RealmProvider *provider,
                                      const gchar *string,
                                      GVariant *options,
                                      GDBusMethodInvocation *invocation,
+                                     GCancellable *cancellable,
                                      GAsyncReadyCallback callback,
                                      gpointer user_data)
 {
@@ -121,7 +122,7 @@ realm_samba_provider_discover_async (RealmProvider *provider,
 		g_task_return_pointer (task, NULL, NULL);
 
 	} else {
-		realm_disco_domain_async (string, invocation,
+		realm_disco_domain_async (string, options, invocation, cancellable,
 		                          on_ad_discover, g_object_ref (task));
 	}
 
@@ -16,42 +16,498 @@
 
 #include "realm-command.h"
 #include "realm-daemon.h"
+#include "realm-diagnostics.h"
+#include "realm-invocation.h"
 #include "realm-service.h"
 #include "realm-settings.h"
 
 #include <glib/gi18n.h>
 
+#define SYSTEMD_NAME         "org.freedesktop.systemd1"
+#define SYSTEMD_PATH         "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER      "org.freedesktop.systemd1.Manager"
+
+/* Like systemd's own default, unless <command>.timeout says otherwise */
+#define SERVICE_JOB_TIMEOUT  90
+
+typedef enum {
+	SERVICE_ENABLE,
+	SERVICE_DISABLE,
+	SERVICE_RESTART,
+	SERVICE_STOP,
+} ServiceAction;
+
+static const struct {
+	const gchar *command;
+	const gchar *doing;
+	gboolean skip_in_install_mode;
+} service_actions[] = {
+	{ "enable-service", "Enabling", FALSE },
+	{ "disable-service", "Disabling", FALSE },
+	{ "restart-service", "Restarting", TRUE },
+	{ "stop-service", "Stopping", TRUE },
+};
+
+/* Once systemd isn't there, don't keep on asking */
+static gboolean systemd_missing = FALSE;
+static GDBusConnection *systemd_subscribed = NULL;
+
+typedef struct {
+	ServiceAction action;
+	gchar *command;
+	gchar *unit;
+	GDBusMethodInvocation *invocation;
+	GDBusConnection *connection;
+	guint subscription;
+	gchar *job;
+	GHashTable *finished;
+	guint timeout_id;
+	GSource *cancel_source;
+} ServiceClosure;
+
 static void
-begin_service_command (const gchar *command,
-                       gboolean skip_in_install_mode,
-                       GDBusMethodInvocation *invocation,
-                       GAsyncReadyCallback callback,
-                       gpointer user_data)
+service_closure_free (gpointer data)
+{
+	ServiceClosure *clo = data;
+
+	g_assert (clo->subscription == 0);
+	g_assert (clo->timeout_id == 0);
+	g_assert (clo->cancel_source == NULL);
+	g_free (clo->command);
+	g_free (clo->unit);
+	g_free (clo->job);
+	g_clear_object (&clo->invocation);
+	g_clear_object (&clo->connection);
+	if (clo->finished)
+		g_hash_table_destroy (clo->finished);
+	g_free (clo);
+}
+
+static gboolean
+use_systemd (ServiceClosure *clo)
+{
+	const gchar *manager;
+	const gchar *command;
+
+	/* Enabling with the running systemd would change the host, not the install */
+	if (systemd_missing || realm_daemon_is_install_mode ())
+		return FALSE;
+
+	/* Commands configured to be skipped are skipped either way */
+	command = realm_settings_value ("commands", clo->command);
+	if (command != NULL) {
+		while (g_ascii_isspace (*command))
+			command++;
+		if (*command == '\0')
+			return FALSE;
+	}
+
+	manager = realm_settings_value ("service", "service-manager");
+	if (manager == NULL || g_str_equal (manager, "auto"))
+		return g_file_test ("/run/systemd/system", G_FILE_TEST_IS_DIR);
+
+	return g_str_equal (manager, "systemd");
+}
+
+static void
+on_service_command (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GError *error = NULL;
+
+	/* A command that ran but failed has already shown its output */
+	if (realm_command_run_finish (result, NULL, &error) == -1)
+		g_task_return_error (task, error);
+	else
+		g_task_return_boolean (task, TRUE);
+
+	g_object_unref (task);
+}
+
+static void
+run_service_command (GTask *task)
+{
+	ServiceClosure *clo = g_task_get_task_data (task);
+
+	realm_command_run_known_async (clo->command, NULL, clo->invocation,
+	                               on_service_command, g_object_ref (task));
+}
+
+static void
+fall_back_to_command (GTask *task,
+                      GError *error)
+{
+	ServiceClosure *clo = g_task_get_task_data (task);
+
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_task_return_error (task, error);
+		return;
+	}
+
+	/* Other failures, such as an unknown unit, may be particular to this service */
+	if (!g_dbus_error_is_remote_error (error) ||
+	    g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) ||
+	    g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER))
+		systemd_missing = TRUE;
+
+	g_debug ("Couldn't %s %s via systemd, running command instead: %s",
+	         service_actions[clo->action].command, clo->unit, error->message);
+	g_error_free (error);
+
+	run_service_command (task);
+}
+
+static void
+stop_waiting_for_job (ServiceClosure *clo)
+{
+	if (clo->timeout_id)
+		g_source_remove (clo->timeout_id);
+	clo->timeout_id = 0;
+
+	if (clo->cancel_source) {
+		g_source_destroy (clo->cancel_source);
+		g_source_unref (clo->cancel_source);
+		clo->cancel_source = NULL;
+	}
+
+	/* Drops the reference the subscription held, so last */
+	if (clo->subscription)
+		g_dbus_connection_signal_unsubscribe (clo->connection, clo->subscription);
+	clo->subscription = 0;
+}
+
+static void
+service_job_finished (GTask *task,
+                      const gchar *result)
+{
+	ServiceClosure *clo = g_task_get_task_data (task);
+
+	/* Like a failed command, a failed job is shown but not fatal */
+	if (!g_str_equal (result, "done") && !g_str_equal (result, "skipped")) {
+		realm_diagnostics_info (clo->invocation, "%s %s failed: %s",
+		                        service_actions[clo->action].doing, clo->unit, result);
+	}
+
+	g_task_return_boolean (task, TRUE);
+	stop_waiting_for_job (clo);
+}
+
+static gboolean
+on_job_timeout (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ServiceClosure *clo = g_task_get_task_data (task);
+
+	clo->timeout_id = 0;
+
+	/* The job carries on in systemd, but like a failed one isn't fatal */
+	realm_diagnostics_info (clo->invocation, "%s %s is taking too long, not waiting for it",
+	                        service_actions[clo->action].doing, clo->unit);
+
+	g_task_return_boolean (task, TRUE);
+	stop_waiting_for_job (clo);
+	return FALSE;
+}
+
+static gboolean
+on_job_cancelled (GCancellable *cancellable,
+                  gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ServiceClosure *clo = g_task_get_task_data (task);
+
+	g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+	                         _("Operation was cancelled."));
+	stop_waiting_for_job (clo);
+	return FALSE;
+}
+
+static void
+wait_for_job (GTask *task)
+{
+	ServiceClosure *clo = g_task_get_task_data (task);
+	GCancellable *cancellable;
+	guint timeout;
+
+	/* These go away before the subscription, which holds the task */
+	timeout = realm_command_get_timeout (clo->command, SERVICE_JOB_TIMEOUT);
+	if (timeout > 0)
+		clo->timeout_id = g_timeout_add_seconds (timeout, on_job_timeout, task);
+
+	cancellable = g_task_get_cancellable (task);
+	if (cancellable) {
+		clo->cancel_source = g_cancellable_source_new (cancellable);
+		g_source_set_callback (clo->cancel_source, (GSourceFunc)on_job_cancelled, task, NULL);
+		g_source_attach (clo->cancel_source, g_task_get_context (task));
+	}
+}
+
+static void
+on_job_removed (GDBusConnection *connection,
+                const gchar *sender_name,
+                const gchar *object_path,
+                const gchar *interface_name,
+                const gchar *signal_name,
+                GVariant *parameters,
+                gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ServiceClosure *clo = g_task_get_task_data (task);
+	const gchar *result;
+	const gchar *job;
+	guint32 id;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(uoss)")) ||
+	    clo->subscription == 0)
+		return;
+
+	g_variant_get (parameters, "(u&o&s&s)", &id, &job, NULL, &result);
+
+	/* The job can finish before the reply that tells us which one it is */
+	if (clo->job == NULL) {
+		g_hash_table_insert (clo->finished, g_strdup (job), g_strdup (result));
+		return;
+	}
+
+	if (g_str_equal (job, clo->job))
+		service_job_finished (task, result);
+}
+
+static void
+on_unit_job (GObject *source,
+             GAsyncResult *result,
+             gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ServiceClosure *clo = g_task_get_task_data (task);
+	const gchar *finished;
+	GError *error = NULL;
+	GVariant *retval;
+
+	retval = g_dbus_connection_call_finish (clo->connection, result, &error);
+	if (error != NULL) {
+		stop_waiting_for_job (clo);
+		fall_back_to_command (task, error);
+
+	} else {
+		g_variant_get (retval, "(o)", &clo->job);
+		g_variant_unref (retval);
+
+		/* Now wait for the job to complete */
+		finished = g_hash_table_lookup (clo->finished, clo->job);
+		if (finished)
+			service_job_finished (task, finished);
+		else
+			wait_for_job (task);
+	}
+
+	g_object_unref (task);
+}
+
+static void
+on_reloaded (GObject *source,
+             GAsyncResult *result,
+             gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ServiceClosure *clo = g_task_get_task_data (task);
+	GError *error = NULL;
+	GVariant *retval;
+
+	retval = g_dbus_connection_call_finish (clo->connection, result, &error);
+	if (error == NULL) {
+		g_variant_unref (retval);
+		g_task_return_boolean (task, TRUE);
+	} else {
+		g_task_return_error (task, error);
+	}
+
+	g_object_unref (task);
+}
+
+static void
+on_unit_files (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
 {
+	GTask *task = G_TASK (user_data);
+	ServiceClosure *clo = g_task_get_task_data (task);
+	GError *error = NULL;
+	GVariant *retval;
+
+	retval = g_dbus_connection_call_finish (clo->connection, result, &error);
+	if (error != NULL) {
+		fall_back_to_command (task, error);
+
+	/* Like systemctl, have systemd pick up the changed links */
+	} else {
+		g_variant_unref (retval);
+		g_dbus_connection_call (clo->connection, SYSTEMD_NAME, SYSTEMD_PATH,
+		                        SYSTEMD_MANAGER, "Reload", NULL, NULL,
+		                        G_DBUS_CALL_FLAGS_NONE, -1, g_task_get_cancellable (task),
+		                        on_reloaded, g_object_ref (task));
+	}
+
+	g_object_unref (task);
+}
+
+static void
+start_unit_job (GTask *task)
+{
+	ServiceClosure *clo = g_task_get_task_data (task);
+
+	g_dbus_connection_call (clo->connection, SYSTEMD_NAME, SYSTEMD_PATH, SYSTEMD_MANAGER,
+	                        clo->action == SERVICE_RESTART ? "RestartUnit" : "StopUnit",
+	                        g_variant_new ("(ss)", clo->unit, "replace"),
+	                        G_VARIANT_TYPE ("(o)"), G_DBUS_CALL_FLAGS_NONE,
+	                        -1, g_task_get_cancellable (task), on_unit_job, g_object_ref (task));
+}
+
+static void
+on_subscribed (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ServiceClosure *clo = g_task_get_task_data (task);
+	GError *error = NULL;
+	GVariant *retval;
+	gchar *remote;
+
+	retval = g_dbus_connection_call_finish (clo->connection, result, &error);
+
+	/* Another action on this connection may have got in first */
+	if (error != NULL && g_dbus_error_is_remote_error (error)) {
+		remote = g_dbus_error_get_remote_error (error);
+		if (g_str_equal (remote, "org.freedesktop.systemd1.AlreadySubscribed"))
+			g_clear_error (&error);
+		g_free (remote);
+	}
+
+	if (error != NULL) {
+		stop_waiting_for_job (clo);
+		fall_back_to_command (task, error);
+	} else {
+		systemd_subscribed = clo->connection;
+		start_unit_job (task);
+	}
+
+	if (retval)
+		g_variant_unref (retval);
+	g_object_unref (task);
+}
+
+static void
+on_system_bus (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	ServiceClosure *clo = g_task_get_task_data (task);
+	GCancellable *cancellable;
+	const gchar *units[2] = { NULL, NULL };
+	GError *error = NULL;
+
+	clo->connection = g_bus_get_finish (result, &error);
+	if (error != NULL) {
+		fall_back_to_command (task, error);
+		g_object_unref (task);
+		return;
+	}
+
+	cancellable = g_task_get_cancellable (task);
+	realm_diagnostics_info (clo->invocation, "%s %s", service_actions[clo->action].doing, clo->unit);
+
+	units[0] = clo->unit;
+	switch (clo->action) {
+	case SERVICE_ENABLE:
+		g_dbus_connection_call (clo->connection, SYSTEMD_NAME, SYSTEMD_PATH,
+		                        SYSTEMD_MANAGER, "EnableUnitFiles",
+		                        g_variant_new ("(^asbb)", units, FALSE, TRUE),
+		                        G_VARIANT_TYPE ("(ba(sss))"), G_DBUS_CALL_FLAGS_NONE,
+		                        -1, cancellable, on_unit_files, g_object_ref (task));
+		break;
+
+	case SERVICE_DISABLE:
+		g_dbus_connection_call (clo->connection, SYSTEMD_NAME, SYSTEMD_PATH,
+		                        SYSTEMD_MANAGER, "DisableUnitFiles",
+		                        g_variant_new ("(^asb)", units, FALSE),
+		                        G_VARIANT_TYPE ("(a(sss))"), G_DBUS_CALL_FLAGS_NONE,
+		                        -1, cancellable, on_unit_files, g_object_ref (task));
+		break;
+
+	case SERVICE_RESTART:
+	case SERVICE_STOP:
+		/* Listen before starting the job, so its end isn't missed */
+		clo->finished = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+		clo->subscription = g_dbus_connection_signal_subscribe (clo->connection, SYSTEMD_NAME,
+		                                                        SYSTEMD_MANAGER, "JobRemoved",
+		                                                        SYSTEMD_PATH, NULL,
+		                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+		                                                        on_job_removed, g_object_ref (task),
+		                                                        g_object_unref);
+
+		/* systemd only sends job signals once someone has subscribed */
+		if (systemd_subscribed != clo->connection) {
+			g_dbus_connection_call (clo->connection, SYSTEMD_NAME, SYSTEMD_PATH,
+			                        SYSTEMD_MANAGER, "Subscribe", NULL, NULL,
+			                        G_DBUS_CALL_FLAGS_NONE, -1, cancellable,
+			                        on_subscribed, g_object_ref (task));
+		} else {
+			start_unit_job (task);
+		}
+		break;
+	}
+
+	g_object_unref (task);
+}
+
+static void
+begin_service_action (const gchar *service_name,
+                      ServiceAction action,
+                      GDBusMethodInvocation *invocation,
+                      GAsyncReadyCallback callback,
+                      gpointer user_data)
+{
+	ServiceClosure *clo;
 	GTask *task;
 
+	task = g_task_new (NULL, invocation ? realm_invocation_get_cancellable (invocation) : NULL,
+	                   callback, user_data);
+	g_task_set_source_tag (task, begin_service_action);
+	clo = g_new0 (ServiceClosure, 1);
+	clo->action = action;
+	clo->command = g_strdup_printf ("%s-%s", service_name, service_actions[action].command);
+	clo->unit = g_strdup_printf ("%s.service", service_name);
+	clo->invocation = invocation ? g_object_ref (invocation) : NULL;
+	g_task_set_task_data (task, clo, service_closure_free);
+
 	/* If install mode, don't do certain service stuff */
-	if (skip_in_install_mode && realm_daemon_is_install_mode ()) {
-		g_debug ("skipping %s command in install mode", command);
-		task = g_task_new (NULL, NULL, callback, user_data);
-		g_task_set_source_tag (task, begin_service_command);
+	if (service_actions[action].skip_in_install_mode && realm_daemon_is_install_mode ()) {
+		g_debug ("skipping %s command in install mode", clo->command);
 		g_task_return_boolean (task, TRUE);
-		g_object_unref (task);
+
+	} else if (use_systemd (clo)) {
+		g_bus_get (G_BUS_TYPE_SYSTEM, g_task_get_cancellable (task),
+		           on_system_bus, g_object_ref (task));
+
 	} else {
-		realm_command_run_known_async (command, NULL, invocation, callback, user_data);
+		run_service_command (task);
 	}
+
+	g_object_unref (task);
 }
 
 static gboolean
-finish_service_command (GAsyncResult *result,
-                        GError **error)
+finish_service_action (GAsyncResult *result,
+                       GError **error)
 {
-	if (g_task_is_valid (result, NULL) &&
-	    g_task_get_source_tag (G_TASK (result)) == begin_service_command) {
-		return g_task_propagate_boolean (G_TASK (result), error);
-	}
-
-	return realm_command_run_finish (result, NULL, error) != -1;
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+	g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == begin_service_action, FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+	return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 void
@@ -60,18 +516,14 @@ realm_service_enable (const gchar *service_name,
                       GAsyncReadyCallback callback,
                       gpointer user_data)
 {
-	gchar *command;
-
-	command = g_strdup_printf ("%s-enable-service", service_name);
-	begin_service_command (command, FALSE, invocation, callback, user_data);
-	g_free (command);
+	begin_service_action (service_name, SERVICE_ENABLE, invocation, callback, user_data);
 }
 
 gboolean
 realm_service_enable_finish (GAsyncResult *result,
                              GError **error)
 {
-	return finish_service_command (result, error);
+	return finish_service_action (result, error);
 }
 
 void
@@ -80,18 +532,14 @@ realm_service_disable (const gchar *service_name,
                        GAsyncReadyCallback callback,
                        gpointer user_data)
 {
-	gchar *command;
-
-	command = g_strdup_printf ("%s-disable-service", service_name);
-	begin_service_command (command, FALSE, invocation, callback, user_data);
-	g_free (command);
+	begin_service_action (service_name, SERVICE_DISABLE, invocation, callback, user_data);
 }
 
 gboolean
 realm_service_disable_finish (GAsyncResult *result,
                               GError **error)
 {
-	return finish_service_command (result, error);
+	return finish_service_action (result, error);
 }
 
 void
@@ -100,18 +548,14 @@ realm_service_restart (const gchar *service_name,
                        GAsyncReadyCallback callback,
                        gpointer user_data)
 {
-	gchar *command;
-
-	command = g_strdup_printf ("%s-restart-service", service_name);
-	begin_service_command (command, TRUE, invocation, callback, user_data);
-	g_free (command);
+	begin_service_action (service_name, SERVICE_RESTART, invocation, callback, user_data);
 }
 
 gboolean
 realm_service_restart_finish (GAsyncResult *result,
                               GError **error)
 {
-	return finish_service_command (result, error);
+	return finish_service_action (result, error);
 }
 
 void
@@ -120,18 +564,14 @@ realm_service_stop (const gchar *service_name,
                     GAsyncReadyCallback callback,
                     gpointer user_data)
 {
-	gchar *command;
-
-	command = g_strdup_printf ("%s-stop-service", service_name);
-	begin_service_command (command, TRUE, invocation, callback, user_data);
-	g_free (command);
+	begin_service_action (service_name, SERVICE_STOP, invocation, callback, user_data);
 }
 
 gboolean
 realm_service_stop_finish (GAsyncResult *result,
                            GError **error)
 {
-	return finish_service_command (result, error);
+	return finish_service_action (result, error);
 }
 
 typedef struct {
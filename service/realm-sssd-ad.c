@@ -166,6 +166,7 @@ configure_sssd_for_domain (RealmIniConfig *config,
 	const gchar *shell;
     const gchar *explicit_computer_name;
 	gchar *authid = NULL;
+	gchar *server = NULL;
 	gboolean qualify;
 	gboolean ret;
 	gchar *section;
@@ -189,6 +190,15 @@ configure_sssd_for_domain (RealmIniConfig *config,
 	else if (disco->explicit_netbios)
 		authid = g_strdup_printf ("%s$", disco->explicit_netbios);
 
+	/*
+	 * Optionally have sssd start with the domain controller we joined
+	 * through, and fall back to looking them up in DNS.
+	 */
+	if (disco->explicit_server)
+		server = g_strdup (disco->explicit_server);
+	else if (disco->domain_controller && realm_options_prefer_discovered_server (disco->domain_name))
+		server = g_strdup_printf ("%s, _srv_", disco->domain_controller);
+
 	ret = realm_sssd_config_add_domain (config, disco->domain_name, error,
 	                                    "cache_credentials", "True",
 		                            "use_fully_qualified_names", qualify ? "True" : "False",
@@ -203,7 +213,7 @@ configure_sssd_for_domain (RealmIniConfig *config,
 
 	                                    "fallback_homedir", home,
 	                                    "default_shell", shell,
-	                                    "ad_server", disco->explicit_server,
+	                                    "ad_server", server,
 	                                    "ldap_sasl_authid", authid,
 	                                    NULL);
 
@@ -211,6 +221,7 @@ configure_sssd_for_domain (RealmIniConfig *config,
 		ret = realm_ini_config_change_list (config, "sssd", "services", ", ", services, NULL, error);
 
 	g_free (authid);
+	g_free (server);
 	g_string_free (realmd_tags, TRUE);
 
 	if (ret) {
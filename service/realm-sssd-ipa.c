@@ -36,6 +36,9 @@
 #include <errno.h>
 #include <string.h>
 
+/* ipa-client-install does a lot, give it a while */
+#define IPA_CLIENT_TIMEOUT 900
+
 struct _RealmSssdIpa {
 	RealmSssd parent;
 };
@@ -251,9 +254,12 @@ on_install_do_join (GObject *source,
 
 	realm_packages_install_finish (result, &error);
 	if (error == NULL) {
-		realm_command_runv_async ((gchar **)enroll->argv->pdata, (gchar **)env,
-		                          enroll->input, enroll->invocation,
-		                          on_ipa_client_do_restart, g_object_ref (task));
+		/* The kinit failure is searched for in all of the output, see above */
+		realm_command_runv_full_async ((gchar **)enroll->argv->pdata, (gchar **)env,
+		                               enroll->input,
+		                               realm_command_get_timeout ("ipa-client-install", IPA_CLIENT_TIMEOUT),
+		                               REALM_COMMAND_FULL_OUTPUT, enroll->invocation,
+		                               on_ipa_client_do_restart, g_object_ref (task));
 	} else {
 		g_task_return_error (task, error);
 	}
@@ -500,8 +506,9 @@ realm_sssd_ipa_leave_async (RealmKerberosMembership *membership,
 			g_return_if_reached ();
 		}
 
-		realm_command_runv_async ((gchar **)argv, (gchar **)env, input, invocation,
-		                          on_ipa_client_do_disable, g_object_ref (task));
+		realm_command_runv_full_async ((gchar **)argv, (gchar **)env, input,
+		                               realm_command_get_timeout ("ipa-client-install", IPA_CLIENT_TIMEOUT),
+		                               REALM_COMMAND_NONE, invocation, on_ipa_client_do_disable, g_object_ref (task));
 
 		if (input)
 			g_bytes_unref (input);
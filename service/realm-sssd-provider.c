@@ -113,6 +113,7 @@ realm_sssd_provider_discover_async (RealmProvider *provider,
                                     const gchar *string,
                                     GVariant *options,
                                     GDBusMethodInvocation *invocation,
+                                    GCancellable *cancellable,
                                     GAsyncReadyCallback callback,
                                     gpointer user_data)
 {
@@ -140,8 +141,8 @@ realm_sssd_provider_discover_async (RealmProvider *provider,
 		g_task_return_pointer (task, NULL, NULL);
 
 	} else {
-		realm_disco_domain_async (string, invocation, on_kerberos_discover,
-		                          g_object_ref (task));
+		realm_disco_domain_async (string, options, invocation, cancellable,
+		                          on_kerberos_discover, g_object_ref (task));
 	}
 
 	g_object_unref (task);
@@ -0,0 +1,241 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#include "realm-dbus-constants.h"
+#include "realm-invocation.h"
+#include "realm-timings.h"
+
+/* Only the last few operations are kept around */
+#define MAX_OPERATIONS  16
+#define MAX_SPANS       256
+
+typedef struct {
+	gchar *phase;
+	gchar *server;
+	gint64 started;
+	gint64 finished;
+	gchar *failure;
+	RealmTimingsUsage *usage;
+} Span;
+
+typedef struct {
+	gchar *key;
+	gint64 begun;
+	GPtrArray *spans;
+} Operation;
+
+static GHashTable *operations = NULL;
+static GQueue operation_order = G_QUEUE_INIT;
+
+static void
+span_free (gpointer data)
+{
+	Span *span = data;
+	g_free (span->phase);
+	g_free (span->server);
+	g_free (span->failure);
+	g_free (span->usage);
+	g_free (span);
+}
+
+static void
+operation_free (gpointer data)
+{
+	Operation *op = data;
+	g_ptr_array_free (op->spans, TRUE);
+	g_free (op->key);
+	g_free (op);
+}
+
+static Operation *
+lookup_operation (GDBusMethodInvocation *invocation,
+                  gboolean reset)
+{
+	Operation *op;
+	const gchar *key;
+
+	/* Background work isn't on behalf of anyone */
+	if (invocation == NULL)
+		return NULL;
+
+	key = realm_invocation_get_key (invocation);
+	if (key == NULL)
+		return NULL;
+
+	if (!operations)
+		operations = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, operation_free);
+
+	op = g_hash_table_lookup (operations, key);
+	if (op && reset) {
+		g_queue_remove (&operation_order, op);
+		g_hash_table_remove (operations, key);
+		op = NULL;
+	}
+
+	if (op == NULL) {
+		op = g_new0 (Operation, 1);
+		op->key = g_strdup (key);
+		op->begun = g_get_monotonic_time ();
+		op->spans = g_ptr_array_new_with_free_func (span_free);
+		g_hash_table_insert (operations, op->key, op);
+		g_queue_push_tail (&operation_order, op);
+
+		while (operation_order.length > MAX_OPERATIONS) {
+			op = g_queue_pop_head (&operation_order);
+			g_hash_table_remove (operations, op->key);
+		}
+
+		op = g_queue_peek_tail (&operation_order);
+	}
+
+	return op;
+}
+
+void
+realm_timings_begin (GDBusMethodInvocation *invocation)
+{
+	lookup_operation (invocation, TRUE);
+}
+
+void
+realm_timings_record (GDBusMethodInvocation *invocation,
+                      const gchar *phase,
+                      const gchar *server,
+                      gint64 started,
+                      const gchar *failure)
+{
+	realm_timings_record_usage (invocation, phase, server, started, failure, NULL);
+}
+
+void
+realm_timings_record_usage (GDBusMethodInvocation *invocation,
+                            const gchar *phase,
+                            const gchar *server,
+                            gint64 started,
+                            const gchar *failure,
+                            const RealmTimingsUsage *usage)
+{
+	Operation *op;
+	Span *span;
+
+	g_return_if_fail (phase != NULL);
+
+	op = lookup_operation (invocation, FALSE);
+	if (op == NULL || op->spans->len >= MAX_SPANS)
+		return;
+
+	span = g_new0 (Span, 1);
+	span->phase = g_strdup (phase);
+	span->server = g_strdup (server);
+	span->started = started;
+	span->finished = g_get_monotonic_time ();
+	span->failure = g_strdup (failure);
+	if (usage) {
+		span->usage = g_new (RealmTimingsUsage, 1);
+		*(span->usage) = *usage;
+	}
+	g_ptr_array_add (op->spans, span);
+
+	if (started < op->begun)
+		op->begun = started;
+
+	g_debug ("%s%s%s took %" G_GINT64_FORMAT " ms", phase,
+	         server ? " on " : "", server ? server : "",
+	         (span->finished - started) / 1000);
+}
+
+gchar *
+realm_timings_address_to_string (GSocketAddress *address)
+{
+	GInetSocketAddress *inet;
+
+	if (!G_IS_INET_SOCKET_ADDRESS (address))
+		return NULL;
+
+	inet = G_INET_SOCKET_ADDRESS (address);
+	return g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+}
+
+static void
+add_usage (GVariantBuilder *entry,
+           const RealmTimingsUsage *usage)
+{
+	if (usage->user_time >= 0)
+		g_variant_builder_add (entry, "{sv}", REALM_DBUS_TIMING_USER_TIME,
+		                       g_variant_new_int64 (usage->user_time));
+	if (usage->system_time >= 0)
+		g_variant_builder_add (entry, "{sv}", REALM_DBUS_TIMING_SYSTEM_TIME,
+		                       g_variant_new_int64 (usage->system_time));
+	if (usage->max_rss >= 0)
+		g_variant_builder_add (entry, "{sv}", REALM_DBUS_TIMING_MAX_RSS,
+		                       g_variant_new_int64 (usage->max_rss));
+	g_variant_builder_add (entry, "{sv}", REALM_DBUS_TIMING_OUTPUT_BYTES,
+	                       g_variant_new_uint64 (usage->output_bytes));
+	g_variant_builder_add (entry, "{sv}", REALM_DBUS_TIMING_ERROR_BYTES,
+	                       g_variant_new_uint64 (usage->error_bytes));
+}
+
+GVariant *
+realm_timings_build (const gchar *key)
+{
+	GVariantBuilder builder;
+	GVariantBuilder phases;
+	GVariantBuilder entry;
+	Operation *op = NULL;
+	gint64 finished;
+	Span *span;
+	guint i;
+
+	g_return_val_if_fail (key != NULL, NULL);
+
+	if (operations)
+		op = g_hash_table_lookup (operations, key);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+	if (op != NULL) {
+		g_variant_builder_init (&phases, G_VARIANT_TYPE ("aa{sv}"));
+		finished = op->begun;
+
+		for (i = 0; i < op->spans->len; i++) {
+			span = op->spans->pdata[i];
+			g_variant_builder_init (&entry, G_VARIANT_TYPE ("a{sv}"));
+			g_variant_builder_add (&entry, "{sv}", REALM_DBUS_TIMING_PHASE,
+			                       g_variant_new_string (span->phase));
+			if (span->server)
+				g_variant_builder_add (&entry, "{sv}", REALM_DBUS_TIMING_SERVER,
+				                       g_variant_new_string (span->server));
+			g_variant_builder_add (&entry, "{sv}", REALM_DBUS_TIMING_OFFSET,
+			                       g_variant_new_int64 (span->started - op->begun));
+			g_variant_builder_add (&entry, "{sv}", REALM_DBUS_TIMING_DURATION,
+			                       g_variant_new_int64 (span->finished - span->started));
+			if (span->failure)
+				g_variant_builder_add (&entry, "{sv}", REALM_DBUS_TIMING_ERROR,
+				                       g_variant_new_string (span->failure));
+			if (span->usage)
+				add_usage (&entry, span->usage);
+			g_variant_builder_add (&phases, "a{sv}", &entry);
+			finished = MAX (finished, span->finished);
+		}
+
+		g_variant_builder_add (&builder, "{sv}", REALM_DBUS_TIMING_DURATION,
+		                       g_variant_new_int64 (finished - op->begun));
+		g_variant_builder_add (&builder, "{sv}", REALM_DBUS_TIMING_PHASES,
+		                       g_variant_builder_end (&phases));
+	}
+
+	return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,53 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#ifndef __REALM_TIMINGS_H__
+#define __REALM_TIMINGS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	gint64 user_time;       /* microseconds, or -1 if not known */
+	gint64 system_time;     /* microseconds, or -1 if not known */
+	gint64 max_rss;         /* kilobytes, or -1 if not known */
+	guint64 output_bytes;
+	guint64 error_bytes;
+} RealmTimingsUsage;
+
+void          realm_timings_begin                     (GDBusMethodInvocation *invocation);
+
+void          realm_timings_record                    (GDBusMethodInvocation *invocation,
+                                                       const gchar *phase,
+                                                       const gchar *server,
+                                                       gint64 started,
+                                                       const gchar *failure);
+
+void          realm_timings_record_usage              (GDBusMethodInvocation *invocation,
+                                                       const gchar *phase,
+                                                       const gchar *server,
+                                                       gint64 started,
+                                                       const gchar *failure,
+                                                       const RealmTimingsUsage *usage);
+
+gchar *       realm_timings_address_to_string         (GSocketAddress *address);
+
+GVariant *    realm_timings_build                     (const gchar *key);
+
+G_END_DECLS
+
+#endif /* __REALM_TIMINGS_H__ */
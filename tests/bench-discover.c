@@ -0,0 +1,466 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+/*
+ * Runs discovery of a domain over and over and reports how long it took.
+ * Normally pointed at tests/fake-realm-server.py like this:
+ *
+ *   $ python tests/fake-realm-server.py --dns=127.0.0.1:5353 &
+ *   $ ./bench-discover --nameserver=127.0.0.1:5353 example.test
+ */
+
+#include "config.h"
+
+#include "service/realm-diagnostics.h"
+#include "service/realm-disco.h"
+#include "service/realm-disco-domain.h"
+#include "service/realm-disco-rootdse.h"
+#include "service/realm-invocation.h"
+#include "service/realm-settings.h"
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <netinet/in.h>
+#include <resolv.h>
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static GMainLoop *loop;
+static gboolean verbose = FALSE;
+
+/*
+ * Discovery asks the system's name servers. To send its queries to the
+ * fake server instead, res_ninit() is wrapped here so the SRV lookups go
+ * there, and a GResolver does the same for host lookups.
+ */
+static struct sockaddr_in nameserver_address;
+static gboolean use_nameserver = FALSE;
+
+int
+res_ninit (res_state state)
+{
+	static int (* real_res_ninit) (res_state) = NULL;
+	int ret;
+
+	/* Whichever name resolv.h gives the real function */
+	if (real_res_ninit == NULL)
+		real_res_ninit = dlsym (RTLD_NEXT, G_STRINGIFY (res_ninit));
+	g_return_val_if_fail (real_res_ninit != NULL, -1);
+
+	ret = (real_res_ninit) (state);
+	if (ret == 0 && use_nameserver) {
+		state->nsaddr_list[0] = nameserver_address;
+		state->nscount = 1;
+	}
+
+	return ret;
+}
+
+static gboolean
+parse_nameserver (const gchar *nameserver)
+{
+	guint64 port = NS_DEFAULTPORT;
+	gchar *colon;
+	gchar *host;
+	gboolean valid;
+
+	/* In the form address[:port] */
+	host = g_strdup (nameserver);
+	colon = strrchr (host, ':');
+	if (colon) {
+		*colon = '\0';
+		port = g_ascii_strtoull (colon + 1, NULL, 10);
+	}
+
+	memset (&nameserver_address, 0, sizeof (nameserver_address));
+	nameserver_address.sin_family = AF_INET;
+	nameserver_address.sin_port = htons (port);
+	valid = port > 0 && port <= G_MAXUINT16 &&
+	        inet_pton (AF_INET, host, &nameserver_address.sin_addr) == 1;
+	g_free (host);
+
+	use_nameserver = valid;
+	return valid;
+}
+
+typedef struct {
+	GResolver parent;
+} BenchResolver;
+
+typedef struct {
+	GResolverClass parent_class;
+} BenchResolverClass;
+
+static GType bench_resolver_get_type (void) G_GNUC_CONST;
+
+G_DEFINE_TYPE (BenchResolver, bench_resolver, G_TYPE_RESOLVER);
+
+static void
+bench_resolver_init (BenchResolver *self)
+{
+
+}
+
+static void
+query_addresses (res_state state,
+                 const gchar *hostname,
+                 int type,
+                 GList **addrs)
+{
+	GSocketFamily family;
+	guchar *answer;
+	gsize length;
+	ns_msg msg;
+	ns_rr rr;
+	gint count;
+	gint len;
+	gint i;
+
+	if (type == ns_t_aaaa) {
+		family = G_SOCKET_FAMILY_IPV6;
+		length = 16;
+	} else {
+		family = G_SOCKET_FAMILY_IPV4;
+		length = 4;
+	}
+
+	answer = g_malloc (NS_MAXMSG);
+	len = res_nquery (state, hostname, ns_c_in, type, answer, NS_MAXMSG);
+
+	if (len >= 0 && ns_initparse (answer, len, &msg) >= 0) {
+		count = ns_msg_count (msg, ns_s_an);
+		for (i = 0; i < count; i++) {
+			if (ns_parserr (&msg, ns_s_an, i, &rr) < 0)
+				continue;
+			if (ns_rr_type (rr) != type || ns_rr_rdlen (rr) != length)
+				continue;
+			*addrs = g_list_append (*addrs, g_inet_address_new_from_bytes (ns_rr_rdata (rr), family));
+		}
+	}
+
+	g_free (answer);
+}
+
+static GList *
+bench_resolver_lookup_by_name (GResolver *resolver,
+                               const gchar *hostname,
+                               GCancellable *cancellable,
+                               GError **error)
+{
+	struct __res_state state;
+	GList *addrs = NULL;
+
+	memset (&state, 0, sizeof (state));
+	if (res_ninit (&state) < 0) {
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_INTERNAL,
+		             "Couldn't initialize the DNS resolver");
+		return NULL;
+	}
+
+	query_addresses (&state, hostname, ns_t_aaaa, &addrs);
+	query_addresses (&state, hostname, ns_t_a, &addrs);
+	res_nclose (&state);
+
+	if (addrs == NULL) {
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+		             "No addresses for %s", hostname);
+	}
+
+	return addrs;
+}
+
+static void
+lookup_by_name_thread (GTask *task,
+                       gpointer source_object,
+                       gpointer task_data,
+                       GCancellable *cancellable)
+{
+	GError *error = NULL;
+	GList *addrs;
+
+	addrs = bench_resolver_lookup_by_name (source_object, task_data, cancellable, &error);
+	if (error)
+		g_task_return_error (task, error);
+	else
+		g_task_return_pointer (task, addrs, (GDestroyNotify)g_resolver_free_addresses);
+}
+
+static void
+bench_resolver_lookup_by_name_async (GResolver *resolver,
+                                     const gchar *hostname,
+                                     GCancellable *cancellable,
+                                     GAsyncReadyCallback callback,
+                                     gpointer user_data)
+{
+	GTask *task;
+
+	task = g_task_new (resolver, cancellable, callback, user_data);
+	g_task_set_task_data (task, g_strdup (hostname), g_free);
+	g_task_set_return_on_cancel (task, TRUE);
+	g_task_run_in_thread (task, lookup_by_name_thread);
+	g_object_unref (task);
+}
+
+static GList *
+bench_resolver_lookup_by_name_finish (GResolver *resolver,
+                                      GAsyncResult *result,
+                                      GError **error)
+{
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+bench_resolver_class_init (BenchResolverClass *klass)
+{
+	GResolverClass *resolver_class = G_RESOLVER_CLASS (klass);
+
+	resolver_class->lookup_by_name = bench_resolver_lookup_by_name;
+	resolver_class->lookup_by_name_async = bench_resolver_lookup_by_name_async;
+	resolver_class->lookup_by_name_finish = bench_resolver_lookup_by_name_finish;
+}
+
+static void
+on_ready_get_result (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	GAsyncResult **place = (GAsyncResult **)user_data;
+	*place = g_object_ref (result);
+	g_main_loop_quit (loop);
+}
+
+static gint64
+discover_once (const gchar *domain,
+               gboolean *found)
+{
+	GAsyncResult *result = NULL;
+	RealmDisco *disco;
+	gint64 started;
+	gint64 elapsed;
+
+	started = g_get_monotonic_time ();
+	realm_disco_domain_async (domain, NULL, NULL, NULL, on_ready_get_result, &result);
+	g_main_loop_run (loop);
+	elapsed = g_get_monotonic_time () - started;
+
+	disco = realm_disco_domain_finish (result, NULL);
+	g_object_unref (result);
+
+	*found = (disco != NULL);
+	if (verbose && disco) {
+		g_printerr ("discovered %s via %s in %.1f ms\n", disco->domain_name,
+		            disco->domain_controller ? disco->domain_controller : "unknown",
+		            elapsed / 1000.0);
+	}
+
+	realm_disco_unref (disco);
+	return elapsed;
+}
+
+static int
+compare_int64 (gconstpointer a,
+               gconstpointer b)
+{
+	gint64 va = *(const gint64 *)a;
+	gint64 vb = *(const gint64 *)b;
+	return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+static gdouble
+percentile (GArray *samples,
+            gdouble fraction)
+{
+	guint rank;
+
+	/* Nearest rank, samples are sorted */
+	rank = (guint)(fraction * samples->len + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > samples->len)
+		rank = samples->len;
+	return g_array_index (samples, gint64, rank - 1) / 1000.0;
+}
+
+static gboolean
+apply_setting (const gchar *setting)
+{
+	gchar **parts;
+	gchar *dot;
+	gboolean ret = FALSE;
+
+	/* In the form section.key=value */
+	parts = g_strsplit (setting, "=", 2);
+	if (parts[0] && parts[1]) {
+		dot = strchr (parts[0], '.');
+		if (dot) {
+			*dot = '\0';
+			realm_settings_add (parts[0], dot + 1, parts[1]);
+			ret = TRUE;
+		}
+	}
+
+	g_strfreev (parts);
+	return ret;
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+	GOptionContext *context;
+	GResolver *resolver;
+	gchar *nameserver = NULL;
+	gchar **settings = NULL;
+	gint iterations = 100;
+	GError *error = NULL;
+	GArray *samples;
+	gint failures = 0;
+	gboolean found;
+	gint64 elapsed;
+	gint i;
+
+	GOptionEntry entries[] = {
+		{ "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Number of discoveries to run", "N" },
+		{ "nameserver", 0, 0, G_OPTION_ARG_STRING, &nameserver, "DNS server to use", "ADDRESS:PORT" },
+		{ "set", 's', 0, G_OPTION_ARG_STRING_ARRAY, &settings, "Override a realmd.conf setting", "SECTION.KEY=VALUE" },
+		{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Show discovery diagnostics", NULL },
+		{ NULL }
+	};
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	context = g_option_context_new ("DOMAIN");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("bench-discover: %s\n", error->message);
+		g_error_free (error);
+		return 2;
+	}
+
+	g_option_context_free (context);
+
+	if (argc != 2 || iterations < 1) {
+		g_printerr ("usage: bench-discover [--iterations=N] [--nameserver=ADDRESS:PORT] DOMAIN\n");
+		return 2;
+	}
+
+	realm_settings_init ();
+
+	/* Each discovery should do the full work */
+	realm_settings_add ("discovery", "cache-max-age", "0");
+	realm_settings_add ("discovery", "negative-cache-ttl", "0");
+	if (nameserver) {
+		if (!parse_nameserver (nameserver)) {
+			g_printerr ("bench-discover: invalid nameserver: %s\n", nameserver);
+			return 2;
+		}
+		resolver = g_object_new (bench_resolver_get_type (), NULL);
+		g_resolver_set_default (resolver);
+		g_object_unref (resolver);
+	}
+
+	for (i = 0; settings && settings[i]; i++) {
+		if (!apply_setting (settings[i])) {
+			g_printerr ("bench-discover: invalid setting: %s\n", settings[i]);
+			return 2;
+		}
+	}
+
+	loop = g_main_loop_new (NULL, FALSE);
+	samples = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+	for (i = 0; i < iterations; i++) {
+		elapsed = discover_once (argv[1], &found);
+		if (!found)
+			failures++;
+		g_array_append_val (samples, elapsed);
+	}
+
+	g_array_sort (samples, compare_int64);
+
+	printf ("discoveries: %d  failures: %d  hedges: %u\n", iterations, failures,
+	        realm_disco_rootdse_get_hedge_count ());
+	printf ("min: %.1f ms  p50: %.1f ms  p95: %.1f ms  p99: %.1f ms  max: %.1f ms\n",
+	        g_array_index (samples, gint64, 0) / 1000.0,
+	        percentile (samples, 0.50), percentile (samples, 0.95),
+	        percentile (samples, 0.99),
+	        g_array_index (samples, gint64, samples->len - 1) / 1000.0);
+
+	g_array_free (samples, TRUE);
+	g_main_loop_unref (loop);
+	g_strfreev (settings);
+	g_free (nameserver);
+	realm_settings_uninit ();
+
+	return failures == iterations ? 1 : 0;
+}
+
+/* Dummy functions */
+
+GCancellable *
+realm_invocation_get_cancellable (GDBusMethodInvocation *invocation)
+{
+	return NULL;
+}
+
+const gchar *
+realm_invocation_get_key (GDBusMethodInvocation *invocation)
+{
+	return NULL;
+}
+
+void
+realm_diagnostics_info (GDBusMethodInvocation *invocation,
+                        const gchar *format,
+                        ...)
+{
+	va_list va;
+
+	if (!verbose)
+		return;
+
+	va_start (va, format);
+	vfprintf (stderr, format, va);
+	fputc ('\n', stderr);
+	va_end (va);
+}
+
+void
+realm_diagnostics_error (GDBusMethodInvocation *invocation,
+                         GError *error,
+                         const gchar *format,
+                         ...)
+{
+	va_list va;
+
+	if (!verbose)
+		return;
+
+	if (format) {
+		va_start (va, format);
+		vfprintf (stderr, format, va);
+		va_end (va);
+		if (error)
+			fputs (": ", stderr);
+	}
+
+	if (error)
+		fputs (error->message, stderr);
+	fputc ('\n', stderr);
+}
@@ -0,0 +1,586 @@
+#!/usr/bin/python
+
+#
+# A fake domain for exercising discovery without a real network: an
+# authoritative DNS server for SRV and A records, and an LDAP (TCP) and
+# MS-CLDAP (UDP) responder for each domain controller. Each server can be
+# given latency, packet loss or be turned into a blackhole.
+#
+# Point tests/bench-discover at it with --nameserver=127.0.0.1:5353, and
+# it sends its DNS queries there instead of to the system's name servers.
+# The servers listen on 127.0.0.2, 127.0.0.3 ... which Linux routes over
+# loopback already.
+#
+# A configuration file may describe the domain in JSON:
+#
+#   {
+#     "domain": "example.test", "type": "ad", "site": "Office",
+#     "servers": [
+#       { "name": "dc1.example.test", "address": "127.0.0.2", "latency": 20 },
+#       { "name": "dc2.example.test", "address": "127.0.0.3", "loss": 0.1 },
+#       { "name": "dc3.example.test", "address": "127.0.0.4", "blackhole": true }
+#     ]
+#   }
+#
+# Latencies are in milliseconds, loss is the fraction of replies dropped.
+# Over TCP a lost reply arrives a second late, like a retransmission would.
+#
+
+import getopt
+import heapq
+import json
+import random
+import select
+import socket
+import struct
+import sys
+import time
+
+TYPE_A = 1
+TYPE_AAAA = 28
+TYPE_SRV = 33
+
+LDAP_SEQUENCE = 0x30
+LDAP_SET = 0x31
+LDAP_BIND_REQUEST = 0x60
+LDAP_BIND_RESPONSE = 0x61
+LDAP_UNBIND_REQUEST = 0x42
+LDAP_SEARCH_REQUEST = 0x63
+LDAP_SEARCH_ENTRY = 0x64
+LDAP_SEARCH_DONE = 0x65
+LDAP_ABANDON_REQUEST = 0x50
+
+DS_LDAP_FLAG = 0x00000008
+DS_DS_FLAG = 0x00000010
+DS_KDC_FLAG = 0x00000020
+DS_CLOSEST_FLAG = 0x00000080
+DS_WRITABLE_FLAG = 0x00000100
+
+AD_CAPABILITY = b"1.2.840.113556.1.4.800"
+AD_2003_CAPABILITY = b"1.2.840.113556.1.4.1670"
+
+verbose = False
+
+def log(message):
+	if verbose:
+		sys.stderr.write("fake-realm-server: %s\n" % message)
+
+def to_bytes(string):
+	if isinstance(string, (bytes, bytearray)):
+		return bytes(string)
+	return string.encode("utf-8")
+
+
+class Timers:
+	def __init__(self):
+		self.heap = []
+		self.counter = 0
+
+	def add(self, delay, callback, *args):
+		self.counter += 1
+		heapq.heappush(self.heap, (time.time() + delay, self.counter, callback, args))
+
+	def timeout(self):
+		if not self.heap:
+			return None
+		return max(0, self.heap[0][0] - time.time())
+
+	def run(self):
+		now = time.time()
+		while self.heap and self.heap[0][0] <= now:
+			(when, counter, callback, args) = heapq.heappop(self.heap)
+			callback(*args)
+
+
+#
+# Minimal BER, just enough for the requests realmd sends
+#
+
+def ber_length(length):
+	if length < 0x80:
+		return bytearray([length])
+	encoded = bytearray()
+	while length:
+		encoded.insert(0, length & 0xff)
+		length >>= 8
+	return bytearray([0x80 | len(encoded)]) + encoded
+
+def ber_tlv(tag, value):
+	value = bytearray(value)
+	return bytearray([tag]) + ber_length(len(value)) + value
+
+def ber_integer(value, tag=0x02):
+	encoded = bytearray()
+	while True:
+		encoded.insert(0, value & 0xff)
+		value >>= 8
+		if value == 0 and not encoded[0] & 0x80:
+			break
+	return ber_tlv(tag, encoded)
+
+def ber_string(value):
+	return ber_tlv(0x04, to_bytes(value))
+
+def ber_parse(data, offset=0):
+	# Returns (tag, value, next) or None when incomplete
+	if offset + 2 > len(data):
+		return None
+	tag = data[offset]
+	length = data[offset + 1]
+	offset += 2
+	if length & 0x80:
+		count = length & 0x7f
+		if offset + count > len(data):
+			return None
+		length = 0
+		for i in range(count):
+			length = (length << 8) | data[offset + i]
+		offset += count
+	if offset + length > len(data):
+		return None
+	return (tag, data[offset:offset + length], offset + length)
+
+def ber_children(data):
+	children = []
+	offset = 0
+	while offset < len(data):
+		parsed = ber_parse(data, offset)
+		if parsed is None:
+			break
+		children.append(parsed[0:2])
+		offset = parsed[2]
+	return children
+
+def ber_to_int(value):
+	result = 0
+	for byte in value:
+		result = (result << 8) | byte
+	return result
+
+def ldap_message(msgid, op):
+	return ber_tlv(LDAP_SEQUENCE, ber_integer(msgid) + op)
+
+def ldap_entry(msgid, dn, attributes):
+	encoded = bytearray()
+	for (name, values) in attributes:
+		encoded += ber_tlv(LDAP_SEQUENCE, ber_string(name) +
+		                   ber_tlv(LDAP_SET, b"".join([bytes(ber_string(v)) for v in values])))
+	return ldap_message(msgid, ber_tlv(LDAP_SEARCH_ENTRY, ber_string(dn) +
+	                                   ber_tlv(LDAP_SEQUENCE, encoded)))
+
+def ldap_done(msgid, code=0, tag=LDAP_SEARCH_DONE):
+	return ldap_message(msgid, ber_tlv(tag, ber_integer(code, 0x0a) +
+	                                   ber_string("") + ber_string("")))
+
+
+#
+# The domain being faked
+#
+
+def dns_name(name):
+	encoded = bytearray()
+	for label in to_bytes(name).split(b"."):
+		if label:
+			encoded += bytearray([len(label)]) + bytearray(label)
+	return encoded + bytearray([0])
+
+def base_dn(domain):
+	return ",".join(["dc=%s" % part for part in domain.split(".")])
+
+class Domain:
+	def __init__(self, config):
+		self.domain = config.get("domain", "example.test").lower()
+		self.realm = config.get("realm", self.domain.upper())
+		self.workgroup = config.get("workgroup", self.domain.split(".")[0].upper()[:15])
+		self.type = config.get("type", "ad")
+		self.site = config.get("site", "Default-First-Site-Name")
+		self.client_site = config.get("client-site", self.site)
+		self.ttl = int(config.get("ttl", 60))
+		self.dns_latency = float(config.get("dns-latency", 0)) / 1000.0
+		self.servers = []
+		for (i, server) in enumerate(config.get("servers", [])):
+			server = dict(server)
+			server.setdefault("name", "dc%d.%s" % (i + 1, self.domain))
+			server.setdefault("address", "127.0.0.%d" % (i + 2))
+			server.setdefault("port", int(config.get("port", 3890)))
+			server.setdefault("site", self.site)
+			server.setdefault("latency", 0)
+			server.setdefault("jitter", 0)
+			server.setdefault("loss", 0.0)
+			server.setdefault("blackhole", False)
+			server["name"] = server["name"].lower()
+			self.servers.append(server)
+
+	def is_ad(self):
+		return self.type.startswith("ad")
+
+	def srv_records(self, qname):
+		service = "_ldap._tcp."
+		if not qname.startswith(service):
+			return None
+		rest = qname[len(service):]
+		if rest == self.domain or rest == "dc._msdcs." + self.domain:
+			return self.servers
+		suffix = "._sites.dc._msdcs." + self.domain
+		if rest.endswith(suffix):
+			site = rest[:-len(suffix)]
+			return [s for s in self.servers if s["site"].lower() == site]
+		return None
+
+	def a_records(self, qname):
+		if qname == self.domain:
+			return [s["address"] for s in self.servers]
+		for server in self.servers:
+			if server["name"] == qname:
+				return [server["address"]]
+		return None
+
+	def netlogon(self, server):
+		flags = DS_LDAP_FLAG | DS_DS_FLAG | DS_KDC_FLAG | DS_WRITABLE_FLAG
+		if server["site"] == self.client_site:
+			flags |= DS_CLOSEST_FLAG
+		blob = bytearray(struct.pack("<II", 23, flags))
+		blob += bytearray(16)
+		for name in (self.domain, self.domain, server["name"], self.workgroup,
+		             server["name"].split(".")[0].upper(), "",
+		             server["site"], self.client_site):
+			blob += dns_name(name)
+		return blob
+
+	def search(self, server, msgid, base, filter, attributes):
+		base = base.decode("utf-8").lower()
+		dn = base_dn(self.domain)
+		replies = []
+
+		if "netlogon" in attributes:
+			if self.is_ad():
+				replies.append(ldap_entry(msgid, "", [("netlogon", [self.netlogon(server)])]))
+		elif base == "":
+			capabilities = []
+			if self.is_ad():
+				capabilities.append(AD_CAPABILITY)
+				if self.type != "ad-2000":
+					capabilities.append(AD_2003_CAPABILITY)
+			attrs = [("defaultNamingContext", [dn]), ("namingContexts", [dn])]
+			if capabilities:
+				attrs.append(("supportedCapabilities", capabilities))
+			replies.append(ldap_entry(msgid, "", attrs))
+		elif self.type == "ipa" and base == dn:
+			if b"krbRealmContainer" in filter:
+				replies.append(ldap_entry(msgid, "cn=%s,cn=kerberos,%s" % (self.realm, dn),
+				                          [("cn", [self.realm])]))
+			else:
+				replies.append(ldap_entry(msgid, dn, [("info", ["IPA V2.0"]),
+				                                      ("associatedDomain", [self.domain])]))
+
+		replies.append(ldap_done(msgid))
+		return replies
+
+
+#
+# DNS server
+#
+
+class DnsServer:
+	def __init__(self, server, domain, timers, address, port):
+		self.server = server
+		self.domain = domain
+		self.timers = timers
+		self.udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.udp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.udp.bind((address, port))
+		self.tcp = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		self.tcp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.tcp.bind((address, port))
+		self.tcp.listen(16)
+		server.add_reader(self.udp, self.on_udp)
+		server.add_reader(self.tcp, self.on_accept)
+
+	def answer(self, query):
+		query = bytearray(query)
+		if len(query) < 12:
+			return None
+		(ident, flags, qdcount) = struct.unpack(">HHH", bytes(query[0:6]))
+		labels = []
+		offset = 12
+		while offset < len(query) and query[offset] != 0:
+			length = query[offset]
+			labels.append(bytes(query[offset + 1:offset + 1 + length]).decode("utf-8"))
+			offset += length + 1
+		offset += 1
+		if qdcount != 1 or offset + 4 > len(query):
+			return None
+		(qtype, qclass) = struct.unpack(">HH", bytes(query[offset:offset + 4]))
+		question = query[12:offset + 4]
+		qname = ".".join(labels).lower()
+
+		answers = []
+		found = False
+		if qtype == TYPE_SRV:
+			servers = self.domain.srv_records(qname)
+			if servers is not None:
+				found = True
+				for server in servers:
+					rdata = struct.pack(">HHH", 0, 100, server["port"]) + bytes(dns_name(server["name"]))
+					answers.append((TYPE_SRV, rdata))
+		elif qtype in (TYPE_A, TYPE_AAAA):
+			addresses = self.domain.a_records(qname)
+			if addresses is not None:
+				found = True
+				if qtype == TYPE_A:
+					for address in addresses:
+						answers.append((TYPE_A, socket.inet_aton(address)))
+		elif self.domain.a_records(qname) is not None or self.domain.srv_records(qname) is not None:
+			found = True
+
+		log("dns %s type %d: %d answers" % (qname, qtype, len(answers)))
+
+		# Authoritative answer, with NXDOMAIN for everything we don't know
+		flags = 0x8400 | (flags & 0x0100) | (0 if found else 3)
+		reply = bytearray(struct.pack(">HHHHHH", ident, flags, 1, len(answers), 0, 0))
+		reply += question
+		for (rtype, rdata) in answers:
+			reply += struct.pack(">HHHIH", 0xc00c, rtype, 1, self.domain.ttl, len(rdata))
+			reply += bytearray(rdata)
+		return bytes(reply)
+
+	def on_udp(self):
+		(data, peer) = self.udp.recvfrom(4096)
+		reply = self.answer(data)
+		if reply is not None:
+			self.timers.add(self.domain.dns_latency, self.udp.sendto, reply, peer)
+
+	def on_accept(self):
+		(connection, peer) = self.tcp.accept()
+		buffer = bytearray()
+		def on_read():
+			try:
+				data = connection.recv(4096)
+			except socket.error:
+				data = b""
+			if not data:
+				self.server.remove_reader(connection)
+				connection.close()
+				return
+			buffer.extend(bytearray(data))
+			while len(buffer) >= 2:
+				length = struct.unpack(">H", bytes(buffer[0:2]))[0]
+				if len(buffer) < length + 2:
+					break
+				reply = self.answer(buffer[2:length + 2])
+				del buffer[0:length + 2]
+				if reply is not None:
+					self.timers.add(self.domain.dns_latency, send_quietly, connection,
+					                struct.pack(">H", len(reply)) + reply)
+		self.server.add_reader(connection, on_read)
+
+
+#
+# LDAP and CLDAP server for one domain controller
+#
+
+def send_quietly(sock, data, peer=None):
+	try:
+		if peer is None:
+			sock.sendall(bytes(data))
+		else:
+			sock.sendto(bytes(data), peer)
+	except socket.error:
+		pass
+
+class LdapServer:
+	def __init__(self, server, domain, timers, config):
+		self.server = server
+		self.domain = domain
+		self.timers = timers
+		self.config = config
+		address = (config["address"], config["port"])
+
+		self.udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.udp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.udp.bind(address)
+		self.tcp = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		self.tcp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.tcp.bind(address)
+
+		# A blackhole never reads or accepts anything: once the tiny
+		# backlog is full further connection attempts just time out
+		if config["blackhole"]:
+			self.tcp.listen(0)
+			return
+
+		self.tcp.listen(16)
+		server.add_reader(self.udp, self.on_udp)
+		server.add_reader(self.tcp, self.on_accept)
+
+	def delay(self):
+		latency = float(self.config["latency"]) + random.uniform(0, float(self.config["jitter"]))
+		return latency / 1000.0
+
+	def lost(self):
+		return random.random() < float(self.config["loss"])
+
+	def dispatch(self, message):
+		# Returns the reply messages, or None to close the connection
+		children = ber_children(message)
+		if len(children) < 2:
+			return None
+		msgid = ber_to_int(children[0][1])
+		(tag, op) = children[1]
+
+		if tag == LDAP_UNBIND_REQUEST:
+			return None
+		elif tag == LDAP_ABANDON_REQUEST:
+			return []
+		elif tag == LDAP_BIND_REQUEST:
+			return [ldap_done(msgid, 0, LDAP_BIND_RESPONSE)]
+		elif tag != LDAP_SEARCH_REQUEST:
+			return [ldap_done(msgid, 53)]
+
+		fields = ber_children(op)
+		if len(fields) < 8:
+			return [ldap_done(msgid, 2)]
+		base = bytes(fields[0][1])
+		filter = bytes(fields[6][1])
+		attributes = [bytes(value).decode("utf-8").lower() for (t, value) in ber_children(fields[7][1])]
+		log("ldap %s: search '%s' for %s" % (self.config["name"], base.decode("utf-8"),
+		                                     ", ".join(attributes)))
+		return self.domain.search(self.config, msgid, base, filter, attributes)
+
+	def on_udp(self):
+		(data, peer) = self.udp.recvfrom(4096)
+		parsed = ber_parse(bytearray(data))
+		if parsed is None or parsed[0] != LDAP_SEQUENCE:
+			return
+		replies = self.dispatch(parsed[1])
+		if not replies or self.lost():
+			return
+		self.timers.add(self.delay(), send_quietly, self.udp, b"".join([bytes(r) for r in replies]), peer)
+
+	def on_accept(self):
+		(connection, peer) = self.tcp.accept()
+		buffer = bytearray()
+		def on_read():
+			try:
+				data = connection.recv(4096)
+			except socket.error:
+				data = b""
+			if not data:
+				self.server.remove_reader(connection)
+				connection.close()
+				return
+			buffer.extend(bytearray(data))
+			while True:
+				parsed = ber_parse(buffer)
+				if parsed is None:
+					break
+				del buffer[0:parsed[2]]
+				replies = self.dispatch(parsed[1])
+				if replies is None:
+					self.server.remove_reader(connection)
+					connection.close()
+					return
+				if replies:
+					delay = self.delay()
+					if self.lost():
+						delay += 1.0
+					self.timers.add(delay, send_quietly, connection,
+					                b"".join([bytes(r) for r in replies]))
+		self.server.add_reader(connection, on_read)
+
+
+class Server:
+	def __init__(self):
+		self.readers = { }
+		self.timers = Timers()
+
+	def add_reader(self, sock, callback):
+		self.readers[sock] = callback
+
+	def remove_reader(self, sock):
+		self.readers.pop(sock, None)
+
+	def run(self):
+		while True:
+			(readable, writable, errors) = select.select(list(self.readers.keys()), [], [],
+			                                             self.timers.timeout())
+			for sock in readable:
+				callback = self.readers.get(sock)
+				if callback:
+					callback()
+			self.timers.run()
+
+
+def usage():
+	sys.stderr.write("usage: fake-realm-server.py [--config=FILE] [--dns=ADDRESS:PORT] [--domain=NAME]\n"
+	                 "         [--type=ad|ad-2000|ipa] [--servers=N] [--port=PORT] [--latency=MS]\n"
+	                 "         [--jitter=MS] [--loss=FRACTION] [--blackhole=N] [--verbose]\n")
+	sys.exit(2)
+
+def main(argv):
+	global verbose
+
+	try:
+		opts, args = getopt.getopt(argv, "v", ["config=", "dns=", "domain=", "type=", "servers=",
+		                                       "port=", "latency=", "jitter=", "loss=",
+		                                       "blackhole=", "verbose"])
+	except getopt.GetoptError as err:
+		sys.stderr.write("fake-realm-server.py: %s\n" % err)
+		usage()
+	if args:
+		usage()
+
+	config = { }
+	dns = "127.0.0.1:5353"
+	count = 2
+	defaults = { }
+	blackholes = 0
+
+	for o, a in opts:
+		if o == "--config":
+			with open(a) as f:
+				config = json.load(f)
+		elif o == "--dns":
+			dns = a
+		elif o == "--domain":
+			config["domain"] = a
+		elif o == "--type":
+			config["type"] = a
+		elif o == "--servers":
+			count = int(a)
+		elif o == "--port":
+			config["port"] = int(a)
+		elif o in ("--latency", "--jitter"):
+			defaults[o[2:]] = float(a)
+		elif o == "--loss":
+			defaults["loss"] = float(a)
+		elif o == "--blackhole":
+			blackholes = int(a)
+		elif o in ("-v", "--verbose"):
+			verbose = True
+
+	if "servers" not in config:
+		config["servers"] = [{ } for i in range(count)]
+	for (i, server) in enumerate(config["servers"]):
+		for (key, value) in defaults.items():
+			server.setdefault(key, value)
+		if i < blackholes:
+			server["blackhole"] = True
+
+	domain = Domain(config)
+	server = Server()
+
+	(address, sep, port) = dns.rpartition(":")
+	DnsServer(server, domain, server.timers, address or "127.0.0.1", int(port))
+	for config in domain.servers:
+		LdapServer(server, domain, server.timers, config)
+		log("%s at %s:%d%s" % (config["name"], config["address"], config["port"],
+		                       config["blackhole"] and " (blackhole)" or ""))
+
+	try:
+		server.run()
+	except KeyboardInterrupt:
+		pass
+
+if __name__ == '__main__':
+	main(sys.argv[1:])
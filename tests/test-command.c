@@ -0,0 +1,314 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#include "service/realm-command.h"
+#include "service/realm-diagnostics.h"
+#include "service/realm-invocation.h"
+#include "service/realm-settings.h"
+#include "service/realm-timings.h"
+
+#include <glib/gstdio.h>
+
+#include <string.h>
+#include <unistd.h>
+
+/* Must match realm-command.c */
+#define OUTPUT_HEAD_SIZE 4096
+#define OUTPUT_TAIL_SIZE 16384
+
+static GMainLoop *loop;
+
+/* What realm-command.c sent to diagnostics */
+static GString *diagnostics_lines;
+static GString *diagnostics_data;
+
+typedef struct {
+	gchar *filename;
+	gchar *contents;
+	gsize length;
+} Test;
+
+static void
+setup (Test *test,
+       gconstpointer data)
+{
+	GError *error = NULL;
+	int fd;
+
+	fd = g_file_open_tmp ("realmd-test-command.XXXXXX", &test->filename, &error);
+	g_assert_no_error (error);
+	close (fd);
+
+	diagnostics_lines = g_string_new ("");
+	diagnostics_data = g_string_new ("");
+}
+
+static void
+teardown (Test *test,
+          gconstpointer data)
+{
+	g_unlink (test->filename);
+	g_free (test->filename);
+	g_free (test->contents);
+
+	g_string_free (diagnostics_lines, TRUE);
+	diagnostics_lines = NULL;
+	g_string_free (diagnostics_data, TRUE);
+	diagnostics_data = NULL;
+}
+
+static void
+write_output (Test *test,
+              gsize length)
+{
+	const gchar *chars = "abcdefghijklmnopqrstuvwxyz0123456789";
+	GError *error = NULL;
+	gsize i;
+
+	/* Doesn't repeat on the tail boundary, so a misplaced byte shows */
+	test->contents = g_malloc (length + 1);
+	for (i = 0; i < length; i++)
+		test->contents[i] = (i % 61 == 60) ? '\n' : chars[(i * 7 + i / 61) % 36];
+	test->contents[length] = '\0';
+	test->length = length;
+
+	g_file_set_contents (test->filename, test->contents, length, &error);
+	g_assert_no_error (error);
+}
+
+static void
+on_ready_get_result (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	GAsyncResult **place = user_data;
+	*place = g_object_ref (result);
+	g_main_loop_quit (loop);
+}
+
+static GString *
+run_command (gchar **argv,
+             guint timeout,
+             RealmCommandFlags flags,
+             GError **error)
+{
+	GAsyncResult *result = NULL;
+	GString *output = NULL;
+	gint status;
+
+	realm_command_runv_full_async (argv, NULL, NULL, timeout, flags,
+	                               NULL, on_ready_get_result, &result);
+	g_main_loop_run (loop);
+
+	status = realm_command_run_finish (result, &output, error);
+	g_object_unref (result);
+
+	if (output)
+		g_assert_cmpint (status, ==, 0);
+	return output;
+}
+
+static void
+test_timeout_ignores_term (Test *test,
+                           gconstpointer data)
+{
+	gchar *argv[] = { "/bin/sh", "-c", "trap '' TERM; sleep 60", NULL };
+	const gchar *prefix = "Process timed out after ";
+	GError *error = NULL;
+	GString *output;
+	gdouble seconds;
+	gint64 started;
+	gchar *end;
+
+	/* It ignores SIGTERM, so only the SIGKILL after the grace period ends it */
+	started = g_get_monotonic_time ();
+	output = run_command (argv, 1, REALM_COMMAND_NONE, &error);
+	g_assert (output == NULL);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT);
+
+	g_assert (g_str_has_prefix (error->message, prefix));
+	seconds = g_ascii_strtod (error->message + strlen (prefix), &end);
+	g_assert_cmpstr (end, ==, " seconds");
+	g_assert_cmpfloat (seconds, >=, 5.0);
+	g_assert_cmpfloat (seconds, <, 30.0);
+	g_assert_cmpint (g_get_monotonic_time () - started, <, 30 * G_USEC_PER_SEC);
+
+	g_assert (strstr (diagnostics_lines->str,
+	                  "Process did not finish within 1 seconds, terminating it\n") != NULL);
+	g_error_free (error);
+}
+
+static void
+test_capture_output (Test *test,
+                     gconstpointer data)
+{
+	gsize length = GPOINTER_TO_SIZE (data);
+	gchar *argv[] = { "/bin/cat", test->filename, NULL };
+	GError *error = NULL;
+	GString *expected;
+	GString *output;
+	gsize omitted;
+
+	write_output (test, length);
+
+	/* The head, and the tail in the right order however often it wrapped */
+	expected = g_string_new ("");
+	if (length <= OUTPUT_HEAD_SIZE + OUTPUT_TAIL_SIZE) {
+		g_string_append_len (expected, test->contents, length);
+	} else {
+		omitted = length - OUTPUT_HEAD_SIZE - OUTPUT_TAIL_SIZE;
+		g_string_append_len (expected, test->contents, OUTPUT_HEAD_SIZE);
+		g_string_append_printf (expected, "\n[... %" G_GSIZE_FORMAT " bytes of output omitted ...]\n",
+		                        omitted);
+		g_string_append_len (expected, test->contents + length - OUTPUT_TAIL_SIZE,
+		                     OUTPUT_TAIL_SIZE);
+	}
+
+	output = run_command (argv, 0, REALM_COMMAND_NONE, &error);
+	g_assert_no_error (error);
+	g_assert_cmpuint (output->len, ==, expected->len);
+	g_assert (memcmp (output->str, expected->str, expected->len) == 0);
+	g_string_free (output, TRUE);
+	g_string_free (expected, TRUE);
+
+	/* Unless all of it is asked for */
+	output = run_command (argv, 0, REALM_COMMAND_FULL_OUTPUT, &error);
+	g_assert_no_error (error);
+	g_assert_cmpuint (output->len, ==, length);
+	g_assert (memcmp (output->str, test->contents, length) == 0);
+	g_string_free (output, TRUE);
+}
+
+static void
+test_diagnostics_limit (Test *test,
+                        gconstpointer data)
+{
+	gchar *argv[] = { "/bin/cat", test->filename, NULL };
+	GError *error = NULL;
+	GString *output;
+
+	write_output (test, 5000);
+
+	/* Cut off mid line, which gets finished off */
+	realm_settings_add ("commands", "cat.diagnostics-limit", "1000");
+	output = run_command (argv, 0, REALM_COMMAND_NONE, &error);
+	g_assert_no_error (error);
+
+	g_assert_cmpuint (diagnostics_data->len, ==, 1001);
+	g_assert (memcmp (diagnostics_data->str, test->contents, 1000) == 0);
+	g_assert_cmpint (diagnostics_data->str[1000], ==, '\n');
+	g_assert (strstr (diagnostics_lines->str,
+	                  "Not showing more than 1000 bytes of output from cat\n") != NULL);
+
+	/* The captured output isn't affected */
+	g_assert_cmpuint (output->len, ==, 5000);
+	g_assert (memcmp (output->str, test->contents, 5000) == 0);
+	g_string_free (output, TRUE);
+
+	/* Zero is no limit at all */
+	g_string_truncate (diagnostics_lines, 0);
+	g_string_truncate (diagnostics_data, 0);
+	realm_settings_add ("commands", "cat.diagnostics-limit", "0");
+	output = run_command (argv, 0, REALM_COMMAND_NONE, &error);
+	g_assert_no_error (error);
+
+	g_assert_cmpuint (diagnostics_data->len, ==, 5000);
+	g_assert (memcmp (diagnostics_data->str, test->contents, 5000) == 0);
+	g_assert (strstr (diagnostics_lines->str, "Not showing more") == NULL);
+	g_string_free (output, TRUE);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+	int ret;
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-command");
+
+	realm_settings_init ();
+	loop = g_main_loop_new (NULL, FALSE);
+
+	g_test_add ("/realmd/command/timeout-ignores-term", Test, NULL,
+	            setup, test_timeout_ignores_term, teardown);
+	g_test_add ("/realmd/command/capture-head-only", Test, GSIZE_TO_POINTER (100),
+	            setup, test_capture_output, teardown);
+	g_test_add ("/realmd/command/capture-head-and-tail", Test,
+	            GSIZE_TO_POINTER (OUTPUT_HEAD_SIZE + OUTPUT_TAIL_SIZE),
+	            setup, test_capture_output, teardown);
+	g_test_add ("/realmd/command/capture-one-omitted", Test,
+	            GSIZE_TO_POINTER (OUTPUT_HEAD_SIZE + OUTPUT_TAIL_SIZE + 1),
+	            setup, test_capture_output, teardown);
+	g_test_add ("/realmd/command/capture-wraparound", Test,
+	            GSIZE_TO_POINTER (OUTPUT_HEAD_SIZE + OUTPUT_TAIL_SIZE * 3 + 1234),
+	            setup, test_capture_output, teardown);
+	g_test_add ("/realmd/command/diagnostics-limit", Test, NULL,
+	            setup, test_diagnostics_limit, teardown);
+
+	ret = g_test_run ();
+
+	g_main_loop_unref (loop);
+	realm_settings_uninit ();
+
+	return ret;
+}
+
+/* Dummy functions */
+
+GCancellable *
+realm_invocation_get_cancellable (GDBusMethodInvocation *invocation)
+{
+	return NULL;
+}
+
+void
+realm_diagnostics_info (GDBusMethodInvocation *invocation,
+                        const gchar *format,
+                        ...)
+{
+	va_list va;
+
+	va_start (va, format);
+	g_string_append_vprintf (diagnostics_lines, format, va);
+	g_string_append_c (diagnostics_lines, '\n');
+	va_end (va);
+}
+
+void
+realm_diagnostics_info_data (GDBusMethodInvocation *invocation,
+                             const gchar *data,
+                             gssize n_data)
+{
+	if (n_data < 0)
+		n_data = strlen (data);
+	g_string_append_len (diagnostics_data, data, n_data);
+}
+
+void
+realm_timings_record_usage (GDBusMethodInvocation *invocation,
+                            const gchar *phase,
+                            const gchar *server,
+                            gint64 started,
+                            const gchar *failure,
+                            const RealmTimingsUsage *usage)
+{
+
+}
@@ -0,0 +1,169 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#include "service/realm-disco.h"
+#include "service/realm-disco-mscldap.h"
+#include "service/realm-settings.h"
+
+#include <glib-object.h>
+
+#include <unistd.h>
+
+typedef struct {
+	GSocket *server;
+	GSocketAddress *address;
+	GSource *source;
+	GMainLoop *loop;
+	GAsyncResult *result;
+	gint received;
+} Test;
+
+static gboolean
+on_server_input (GSocket *sock,
+                 GIOCondition cond,
+                 gpointer user_data)
+{
+	const gchar garbage[] = "\x30\x84\xff\xff\xff\xff not ldap";
+	Test *test = user_data;
+	GSocketAddress *from = NULL;
+	GError *error = NULL;
+	gchar buffer[4096];
+	gssize len;
+
+	len = g_socket_receive_from (sock, &from, buffer, sizeof (buffer), NULL, &error);
+	g_assert_no_error (error);
+	g_assert_cmpint (len, >, 0);
+
+	/* Answer the first ping with junk, and then say nothing more */
+	if (test->received++ == 0) {
+		g_socket_send_to (sock, from, garbage, sizeof (garbage), NULL, &error);
+		g_assert_no_error (error);
+	}
+
+	g_object_unref (from);
+	return TRUE;
+}
+
+static void
+setup (Test *test,
+       gconstpointer unused)
+{
+	GInetAddress *inet;
+	GSocketAddress *any;
+	GError *error = NULL;
+
+	realm_settings_init ();
+	realm_settings_add ("discovery", "response-timeout", "1");
+
+	test->server = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+	                             G_SOCKET_PROTOCOL_UDP, &error);
+	g_assert_no_error (error);
+
+	inet = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+	any = g_inet_socket_address_new (inet, 0);
+	g_socket_bind (test->server, any, TRUE, &error);
+	g_assert_no_error (error);
+	g_object_unref (any);
+	g_object_unref (inet);
+
+	test->address = g_socket_get_local_address (test->server, &error);
+	g_assert_no_error (error);
+
+	test->source = g_socket_create_source (test->server, G_IO_IN, NULL);
+	g_source_set_callback (test->source, (GSourceFunc)on_server_input, test, NULL);
+	g_source_attach (test->source, NULL);
+
+	test->loop = g_main_loop_new (NULL, FALSE);
+}
+
+static void
+teardown (Test *test,
+          gconstpointer unused)
+{
+	g_source_destroy (test->source);
+	g_source_unref (test->source);
+	g_object_unref (test->address);
+	g_object_unref (test->server);
+	g_main_loop_unref (test->loop);
+	g_clear_object (&test->result);
+	realm_settings_uninit ();
+}
+
+static void
+on_ready_get_result (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	Test *test = user_data;
+	test->result = g_object_ref (result);
+	g_main_loop_quit (test->loop);
+}
+
+static void
+test_ping_junk_then_silence (Test *test,
+                             gconstpointer unused)
+{
+	GError *error = NULL;
+	RealmDisco *disco;
+	GList *addresses;
+	gint64 started;
+
+	/* A blocking read after the junk would hang here, so don't wait forever */
+	alarm (30);
+
+	addresses = g_list_prepend (NULL, test->address);
+	started = g_get_monotonic_time ();
+	realm_disco_mscldap_ping_async ("example.test", addresses, NULL,
+	                                on_ready_get_result, test);
+	g_list_free (addresses);
+
+	g_main_loop_run (test->loop);
+
+	disco = realm_disco_mscldap_ping_finish (test->result, &error);
+	g_assert_no_error (error);
+	g_assert (disco == NULL);
+
+	/* The junk was answered, the pings kept going, and it gave up in time */
+	g_assert_cmpint (test->received, >, 1);
+	g_assert_cmpint (g_get_monotonic_time () - started, <, 5 * G_USEC_PER_SEC);
+
+	alarm (0);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-mscldap");
+
+	g_test_add ("/realmd/mscldap/ping-junk-then-silence", Test, NULL,
+	            setup, test_ping_junk_then_silence, teardown);
+
+	return g_test_run ();
+}
+
+/* Dummy functions */
+
+const gchar *
+realm_invocation_get_key (GDBusMethodInvocation *invocation)
+{
+	return NULL;
+}
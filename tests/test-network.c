@@ -0,0 +1,504 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#include "service/realm-disco-cache.h"
+#include "service/realm-network.h"
+#include "service/realm-settings.h"
+
+#include <glib-object.h>
+#include <glib/gstdio.h>
+
+#include <unistd.h>
+
+/* Just enough of NetworkManager and systemd-resolved to answer lookups */
+static const gchar *mock_xml =
+	"<node>"
+	" <interface name='org.freedesktop.NetworkManager'>"
+	"  <property name='ActiveConnections' type='ao' access='read'/>"
+	" </interface>"
+	" <interface name='org.freedesktop.NetworkManager.Connection.Active'>"
+	"  <property name='Devices' type='ao' access='read'/>"
+	" </interface>"
+	" <interface name='org.freedesktop.NetworkManager.Device'>"
+	"  <property name='Dhcp4Config' type='o' access='read'/>"
+	"  <property name='Dhcp6Config' type='o' access='read'/>"
+	" </interface>"
+	" <interface name='org.freedesktop.NetworkManager.DHCP4Config'>"
+	"  <property name='Options' type='a{sv}' access='read'/>"
+	" </interface>"
+	" <interface name='org.freedesktop.resolve1.Manager'>"
+	"  <property name='Domains' type='a(isb)' access='read'/>"
+	" </interface>"
+	"</node>";
+
+typedef struct {
+	GTestDBus *bus;
+	GDBusConnection *client;
+	GDBusConnection *server;
+	GDBusNodeInfo *info;
+	GHashTable *properties;
+	GHashTable *registered;
+	gchar *resolv_conf;
+	GMainLoop *loop;
+	GAsyncResult *result;
+} Test;
+
+static GVariant *
+on_get_property (GDBusConnection *connection,
+                 const gchar *sender,
+                 const gchar *object_path,
+                 const gchar *interface_name,
+                 const gchar *property_name,
+                 GError **error,
+                 gpointer user_data)
+{
+	Test *test = user_data;
+	GVariant *value;
+	gchar *key;
+
+	key = g_strdup_printf ("%s %s %s", object_path, interface_name, property_name);
+	value = g_hash_table_lookup (test->properties, key);
+	g_free (key);
+
+	if (value == NULL) {
+		g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+		             "No such property: %s", property_name);
+		return NULL;
+	}
+
+	return g_variant_ref (value);
+}
+
+static const GDBusInterfaceVTable mock_vtable = {
+	NULL,
+	on_get_property,
+	NULL,
+};
+
+static void
+mock_property (Test *test,
+               const gchar *object_path,
+               const gchar *interface_name,
+               const gchar *property_name,
+               GVariant *value)
+{
+	GDBusInterfaceInfo *iface;
+	GError *error = NULL;
+	gchar *key;
+	guint id;
+
+	key = g_strdup_printf ("%s %s", object_path, interface_name);
+	if (!g_hash_table_lookup (test->registered, key)) {
+		iface = g_dbus_node_info_lookup_interface (test->info, interface_name);
+		g_assert (iface != NULL);
+		id = g_dbus_connection_register_object (test->server, object_path, iface,
+		                                        &mock_vtable, test, NULL, &error);
+		g_assert_no_error (error);
+		g_hash_table_insert (test->registered, g_strdup (key), GUINT_TO_POINTER (id));
+	}
+	g_free (key);
+
+	key = g_strdup_printf ("%s %s %s", object_path, interface_name, property_name);
+	g_hash_table_insert (test->properties, key, g_variant_ref_sink (value));
+}
+
+static void
+mock_own_name (Test *test,
+               const gchar *name)
+{
+	GError *error = NULL;
+	GVariant *retval;
+	guint32 reply;
+
+	retval = g_dbus_connection_call_sync (test->server, "org.freedesktop.DBus",
+	                                      "/org/freedesktop/DBus", "org.freedesktop.DBus",
+	                                      "RequestName", g_variant_new ("(su)", name, 4),
+	                                      G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE,
+	                                      -1, NULL, &error);
+	g_assert_no_error (error);
+	g_variant_get (retval, "(u)", &reply);
+	g_assert_cmpuint (reply, ==, 1);
+	g_variant_unref (retval);
+}
+
+static void
+mock_dhcp_domain (Test *test,
+                  const gchar *domain)
+{
+	GVariantBuilder options;
+
+	g_variant_builder_init (&options, G_VARIANT_TYPE ("a{sv}"));
+	g_variant_builder_add (&options, "{sv}", "domain_name", g_variant_new_string (domain));
+
+	mock_property (test, "/org/freedesktop/NetworkManager/DHCP4Config/1",
+	               "org.freedesktop.NetworkManager.DHCP4Config", "Options",
+	               g_variant_builder_end (&options));
+}
+
+static void
+mock_dhcp_changed (Test *test)
+{
+	const gchar *changed[] = { "Options", NULL };
+	GError *error = NULL;
+
+	/* Like NetworkManager, just says what changed */
+	g_dbus_connection_emit_signal (test->server, NULL, "/org/freedesktop/NetworkManager/DHCP4Config/1",
+	                               "org.freedesktop.DBus.Properties", "PropertiesChanged",
+	                               g_variant_new ("(s@a{sv}@as)", "org.freedesktop.NetworkManager.DHCP4Config",
+	                                              g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
+	                                              g_variant_new_strv (changed, -1)),
+	                               &error);
+	g_assert_no_error (error);
+}
+
+static void
+mock_network_manager (Test *test,
+                      const gchar *domain)
+{
+	const gchar *active[] = { "/org/freedesktop/NetworkManager/ActiveConnection/1", NULL };
+	const gchar *devices[] = { "/org/freedesktop/NetworkManager/Devices/1", NULL };
+
+	mock_property (test, "/org/freedesktop/NetworkManager",
+	               "org.freedesktop.NetworkManager", "ActiveConnections",
+	               g_variant_new_objv (active, -1));
+	mock_property (test, active[0],
+	               "org.freedesktop.NetworkManager.Connection.Active", "Devices",
+	               g_variant_new_objv (devices, -1));
+	mock_property (test, devices[0],
+	               "org.freedesktop.NetworkManager.Device", "Dhcp4Config",
+	               g_variant_new_object_path ("/org/freedesktop/NetworkManager/DHCP4Config/1"));
+	mock_property (test, devices[0],
+	               "org.freedesktop.NetworkManager.Device", "Dhcp6Config",
+	               g_variant_new_object_path ("/"));
+	mock_dhcp_domain (test, domain);
+
+	mock_own_name (test, "org.freedesktop.NetworkManager");
+}
+
+static void
+mock_resolved (Test *test,
+               const gchar *global,
+               const gchar *link)
+{
+	GVariantBuilder domains;
+
+	/* Routing only domains are never the answer */
+	g_variant_builder_init (&domains, G_VARIANT_TYPE ("a(isb)"));
+	g_variant_builder_add (&domains, "(isb)", 2, "corp.test", TRUE);
+	g_variant_builder_add (&domains, "(isb)", 0, ".", TRUE);
+	if (global)
+		g_variant_builder_add (&domains, "(isb)", 0, global, FALSE);
+	if (link)
+		g_variant_builder_add (&domains, "(isb)", 2, link, FALSE);
+
+	mock_property (test, "/org/freedesktop/resolve1",
+	               "org.freedesktop.resolve1.Manager", "Domains",
+	               g_variant_builder_end (&domains));
+
+	mock_own_name (test, "org.freedesktop.resolve1");
+}
+
+static void
+mock_resolv_conf (Test *test,
+                  const gchar *contents)
+{
+	GError *error = NULL;
+
+	g_file_set_contents (test->resolv_conf, contents, -1, &error);
+	g_assert_no_error (error);
+}
+
+static GDBusConnection *
+connect_to_bus (Test *test)
+{
+	GDBusConnection *connection;
+	GError *error = NULL;
+
+	/* Not the shared session bus, that must go away with the test bus */
+	connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (test->bus),
+	                                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+	                                                     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+	                                                     NULL, NULL, &error);
+	g_assert_no_error (error);
+	return connection;
+}
+
+static void
+setup (Test *test,
+       gconstpointer unused)
+{
+	GError *error = NULL;
+
+	test->bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+	g_test_dbus_up (test->bus);
+
+	test->client = connect_to_bus (test);
+	test->server = connect_to_bus (test);
+
+	test->info = g_dbus_node_info_new_for_xml (mock_xml, &error);
+	g_assert_no_error (error);
+
+	test->properties = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+	                                          (GDestroyNotify)g_variant_unref);
+	test->registered = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	test->resolv_conf = g_strdup_printf ("/tmp/realmd-test-resolv.%d", (gint)getpid ());
+	realm_settings_add ("paths", "resolv.conf", test->resolv_conf);
+
+	test->loop = g_main_loop_new (NULL, FALSE);
+}
+
+static void
+teardown (Test *test,
+          gconstpointer unused)
+{
+	GHashTableIter iter;
+	gpointer id;
+
+	g_hash_table_iter_init (&iter, test->registered);
+	while (g_hash_table_iter_next (&iter, NULL, &id))
+		g_dbus_connection_unregister_object (test->server, GPOINTER_TO_UINT (id));
+
+	g_dbus_connection_close_sync (test->server, NULL, NULL);
+	g_dbus_connection_close_sync (test->client, NULL, NULL);
+	g_object_unref (test->server);
+	g_object_unref (test->client);
+	g_test_dbus_down (test->bus);
+	g_object_unref (test->bus);
+
+	g_unlink (test->resolv_conf);
+	g_free (test->resolv_conf);
+
+	g_hash_table_destroy (test->properties);
+	g_hash_table_destroy (test->registered);
+	g_dbus_node_info_unref (test->info);
+	g_main_loop_unref (test->loop);
+	if (test->result)
+		g_object_unref (test->result);
+}
+
+static void
+on_ready_get_result (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	Test *test = user_data;
+	test->result = g_object_ref (result);
+	g_main_loop_quit (test->loop);
+}
+
+static gchar *
+default_domain (Test *test,
+                const gchar **source)
+{
+	GError *error = NULL;
+	gchar *domain;
+
+	realm_network_get_default_domain_async (test->client, on_ready_get_result, test);
+	g_main_loop_run (test->loop);
+
+	domain = realm_network_get_default_domain_finish (test->result, source, &error);
+	g_assert_no_error (error);
+	return domain;
+}
+
+static gchar *
+dhcp_domain (Test *test)
+{
+	GError *error = NULL;
+	gchar *domain;
+
+	g_clear_object (&test->result);
+	realm_network_get_dhcp_domain_async (test->client, on_ready_get_result, test);
+	g_main_loop_run (test->loop);
+
+	domain = realm_network_get_dhcp_domain_finish (test->result, &error);
+	g_assert_no_error (error);
+	return domain;
+}
+
+static gboolean
+on_timeout_quit (gpointer user_data)
+{
+	Test *test = user_data;
+	g_main_loop_quit (test->loop);
+	return FALSE;
+}
+
+static void
+wait_for_refresh (Test *test)
+{
+	/* Well past the delay before the watch looks again */
+	g_timeout_add (1500, on_timeout_quit, test);
+	g_main_loop_run (test->loop);
+}
+
+static void
+test_resolv_conf (Test *test,
+                  gconstpointer unused)
+{
+	const gchar *source;
+	gchar *domain;
+
+	mock_resolv_conf (test, "# generated\n"
+	                        "domain old.test\n"
+	                        "nameserver 192.0.2.1\n"
+	                        "search\tone.test two.test\n");
+
+	/* The last line wins, and its first search domain */
+	domain = default_domain (test, &source);
+	g_assert_cmpstr (domain, ==, "one.test");
+	g_assert_cmpstr (source, ==, "resolv.conf");
+	g_free (domain);
+}
+
+static void
+test_resolved (Test *test,
+               gconstpointer unused)
+{
+	const gchar *source;
+	gchar *domain;
+
+	mock_resolv_conf (test, "search stub.test\n");
+	mock_resolved (test, "global.test", "link.test");
+
+	domain = default_domain (test, &source);
+	g_assert_cmpstr (domain, ==, "link.test");
+	g_assert_cmpstr (source, ==, "systemd-resolved");
+	g_free (domain);
+}
+
+static void
+test_resolved_global (Test *test,
+                      gconstpointer unused)
+{
+	const gchar *source;
+	gchar *domain;
+
+	mock_resolved (test, "global.test.", NULL);
+
+	domain = default_domain (test, &source);
+	g_assert_cmpstr (domain, ==, "global.test");
+	g_assert_cmpstr (source, ==, "systemd-resolved");
+	g_free (domain);
+}
+
+static void
+test_network_manager (Test *test,
+                      gconstpointer unused)
+{
+	const gchar *source;
+	gchar *domain;
+
+	mock_resolv_conf (test, "search stub.test\n");
+	mock_resolved (test, NULL, "link.test");
+	mock_network_manager (test, "dhcp.test");
+
+	domain = default_domain (test, &source);
+	g_assert_cmpstr (domain, ==, "dhcp.test");
+	g_assert_cmpstr (source, ==, "NetworkManager");
+	g_free (domain);
+}
+
+static void
+test_dhcp_changed (Test *test,
+                   gconstpointer unused)
+{
+	RealmDisco *disco;
+	gchar *domain;
+	gchar *failure;
+
+	mock_network_manager (test, "dhcp.test");
+
+	domain = dhcp_domain (test);
+	g_assert_cmpstr (domain, ==, "dhcp.test");
+	g_free (domain);
+
+	/* Now the watch has seen NetworkManager and knows the domain */
+	wait_for_refresh (test);
+
+	disco = realm_disco_new ("found.test");
+	realm_disco_cache_store ("found.test", disco, 60);
+	realm_disco_unref (disco);
+	realm_disco_cache_store_failure ("missing.test", "Nope");
+
+	/* Without a change signal the remembered domain is used */
+	mock_dhcp_domain (test, "moved.test");
+	domain = dhcp_domain (test);
+	g_assert_cmpstr (domain, ==, "dhcp.test");
+	g_free (domain);
+
+	disco = realm_disco_cache_lookup ("found.test", NULL);
+	g_assert (disco != NULL);
+	realm_disco_unref (disco);
+
+	/* The watch looks again by itself */
+	mock_dhcp_changed (test);
+	wait_for_refresh (test);
+
+	disco = realm_disco_cache_lookup ("found.test", NULL);
+	g_assert (disco == NULL);
+	failure = realm_disco_cache_lookup_failure ("missing.test", NULL);
+	g_assert (failure == NULL);
+
+	/* And remembers the new one */
+	mock_dhcp_domain (test, "unseen.test");
+	domain = dhcp_domain (test);
+	g_assert_cmpstr (domain, ==, "moved.test");
+	g_free (domain);
+}
+
+static void
+test_nothing (Test *test,
+              gconstpointer unused)
+{
+	const gchar *source = "invalid";
+	gchar *domain;
+
+	mock_resolv_conf (test, "nameserver 192.0.2.1\n");
+
+	domain = default_domain (test, &source);
+	g_assert (domain == NULL);
+	g_assert (source == NULL);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+	int ret;
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-network");
+
+	realm_settings_init ();
+
+	g_test_add ("/realmd/network/resolv-conf", Test, NULL, setup, test_resolv_conf, teardown);
+	g_test_add ("/realmd/network/resolved", Test, NULL, setup, test_resolved, teardown);
+	g_test_add ("/realmd/network/resolved-global", Test, NULL, setup, test_resolved_global, teardown);
+	g_test_add ("/realmd/network/network-manager", Test, NULL, setup, test_network_manager, teardown);
+	g_test_add ("/realmd/network/dhcp-changed", Test, NULL, setup, test_dhcp_changed, teardown);
+	g_test_add ("/realmd/network/nothing", Test, NULL, setup, test_nothing, teardown);
+
+	ret = g_test_run ();
+
+	realm_settings_uninit ();
+	return ret;
+}
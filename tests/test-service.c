@@ -0,0 +1,424 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2013 Red Hat Inc
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ *
+ * Author: Stef Walter <stefw@redhat.com>
+ */
+
+#include "config.h"
+
+#include "service/realm-command.h"
+#include "service/realm-daemon.h"
+#include "service/realm-diagnostics.h"
+#include "service/realm-invocation.h"
+#include "service/realm-service.h"
+#include "service/realm-settings.h"
+
+#include <glib-object.h>
+
+/* Just enough of systemd to manage units */
+static const gchar *systemd_xml =
+	"<node>"
+	" <interface name='org.freedesktop.systemd1.Manager'>"
+	"  <method name='Subscribe'/>"
+	"  <method name='Reload'/>"
+	"  <method name='EnableUnitFiles'>"
+	"   <arg name='files' type='as' direction='in'/>"
+	"   <arg name='runtime' type='b' direction='in'/>"
+	"   <arg name='force' type='b' direction='in'/>"
+	"   <arg name='carries_install_info' type='b' direction='out'/>"
+	"   <arg name='changes' type='a(sss)' direction='out'/>"
+	"  </method>"
+	"  <method name='DisableUnitFiles'>"
+	"   <arg name='files' type='as' direction='in'/>"
+	"   <arg name='runtime' type='b' direction='in'/>"
+	"   <arg name='changes' type='a(sss)' direction='out'/>"
+	"  </method>"
+	"  <method name='RestartUnit'>"
+	"   <arg name='name' type='s' direction='in'/>"
+	"   <arg name='mode' type='s' direction='in'/>"
+	"   <arg name='job' type='o' direction='out'/>"
+	"  </method>"
+	"  <method name='StopUnit'>"
+	"   <arg name='name' type='s' direction='in'/>"
+	"   <arg name='mode' type='s' direction='in'/>"
+	"   <arg name='job' type='o' direction='out'/>"
+	"  </method>"
+	"  <signal name='JobRemoved'>"
+	"   <arg name='id' type='u'/>"
+	"   <arg name='job' type='o'/>"
+	"   <arg name='unit' type='s'/>"
+	"   <arg name='result' type='s'/>"
+	"  </signal>"
+	" </interface>"
+	"</node>";
+
+static GTestDBus *test_bus;
+static GDBusConnection *systemd;
+static GString *calls;
+static GMainLoop *loop;
+
+/* Jobs either finish before the caller hears about them, or after */
+static gboolean job_finishes_early;
+static gboolean job_never_finishes;
+static guint job_ids;
+
+typedef struct {
+	guint32 id;
+	gchar *job;
+	gchar *unit;
+} JobRemoved;
+
+static gboolean
+on_emit_job_removed (gpointer user_data)
+{
+	JobRemoved *removed = user_data;
+	GError *error = NULL;
+
+	g_dbus_connection_emit_signal (systemd, NULL, "/org/freedesktop/systemd1",
+	                               "org.freedesktop.systemd1.Manager", "JobRemoved",
+	                               g_variant_new ("(uoss)", removed->id, removed->job,
+	                                              removed->unit, "done"),
+	                               &error);
+	g_assert_no_error (error);
+
+	g_free (removed->job);
+	g_free (removed->unit);
+	g_free (removed);
+	return FALSE;
+}
+
+static void
+on_systemd_method (GDBusConnection *connection,
+                   const gchar *sender,
+                   const gchar *object_path,
+                   const gchar *interface_name,
+                   const gchar *method_name,
+                   GVariant *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer user_data)
+{
+	JobRemoved *removed;
+	const gchar **units;
+	GVariant *reply;
+	const gchar *unit;
+
+	if (g_str_equal (method_name, "Subscribe")) {
+		g_dbus_method_invocation_return_value (invocation, NULL);
+		return;
+	}
+
+	if (calls->len)
+		g_string_append_c (calls, ' ');
+	g_string_append (calls, method_name);
+
+	if (g_str_equal (method_name, "Reload")) {
+		g_dbus_method_invocation_return_value (invocation, NULL);
+
+	} else if (g_str_equal (method_name, "EnableUnitFiles") ||
+	           g_str_equal (method_name, "DisableUnitFiles")) {
+		g_variant_get_child (parameters, 0, "^a&s", &units);
+		g_string_append_printf (calls, ":%s", units[0]);
+		g_free (units);
+		if (g_str_equal (method_name, "EnableUnitFiles"))
+			g_dbus_method_invocation_return_value (invocation, g_variant_new_parsed ("(true, @a(sss) [])"));
+		else
+			g_dbus_method_invocation_return_value (invocation, g_variant_new_parsed ("(@a(sss) [],)"));
+
+	} else {
+		g_variant_get (parameters, "(&s&s)", &unit, NULL);
+		g_string_append_printf (calls, ":%s", unit);
+
+		removed = g_new0 (JobRemoved, 1);
+		removed->id = ++job_ids;
+		removed->job = g_strdup_printf ("/org/freedesktop/systemd1/job/%u", removed->id);
+		removed->unit = g_strdup (unit);
+
+		if (job_never_finishes) {
+			g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", removed->job));
+			g_free (removed->job);
+			g_free (removed->unit);
+			g_free (removed);
+		} else if (job_finishes_early) {
+			reply = g_variant_new ("(o)", removed->job);
+			on_emit_job_removed (removed);
+			g_dbus_method_invocation_return_value (invocation, reply);
+		} else {
+			g_dbus_method_invocation_return_value (invocation, g_variant_new ("(o)", removed->job));
+			g_timeout_add (20, on_emit_job_removed, removed);
+		}
+	}
+}
+
+static const GDBusInterfaceVTable systemd_vtable = {
+	on_systemd_method,
+	NULL,
+	NULL,
+};
+
+static void
+systemd_request_name (const gchar *method,
+                      GVariant *args)
+{
+	GError *error = NULL;
+	GVariant *retval;
+
+	retval = g_dbus_connection_call_sync (systemd, "org.freedesktop.DBus",
+	                                      "/org/freedesktop/DBus", "org.freedesktop.DBus",
+	                                      method, args, G_VARIANT_TYPE ("(u)"),
+	                                      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+	g_assert_no_error (error);
+	g_variant_unref (retval);
+}
+
+static void
+setup (gpointer unused,
+       gconstpointer data)
+{
+	calls = g_string_new ("");
+	job_finishes_early = FALSE;
+	job_never_finishes = FALSE;
+}
+
+static void
+teardown (gpointer unused,
+          gconstpointer data)
+{
+	g_string_free (calls, TRUE);
+	calls = NULL;
+}
+
+static void
+on_ready_get_result (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	GAsyncResult **place = user_data;
+	*place = g_object_ref (result);
+	g_main_loop_quit (loop);
+}
+
+static void
+test_enable_and_restart (gpointer unused,
+                         gconstpointer data)
+{
+	GAsyncResult *result = NULL;
+	GError *error = NULL;
+
+	realm_service_enable_and_restart ("sssd", NULL, on_ready_get_result, &result);
+	g_main_loop_run (loop);
+
+	realm_service_enable_and_restart_finish (result, &error);
+	g_assert_no_error (error);
+	g_object_unref (result);
+
+	g_assert_cmpstr (calls->str, ==, "EnableUnitFiles:sssd.service Reload RestartUnit:sssd.service");
+}
+
+static void
+test_disable_and_stop (gpointer unused,
+                       gconstpointer data)
+{
+	GAsyncResult *result = NULL;
+	GError *error = NULL;
+
+	job_finishes_early = TRUE;
+
+	realm_service_disable_and_stop ("winbind", NULL, on_ready_get_result, &result);
+	g_main_loop_run (loop);
+
+	realm_service_disable_and_stop_finish (result, &error);
+	g_assert_no_error (error);
+	g_object_unref (result);
+
+	g_assert_cmpstr (calls->str, ==, "DisableUnitFiles:winbind.service Reload StopUnit:winbind.service");
+}
+
+static void
+test_job_timeout (gpointer unused,
+                  gconstpointer data)
+{
+	GAsyncResult *result = NULL;
+	GError *error = NULL;
+	gint64 started;
+
+	/* A stuck job is given up on like a failed one */
+	job_never_finishes = TRUE;
+	realm_settings_add ("commands", "sssd-restart-service.timeout", "1");
+
+	started = g_get_monotonic_time ();
+	realm_service_restart ("sssd", NULL, on_ready_get_result, &result);
+	g_main_loop_run (loop);
+
+	realm_service_restart_finish (result, &error);
+	g_assert_no_error (error);
+	g_object_unref (result);
+
+	g_assert_cmpint (g_get_monotonic_time () - started, <, 5 * G_USEC_PER_SEC);
+	g_assert_cmpstr (calls->str, ==, "RestartUnit:sssd.service");
+}
+
+static void
+test_skipped_command (gpointer unused,
+                      gconstpointer data)
+{
+	GAsyncResult *result = NULL;
+	GError *error = NULL;
+
+	/* A blank command means don't touch the service at all */
+	realm_settings_add ("commands", "sssd-restart-service", " ");
+
+	realm_service_restart ("sssd", NULL, on_ready_get_result, &result);
+	g_main_loop_run (loop);
+
+	realm_service_restart_finish (result, &error);
+	g_assert_no_error (error);
+	g_object_unref (result);
+
+	g_assert_cmpstr (calls->str, ==, "command:sssd-restart-service");
+}
+
+static void
+test_no_systemd (gpointer unused,
+                 gconstpointer data)
+{
+	GAsyncResult *result = NULL;
+	GError *error = NULL;
+
+	systemd_request_name ("ReleaseName", g_variant_new ("(s)", "org.freedesktop.systemd1"));
+
+	realm_service_stop ("winbind", NULL, on_ready_get_result, &result);
+	g_main_loop_run (loop);
+
+	realm_service_stop_finish (result, &error);
+	g_assert_no_error (error);
+	g_object_unref (result);
+
+	g_assert_cmpstr (calls->str, ==, "command:winbind-stop-service");
+}
+
+int
+main (int argc,
+      char **argv)
+{
+	GDBusNodeInfo *info;
+	GError *error = NULL;
+	int ret;
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-service");
+
+	realm_settings_init ();
+	realm_settings_add ("service", "service-manager", "systemd");
+
+	/* The fake systemd is on a private bus standing in for the system bus */
+	test_bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+	g_test_dbus_up (test_bus);
+	g_setenv ("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address (test_bus), TRUE);
+
+	systemd = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (test_bus),
+	                                                  G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+	                                                  G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+	                                                  NULL, NULL, &error);
+	g_assert_no_error (error);
+
+	info = g_dbus_node_info_new_for_xml (systemd_xml, &error);
+	g_assert_no_error (error);
+	g_dbus_connection_register_object (systemd, "/org/freedesktop/systemd1", info->interfaces[0],
+	                                   &systemd_vtable, NULL, NULL, &error);
+	g_assert_no_error (error);
+	systemd_request_name ("RequestName", g_variant_new ("(su)", "org.freedesktop.systemd1", 4));
+
+	loop = g_main_loop_new (NULL, FALSE);
+
+	g_test_add ("/realmd/service/enable-and-restart", gpointer, NULL, setup, test_enable_and_restart, teardown);
+	g_test_add ("/realmd/service/disable-and-stop", gpointer, NULL, setup, test_disable_and_stop, teardown);
+	g_test_add ("/realmd/service/job-timeout", gpointer, NULL, setup, test_job_timeout, teardown);
+	g_test_add ("/realmd/service/skipped-command", gpointer, NULL, setup, test_skipped_command, teardown);
+	g_test_add ("/realmd/service/no-systemd", gpointer, NULL, setup, test_no_systemd, teardown);
+
+	ret = g_test_run ();
+
+	g_main_loop_unref (loop);
+	g_dbus_node_info_unref (info);
+	g_dbus_connection_close_sync (systemd, NULL, NULL);
+	g_object_unref (systemd);
+	g_test_dbus_down (test_bus);
+	g_object_unref (test_bus);
+	realm_settings_uninit ();
+
+	return ret;
+}
+
+/* Dummy functions */
+
+gboolean
+realm_daemon_is_install_mode (void)
+{
+	return FALSE;
+}
+
+GCancellable *
+realm_invocation_get_cancellable (GDBusMethodInvocation *invocation)
+{
+	return NULL;
+}
+
+void
+realm_diagnostics_info (GDBusMethodInvocation *invocation,
+                        const gchar *format,
+                        ...)
+{
+
+}
+
+void
+realm_command_run_known_async (const gchar *known_command,
+                               gchar **environ,
+                               GDBusMethodInvocation *invocation,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data)
+{
+	GTask *task;
+
+	if (calls->len)
+		g_string_append_c (calls, ' ');
+	g_string_append_printf (calls, "command:%s", known_command);
+
+	task = g_task_new (NULL, NULL, callback, user_data);
+	g_task_return_int (task, 0);
+	g_object_unref (task);
+}
+
+gint
+realm_command_run_finish (GAsyncResult *result,
+                          GString **output,
+                          GError **error)
+{
+	return g_task_propagate_int (G_TASK (result), error);
+}
+
+guint
+realm_command_get_timeout (const gchar *name,
+                           guint default_timeout)
+{
+	gdouble timeout;
+	gchar *key;
+
+	key = g_strdup_printf ("%s.timeout", name);
+	timeout = realm_settings_double ("commands", key, default_timeout);
+	g_free (key);
+
+	return timeout > 0 ? (guint)timeout : 0;
+}
@@ -33,6 +33,7 @@
 struct _RealmClient {
 	GDBusObjectManagerClient parent;
 	RealmDbusProvider *provider;
+	RealmDbusService *service;
 	GPid peer_pid;
 };
 
@@ -75,6 +76,8 @@ realm_client_finalize (GObject *obj)
 
 	if (self->provider)
 		g_object_unref (self->provider);
+	if (self->service)
+		g_object_unref (self->service);
 
 	G_OBJECT_CLASS (realm_client_parent_class)->finalize (obj);
 }
@@ -216,6 +219,7 @@ realm_client_new_on_connection (GDBusConnection *connection,
 	if (ret != NULL) {
 		client = REALM_CLIENT (ret);
 		client->provider = g_object_ref (provider);
+		client->service = g_object_ref (service);
 		g_dbus_proxy_set_default_timeout (G_DBUS_PROXY (provider), G_MAXINT);
 
 		/* On Ctrl-C send a cancel to the server */
@@ -418,6 +422,86 @@ realm_client_discover (RealmClient *self,
 	return g_list_reverse (realms);
 }
 
+GVariant *
+realm_client_discover_many (RealmClient *self,
+                            const gchar **strings,
+                            const gchar *client_software,
+                            const gchar *server_software,
+                            const gchar *membership_software,
+                            GError **error)
+{
+	GVariant *results = NULL;
+	GVariant *options;
+	SyncClosure sync;
+	gboolean ret;
+
+	g_return_val_if_fail (REALM_IS_CLIENT (self), NULL);
+	g_return_val_if_fail (strings != NULL, NULL);
+
+	sync.result = NULL;
+	sync.loop = g_main_loop_new (NULL, FALSE);
+
+	options = realm_build_options (REALM_DBUS_OPTION_CLIENT_SOFTWARE, client_software,
+	                               REALM_DBUS_OPTION_SERVER_SOFTWARE, server_software,
+	                               REALM_DBUS_OPTION_MEMBERSHIP_SOFTWARE, membership_software,
+	                               NULL);
+
+	realm_dbus_provider_call_discover_many (self->provider, strings, options,
+	                                        NULL, on_complete_get_result, &sync);
+
+	/* This mainloop is quit by on_complete_get_result */
+	g_main_loop_run (sync.loop);
+
+	ret = realm_dbus_provider_call_discover_many_finish (self->provider, &results,
+	                                                     sync.result, error);
+
+	g_object_unref (sync.result);
+	g_main_loop_unref (sync.loop);
+
+	if (!ret)
+		return NULL;
+
+	return results;
+}
+
+GVariant *
+realm_client_get_last_operation_timings (RealmClient *self,
+                                         const gchar *operation,
+                                         GError **error)
+{
+	GVariant *timings = NULL;
+
+	g_return_val_if_fail (REALM_IS_CLIENT (self), NULL);
+
+	if (operation == NULL)
+		operation = "";
+
+	if (!realm_dbus_service_call_get_last_operation_timings_sync (self->service, operation,
+	                                                              &timings, NULL, error))
+		return NULL;
+
+	return timings;
+}
+
+GVariant *
+realm_client_get_domain_controller_status (RealmClient *self,
+                                           const gchar *domain,
+                                           GError **error)
+{
+	GVariant *controllers = NULL;
+
+	g_return_val_if_fail (REALM_IS_CLIENT (self), NULL);
+
+	if (domain == NULL)
+		domain = "";
+
+	if (!realm_dbus_service_call_get_domain_controller_status_sync (self->service, domain,
+	                                                                &controllers, NULL, error))
+		return NULL;
+
+	return controllers;
+}
+
 RealmDbusRealm *
 realm_client_get_realm (RealmClient *self,
                         const gchar *object_path)
@@ -47,6 +47,21 @@ GList *                        realm_client_discover                 (RealmClien
                                                                       gboolean *had_mismatched,
                                                                       GError **error);
 
+GVariant *                     realm_client_discover_many            (RealmClient *self,
+                                                                      const gchar **strings,
+                                                                      const gchar *client_software,
+                                                                      const gchar *server_software,
+                                                                      const gchar *membership_software,
+                                                                      GError **error);
+
+GVariant *                     realm_client_get_last_operation_timings (RealmClient *self,
+                                                                        const gchar *operation,
+                                                                        GError **error);
+
+GVariant *                     realm_client_get_domain_controller_status (RealmClient *self,
+                                                                          const gchar *domain,
+                                                                          GError **error);
+
 RealmDbusRealm *               realm_client_get_realm                (RealmClient *self,
                                                                       const gchar *object_path);
 
@@ -111,31 +111,73 @@ print_realm_info (RealmClient *client,
 	}
 }
 
+static void
+print_timings (RealmClient *client)
+{
+	const gchar *name;
+	const gchar *server;
+	const gchar *failure;
+	GError *error = NULL;
+	GVariant *timings;
+	GVariant *phases;
+	GVariant *phase;
+	GVariantIter iter;
+	gint64 offset;
+	gint64 duration;
+
+	timings = realm_client_get_last_operation_timings (client, realm_operation_id, &error);
+	if (error != NULL) {
+		realm_handle_error (error, _("Couldn't get discovery timings"));
+		return;
+	}
+
+	if (!g_variant_lookup (timings, REALM_DBUS_TIMING_DURATION, "x", &duration)) {
+		g_print ("  timings: none\n");
+		g_variant_unref (timings);
+		return;
+	}
+
+	g_print ("  timings: %.1f ms\n", duration / 1000.0);
+
+	phases = g_variant_lookup_value (timings, REALM_DBUS_TIMING_PHASES, G_VARIANT_TYPE ("aa{sv}"));
+	if (phases) {
+		g_variant_iter_init (&iter, phases);
+		while ((phase = g_variant_iter_next_value (&iter)) != NULL) {
+			if (!g_variant_lookup (phase, REALM_DBUS_TIMING_PHASE, "&s", &name))
+				name = "unknown";
+			if (!g_variant_lookup (phase, REALM_DBUS_TIMING_SERVER, "&s", &server))
+				server = NULL;
+			if (!g_variant_lookup (phase, REALM_DBUS_TIMING_ERROR, "&s", &failure))
+				failure = NULL;
+			if (!g_variant_lookup (phase, REALM_DBUS_TIMING_OFFSET, "x", &offset))
+				offset = 0;
+			if (!g_variant_lookup (phase, REALM_DBUS_TIMING_DURATION, "x", &duration))
+				duration = 0;
+
+			g_print ("    %8.1f ms %8.1f ms  %s%s%s%s%s\n",
+			         offset / 1000.0, duration / 1000.0, name,
+			         server ? " " : "", server ? server : "",
+			         failure ? ": " : "", failure ? failure : "");
+			g_variant_unref (phase);
+		}
+		g_variant_unref (phases);
+	}
+
+	g_variant_unref (timings);
+}
+
 static int
-perform_discover (RealmClient *client,
+print_discovered (RealmClient *client,
                   const gchar *string,
+                  GList *realms,
                   gboolean all,
-                  gboolean name_only,
-                  const gchar *server_software,
-                  const gchar *client_software,
-                  const gchar *membership_software)
+                  gboolean name_only)
 {
 	GHashTable *seen;
 	gboolean found = FALSE;
-	GError *error = NULL;
 	const gchar *name;
-	GList *realms;
 	GList *l;
 
-	realms = realm_client_discover (client, string, client_software,
-	                                server_software, membership_software,
-	                                REALM_DBUS_REALM_INTERFACE, NULL, &error);
-
-	if (error != NULL) {
-		realm_handle_error (error, _("Couldn't discover realms"));
-		return 1;
-	}
-
 	seen = g_hash_table_new (g_str_hash, g_str_equal);
 
 	for (l = realms; l != NULL; l = g_list_next (l)) {
@@ -148,7 +190,6 @@ perform_discover (RealmClient *client,
 	}
 
 	g_hash_table_destroy (seen);
-	g_list_free_full (realms, g_object_unref);
 
 	if (!found) {
 		if (string == NULL)
@@ -161,6 +202,115 @@ perform_discover (RealmClient *client,
 	return 0;
 }
 
+static int
+perform_discover (RealmClient *client,
+                  const gchar *string,
+                  gboolean all,
+                  gboolean name_only,
+                  gboolean timings,
+                  const gchar *server_software,
+                  const gchar *client_software,
+                  const gchar *membership_software)
+{
+	GError *error = NULL;
+	GList *realms;
+	int ret;
+
+	realms = realm_client_discover (client, string, client_software,
+	                                server_software, membership_software,
+	                                REALM_DBUS_REALM_INTERFACE, NULL, &error);
+
+	if (error != NULL) {
+		realm_handle_error (error, _("Couldn't discover realms"));
+		if (timings)
+			print_timings (client);
+		return 1;
+	}
+
+	ret = print_discovered (client, string, realms, all, name_only);
+	g_list_free_full (realms, g_object_unref);
+
+	if (timings)
+		print_timings (client);
+
+	return ret;
+}
+
+static int
+perform_discover_many (RealmClient *client,
+                       const gchar **strings,
+                       gboolean all,
+                       gboolean name_only,
+                       gboolean timings,
+                       const gchar *server_software,
+                       const gchar *client_software,
+                       const gchar *membership_software)
+{
+	const gchar *string;
+	const gchar *failure;
+	GError *error = NULL;
+	RealmDbusRealm *realm;
+	GVariantIter *paths;
+	GVariantIter iter;
+	GVariant *results;
+	const gchar *path;
+	gint relevance;
+	GList *realms;
+	gint result = 0;
+	gint ret;
+	gint i;
+
+	results = realm_client_discover_many (client, strings, client_software,
+	                                      server_software, membership_software,
+	                                      &error);
+
+	/* An older realmd, discover one by one instead */
+	if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+		g_clear_error (&error);
+		for (i = 0; strings[i] != NULL; i++) {
+			ret = perform_discover (client, strings[i], all, name_only, timings,
+			                        server_software, client_software,
+			                        membership_software);
+			if (ret != 0)
+				result = ret;
+		}
+		return result;
+	}
+
+	if (error != NULL) {
+		realm_handle_error (error, _("Couldn't discover realms"));
+		return 1;
+	}
+
+	g_variant_iter_init (&iter, results);
+	while (g_variant_iter_loop (&iter, "(&siao&s)", &string, &relevance, &paths, &failure)) {
+		if (!g_str_equal (failure, "")) {
+			realm_handle_error (NULL, _("Couldn't discover realms for %s: %s"), string, failure);
+			result = 1;
+			continue;
+		}
+
+		realms = NULL;
+		while (g_variant_iter_next (paths, "&o", &path)) {
+			realm = realm_client_get_realm (client, path);
+			if (realm != NULL)
+				realms = g_list_prepend (realms, realm);
+		}
+
+		realms = g_list_reverse (realms);
+		if (print_discovered (client, string, realms, all, name_only) != 0)
+			result = 1;
+		g_list_free_full (realms, g_object_unref);
+	}
+
+	g_variant_unref (results);
+
+	if (timings)
+		print_timings (client);
+
+	return result;
+}
+
 int
 realm_discover (RealmClient *client,
                 int argc,
@@ -173,9 +323,8 @@ realm_discover (RealmClient *client,
 	GError *error = NULL;
 	gboolean arg_all = FALSE;
 	gboolean arg_name_only = FALSE;
+	gboolean arg_timings = FALSE;
 	gint result = 0;
-	gint ret;
-	gint i;
 
 	GOptionEntry option_entries[] = {
 		{ "all", 'a', 0, G_OPTION_ARG_NONE, &arg_all, N_("Show all discovered realms"), NULL },
@@ -183,6 +332,7 @@ realm_discover (RealmClient *client,
 		{ "client-software", 0, 0, G_OPTION_ARG_STRING, &arg_client_software, N_("Use specific client software"), NULL },
 		{ "membership-software", 0, 0, G_OPTION_ARG_STRING, &arg_membership_software, N_("Use specific membership software"), NULL },
 		{ "server-software", 0, 0, G_OPTION_ARG_STRING, &arg_server_software, N_("Use specific server software"), NULL },
+		{ "timings", 0, 0, G_OPTION_ARG_NONE, &arg_timings, N_("Show how long each part of discovery took"), NULL },
 		{ NULL, }
 	};
 
@@ -199,22 +349,26 @@ realm_discover (RealmClient *client,
 	/* The default realm? */
 	} else if (argc == 1) {
 		result = perform_discover (client, NULL, arg_all,
-		                           arg_name_only,
+		                           arg_name_only, arg_timings,
 		                           arg_server_software,
 		                           arg_client_software,
 		                           arg_membership_software);
 
-	/* Specific realms */
+	/* A specific realm */
+	} else if (argc == 2) {
+		result = perform_discover (client, argv[1], arg_all,
+		                           arg_name_only, arg_timings,
+		                           arg_server_software,
+		                           arg_client_software,
+		                           arg_membership_software);
+
+	/* Several realms, discovered concurrently by the service */
 	} else {
-		for (i = 1; i < argc; i++) {
-			ret = perform_discover (client, argv[i], arg_all,
-			                        arg_name_only,
-			                        arg_server_software,
-			                        arg_client_software,
-			                        arg_membership_software);
-			if (ret != 0)
-				result = ret;
-		}
+		result = perform_discover_many (client, (const gchar **)argv + 1,
+		                                arg_all, arg_name_only, arg_timings,
+		                                arg_server_software,
+		                                arg_client_software,
+		                                arg_membership_software);
 	}
 
 	g_free (arg_server_software);
@@ -295,3 +449,84 @@ realm_list (RealmClient *client,
 	g_option_context_free (context);
 	return ret;
 }
+
+static int
+perform_dc_status (RealmClient *client,
+                   const gchar *domain)
+{
+	const gchar *address;
+	const gchar *hostname;
+	const gchar *value;
+	GError *error = NULL;
+	GVariant *controllers;
+	GVariant *controller;
+	GVariantIter iter;
+	gboolean bad;
+	gdouble number;
+	guint32 count;
+
+	controllers = realm_client_get_domain_controller_status (client, domain, &error);
+	if (error != NULL) {
+		realm_handle_error (error, _("Couldn't get domain controller status"));
+		return 1;
+	}
+
+	if (g_variant_n_children (controllers) == 0 && realm_verbose)
+		g_printerr ("No known domain controllers\n");
+
+	g_variant_iter_init (&iter, controllers);
+	while ((controller = g_variant_iter_next_value (&iter)) != NULL) {
+		if (!g_variant_lookup (controller, REALM_DBUS_DC_ADDRESS, "&s", &address))
+			address = "unknown";
+		if (!g_variant_lookup (controller, REALM_DBUS_DC_HOSTNAME, "&s", &hostname))
+			hostname = NULL;
+
+		g_print ("%s\n", hostname ? hostname : address);
+		g_print ("  address: %s\n", address);
+		if (g_variant_lookup (controller, REALM_DBUS_DC_DOMAIN, "&s", &value))
+			g_print ("  domain: %s\n", value);
+		if (g_variant_lookup (controller, REALM_DBUS_DC_RTT, "d", &number))
+			g_print ("  round-trip: %.1f ms\n", number);
+		if (g_variant_lookup (controller, REALM_DBUS_DC_SUCCESSES, "u", &count))
+			g_print ("  successes: %u\n", count);
+		if (g_variant_lookup (controller, REALM_DBUS_DC_FAILURES, "d", &number))
+			g_print ("  recent-failures: %.2f\n", number);
+		if (!g_variant_lookup (controller, REALM_DBUS_DC_BAD, "b", &bad))
+			bad = FALSE;
+		g_print ("  status: %s\n", bad ? "failing" : "ok");
+		g_variant_unref (controller);
+	}
+
+	g_variant_unref (controllers);
+	return 0;
+}
+
+int
+realm_dc_status (RealmClient *client,
+                 int argc,
+                 char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	gint ret = 0;
+
+	context = g_option_context_new ("dc-status [DOMAIN]");
+	g_option_context_set_translation_domain (context, GETTEXT_PACKAGE);
+	g_option_context_add_main_entries (context, realm_global_options, NULL);
+
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+		g_error_free (error);
+		ret = 2;
+
+	} else if (argc > 2) {
+		g_printerr ("%s: specify one domain\n", g_get_prgname ());
+		ret = 2;
+
+	} else {
+		ret = perform_dc_status (client, argc == 2 ? argv[1] : NULL);
+	}
+
+	g_option_context_free (context);
+	return ret;
+}
@@ -49,6 +49,10 @@ int                   realm_list                   (RealmClient *client,
                                                     int argc,
                                                     char *argv[]);
 
+int                   realm_dc_status              (RealmClient *client,
+                                                    int argc,
+                                                    char *argv[]);
+
 int                   realm_permit                 (RealmClient *client,
                                                     int argc,
                                                     char *argv[]);